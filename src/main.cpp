@@ -1,21 +1,55 @@
 #include <ai.h>
 #include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <ctime>
 #include <string>
 #include <iostream>
 #include <map>
+#include <set>
 #include <vector>
 #include <deque>
+#include <algorithm>
+#include <new>
+#include <sys/stat.h>
 #include <Field3D/InitIO.h>
 #include <Field3D/FieldIO.h>
 #include <Field3D/Field3DFile.h>
 #include <Field3D/FieldInterp.h>
 #include <Field3D/DenseField.h>
 #include <Field3D/SparseField.h>
+#include <Field3D/SparseFile.h>
+#include <Field3D/MIPField.h>
 #include <Field3D/EmptyField.h>
 #include <Field3D/FieldSampler.h>
 #include <Field3D/FieldMapping.h>
 #include <Field3D/FieldMetadata.h>
 #include <OpenEXR/ImathBoxAlgo.h>
+// Field3DInputFile reads Ogawa backed files since Field3D 1.6
+#if defined(FIELD3D_MAJOR_VER) && (FIELD3D_MAJOR_VER > 1 || (FIELD3D_MAJOR_VER == 1 && FIELD3D_MINOR_VER >= 6))
+#  define F3D_OGAWA_SUPPORT
+#endif
+#ifdef _MSC_VER
+#  include <intrin.h>
+#endif
+#ifdef _WIN32
+#  ifndef NOMINMAX
+#    define NOMINMAX
+#  endif
+#  include <windows.h>
+#  include <sys/utime.h>
+#else
+#  include <unistd.h>
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <signal.h>
+#  include <errno.h>
+#  include <dirent.h>
+#  include <glob.h>
+#  include <utime.h>
+#  include <sys/time.h>
+#  include <sys/wait.h>
+#endif
 
 // ---
 
@@ -32,9 +66,21 @@ enum FieldType
    FT_dense = 0,
    FT_sparse,
    FT_mac,
+   FT_bricked,
+   FT_quantized,
+   FT_compressed,
+   FT_mapped,
    FT_unknown
 };
 
+enum FileFormat
+{
+   FF_hdf5 = 0,
+   FF_ogawa,
+   FF_vdb,
+   FF_unknown
+};
+
 enum SampleMergeType
 {
    SMT_add = 0,
@@ -128,6 +174,270 @@ static const char* ShutterTimeTypeToString(ShutterTimeType t)
    }
 }
 
+enum StoragePrecision
+{
+   SP_native = 0,
+   SP_half,
+   SP_float,
+   SP_q16,
+   SP_q8,
+   SP_unknown
+};
+
+static StoragePrecision StoragePrecisionFromString(const std::string &s)
+{
+   if (s == "half")
+   {
+      return SP_half;
+   }
+   else if (s == "float")
+   {
+      return SP_float;
+   }
+   else if (s == "q16")
+   {
+      return SP_q16;
+   }
+   else if (s == "q8")
+   {
+      return SP_q8;
+   }
+   else
+   {
+      return SP_unknown;
+   }
+}
+
+static const char* StoragePrecisionToString(StoragePrecision p)
+{
+   switch (p)
+   {
+   case SP_half:
+      return "half";
+   case SP_float:
+      return "float";
+   case SP_q16:
+      return "q16";
+   case SP_q8:
+      return "q8";
+   default:
+      return "";
+   }
+}
+
+// Bytes per component
+static size_t StoragePrecisionSize(StoragePrecision p)
+{
+   switch (p)
+   {
+   case SP_half:
+   case SP_q16:
+      return 2;
+   case SP_float:
+      return 4;
+   case SP_q8:
+      return 1;
+   default:
+      return 0;
+   }
+}
+
+// Minimal atomic integer (no C++11 requirement)
+class AtomicInt
+{
+public:
+
+   explicit AtomicInt(long value=0)
+      : mValue(value)
+   {
+   }
+
+   long get() const
+   {
+      return const_cast<AtomicInt*>(this)->add(0);
+   }
+   
+   // Plain read with acquire semantics (no locked instruction), for hot paths
+   long load() const
+   {
+      #ifdef _MSC_VER
+      long value = mValue;
+      _ReadWriteBarrier();
+      return value;
+      #else
+      return __atomic_load_n(&mValue, __ATOMIC_ACQUIRE);
+      #endif
+   }
+
+   void set(long value)
+   {
+      long cur = get();
+      while (!compareAndSwap(cur, value))
+      {
+         cur = get();
+      }
+   }
+
+   // returns the new value
+   long add(long delta)
+   {
+      #ifdef _MSC_VER
+      return _InterlockedExchangeAdd(&mValue, delta) + delta;
+      #else
+      return __sync_add_and_fetch(&mValue, delta);
+      #endif
+   }
+
+   bool compareAndSwap(long expected, long value)
+   {
+      #ifdef _MSC_VER
+      return (_InterlockedCompareExchange(&mValue, value, expected) == expected);
+      #else
+      return __sync_bool_compare_and_swap(&mValue, expected, value);
+      #endif
+   }
+
+private:
+
+   AtomicInt(const AtomicInt&);
+   AtomicInt& operator=(const AtomicInt&);
+
+   volatile long mValue;
+};
+
+static int GetProcessorCount()
+{
+   #ifdef _WIN32
+   SYSTEM_INFO si;
+   GetSystemInfo(&si);
+   return int(si.dwNumberOfProcessors);
+   #else
+   long n = sysconf(_SC_NPROCESSORS_ONLN);
+   return (n > 0 ? int(n) : 1);
+   #endif
+}
+
+// Wall clock time in seconds
+static double GetTime()
+{
+   #ifdef _WIN32
+   LARGE_INTEGER freq, count;
+   QueryPerformanceFrequency(&freq);
+   QueryPerformanceCounter(&count);
+   return double(count.QuadPart) / double(freq.QuadPart);
+   #else
+   struct timeval tv;
+   gettimeofday(&tv, 0);
+   return double(tv.tv_sec) + 1.0e-6 * double(tv.tv_usec);
+   #endif
+}
+
+// Interactive sessions (IPR) keep the scene data after rendering for further updates
+static bool IsInteractiveSession()
+{
+   AtNode *opts = AiUniverseGetOptions();
+   
+   return (opts && AiNodeEntryLookUpParameter(AiNodeGetNodeEntry(opts), "preserve_scene_data") &&
+           AiNodeGetBool(opts, "preserve_scene_data"));
+}
+
+// Thread count from options node (0 means all cores, negative values all cores but N)
+static int GetArnoldThreadCount()
+{
+   AtNode *opts = AiUniverseGetOptions();
+   
+   int n = (opts ? AiNodeGetInt(opts, "threads") : 0);
+   
+   if (n <= 0)
+   {
+      n += GetProcessorCount();
+   }
+   
+   return std::max(1, n);
+}
+
+// Simple worker pool: run(index) is called once for each index in [0, count)
+class ParallelTask
+{
+public:
+   
+   virtual ~ParallelTask()
+   {
+   }
+   
+   virtual void run(size_t index) = 0;
+};
+
+struct ParallelRun
+{
+   ParallelTask *task;
+   size_t count;
+   AtomicInt next;
+   
+   ParallelRun(ParallelTask *t, size_t n)
+      : task(t)
+      , count(n)
+      , next(0)
+   {
+   }
+};
+
+static unsigned int ParallelWorker(void *data)
+{
+   ParallelRun *run = (ParallelRun*) data;
+   
+   size_t i = size_t(run->next.add(1) - 1);
+   
+   while (i < run->count)
+   {
+      run->task->run(i);
+      i = size_t(run->next.add(1) - 1);
+   }
+   
+   return 0;
+}
+
+static void RunParallel(ParallelTask &task, size_t count, int numThreads, int priority=AI_PRIORITY_NORMAL)
+{
+   if (count == 0)
+   {
+      return;
+   }
+   
+   if (numThreads <= 1 || count == 1)
+   {
+      for (size_t i=0; i<count; ++i)
+      {
+         task.run(i);
+      }
+      return;
+   }
+   
+   ParallelRun run(&task, count);
+   
+   // calling thread also processes tasks
+   std::vector<void*> threads;
+   size_t n = std::min(size_t(numThreads), count) - 1;
+   
+   for (size_t i=0; i<n; ++i)
+   {
+      void *thread = AiThreadCreate(ParallelWorker, &run, priority);
+      
+      if (thread)
+      {
+         threads.push_back(thread);
+      }
+   }
+   
+   ParallelWorker(&run);
+   
+   for (size_t i=0; i<threads.size(); ++i)
+   {
+      AiThreadWait(threads[i]);
+      AiThreadClose(threads[i]);
+   }
+}
+
 
 template <typename ValueType> struct ArnoldType { enum { Value = AI_TYPE_UNDEFINED }; };
 template <> struct ArnoldType<Field3D::half> { enum { Value = AI_TYPE_FLOAT }; };
@@ -339,1007 +649,7726 @@ struct SampleField<Field3D::MACField<FIELD3D_VEC3_T<DataType> > >
 };
 
 
-struct ScalarFieldData
+// Huge pages backing of arena chunks (-hugePages)
+enum HugePages
 {
-   Field3D::SparseField<Field3D::half>::Ptr sparseh;
-   Field3D::SparseField<float>::Ptr sparsef;
-   Field3D::SparseField<double>::Ptr sparsed;
-   
-   Field3D::DenseField<Field3D::half>::Ptr denseh;
-   Field3D::DenseField<float>::Ptr densef;
-   Field3D::DenseField<double>::Ptr densed;
+   HP_none = 0,
+   HP_transparent,
+   HP_explicit,
+   HP_unknown
 };
 
-struct VectorFieldData
+static HugePages HugePagesFromString(const std::string &s)
 {
-   Field3D::SparseField<Field3D::V3h>::Ptr sparseh;
-   Field3D::SparseField<Field3D::V3f>::Ptr sparsef;
-   Field3D::SparseField<Field3D::V3d>::Ptr sparsed;
-   
-   Field3D::DenseField<Field3D::V3h>::Ptr denseh;
-   Field3D::DenseField<Field3D::V3f>::Ptr densef;
-   Field3D::DenseField<Field3D::V3d>::Ptr densed;
-   
-   Field3D::MACField<Field3D::V3h>::Ptr mach;
-   Field3D::MACField<Field3D::V3f>::Ptr macf;
-   Field3D::MACField<Field3D::V3d>::Ptr macd;
-};
+   if (s == "none")
+   {
+      return HP_none;
+   }
+   else if (s == "transparent")
+   {
+      return HP_transparent;
+   }
+   else if (s == "explicit")
+   {
+      return HP_explicit;
+   }
+   else
+   {
+      return HP_unknown;
+   }
+}
 
+static const char* HugePagesToString(HugePages hp)
+{
+   switch (hp)
+   {
+   case HP_transparent:
+      return "transparent";
+   case HP_explicit:
+      return "explicit";
+   default:
+      return "none";
+   }
+}
 
-struct FieldData
+// Voxel storage of the fields built by a layer's conversions (-arena). Memory is
+// carved out of large page aligned chunks, requested from the system directly so
+// that it can be backed by huge pages, and only returned (all at once) when the
+// layer and all its fields are released. Fields keep a reference on the arena.
+class Arena
 {
-   std::string partition;
-   std::string name;
-   size_t globalIndex;
-   size_t partitionIndex;
+public:
    
-   Field3D::FieldRes::Ptr base;
+   enum
+   {
+      ChunkSize = 32 << 20,
+      // huge page size on x86_64 and aarch64 (4k base pages)
+      HugePageSize = 2 << 20,
+      Alignment = 64
+   };
    
-   FieldType type;
-   FieldDataType dataType;
-   bool isVector;
+   static Arena* Create(HugePages hugePages)
+   {
+      Arena *arena = new Arena(hugePages);
+      arena->mRefCount.set(1);
+      return arena;
+   }
    
-   ScalarFieldData scalar;
-   VectorFieldData vector;
+   void ref()
+   {
+      mRefCount.add(1);
+   }
    
-   FieldData *velocityField[3];
+   void unref()
+   {
+      if (mRefCount.add(-1) == 0)
+      {
+         delete this;
+      }
+   }
    
-   bool setup(Field3D::FieldRes::Ptr baseField, FieldDataType dt, bool vec)
+   // Thread safe. Returns 64 bytes aligned memory, throws std::bad_alloc as
+   // operator new when the system is out of memory
+   void* allocate(size_t bytes)
    {
-      type = FT_unknown;
-      dataType = FDT_unknown;
-      isVector = false;
-      base = 0;
-      velocityField[0] = 0;
-      velocityField[1] = 0;
-      velocityField[2] = 0;
+      bytes = (bytes + Alignment - 1) & ~size_t(Alignment - 1);
+      
+      void *ptr = 0;
       
-      if (vec)
+      AiCritSecEnter(&mLock);
+      
+      if (bytes > ChunkSize / 4)
       {
-         switch (dt)
+         // large requests get their own chunk, the current one stays open
+         Chunk chunk;
+         
+         if (allocChunk(bytes, chunk))
          {
-         case FDT_half:
-            vector.sparseh = Field3D::field_dynamic_cast<Field3D::SparseField<Field3D::V3h> >(baseField);
-            if (!vector.sparseh)
-            {
-               vector.denseh = Field3D::field_dynamic_cast<Field3D::DenseField<Field3D::V3h> >(baseField);
-               if (!vector.denseh)
-               {
-                  vector.mach = Field3D::field_dynamic_cast<Field3D::MACField<Field3D::V3h> >(baseField);
-                  if (!vector.mach)
-                  {
-                     return false;
-                  }
-                  else
-                  {
-                     type = FT_mac;
-                  }
-               }
-               else
-               {
-                  type = FT_dense;
-               }
-            }
-            else
-            {
-               type = FT_sparse;
-            }
-            break;
-         case FDT_float:
-            vector.sparsef = Field3D::field_dynamic_cast<Field3D::SparseField<Field3D::V3f> >(baseField);
-            if (!vector.sparsef)
-            {
-               vector.densef = Field3D::field_dynamic_cast<Field3D::DenseField<Field3D::V3f> >(baseField);
-               if (!vector.densef)
-               {
-                  vector.macf = Field3D::field_dynamic_cast<Field3D::MACField<Field3D::V3f> >(baseField);
-                  if (!vector.macf)
-                  {
-                     return false;
-                  }
-                  else
-                  {
-                     type = FT_mac;
-                  }
-               }
-               else
-               {
-                  type = FT_dense;
-               }
-            }
-            else
+            chunk.used = bytes;
+            mChunks.insert(mChunks.begin(), chunk);
+            ptr = chunk.data;
+         }
+      }
+      else
+      {
+         if (mChunks.empty() || mChunks.back().used + bytes > mChunks.back().size)
+         {
+            Chunk chunk;
+            
+            if (allocChunk(ChunkSize, chunk))
             {
-               type = FT_sparse;
+               mChunks.push_back(chunk);
             }
-            break;
-         case FDT_double:
-            vector.sparsed = Field3D::field_dynamic_cast<Field3D::SparseField<Field3D::V3d> >(baseField);
-            if (!vector.sparsed)
-            {
-               vector.densed = Field3D::field_dynamic_cast<Field3D::DenseField<Field3D::V3d> >(baseField);
-               if (!vector.densed)
-               {
-                  vector.macd = Field3D::field_dynamic_cast<Field3D::MACField<Field3D::V3d> >(baseField);
-                  if (!vector.macd)
-                  {
-                     return false;
-                  }
-                  else
-                  {
-                     type = FT_mac;
-                  }
-               }
-               else
-               {
-                  type = FT_dense;
-               }
-            }
-            else
-            {
-               type = FT_sparse;
-            }
-            break;
-         default:
-            return false;
          }
-      }
-      else
-      {
-         switch (dt)
+         
+         if (!mChunks.empty() && mChunks.back().used + bytes <= mChunks.back().size)
          {
-         case FDT_half:
-            scalar.sparseh = Field3D::field_dynamic_cast<Field3D::SparseField<Field3D::half> >(baseField);
-            if (!scalar.sparseh)
-            {
-               scalar.denseh = Field3D::field_dynamic_cast<Field3D::DenseField<Field3D::half> >(baseField);
-               if (!scalar.denseh)
-               {
-                  return false;
-               }
-               else
-               {
-                  type = FT_dense;
-               }
-            }
-            else
-            {
-               type = FT_sparse;
-            }
-            break;
-         case FDT_float:
-            scalar.sparsef = Field3D::field_dynamic_cast<Field3D::SparseField<float> >(baseField);
-            if (!scalar.sparsef)
-            {
-               scalar.densef = Field3D::field_dynamic_cast<Field3D::DenseField<float> >(baseField);
-               if (!scalar.densef)
-               {
-                  return false;
-               }
-               else
-               {
-                  type = FT_dense;
-               }
-            }
-            else
-            {
-               type = FT_sparse;
-            }
-            break;
-         case FDT_double:
-            scalar.sparsed = Field3D::field_dynamic_cast<Field3D::SparseField<double> >(baseField);
-            if (!scalar.sparsed)
-            {
-               scalar.densed = Field3D::field_dynamic_cast<Field3D::DenseField<double> >(baseField);
-               if (!scalar.densed)
-               {
-                  return false;
-               }
-               else
-               {
-                  type = FT_dense;
-               }
-            }
-            else
-            {
-               type = FT_sparse;
-            }
-            break;
-         default:
-            return false;
+            Chunk &chunk = mChunks.back();
+            ptr = chunk.data + chunk.used;
+            chunk.used += bytes;
          }
       }
       
-      base = baseField;
-      isVector = vec;
-      dataType = dt;
+      AiCritSecLeave(&mLock);
       
-      return true;
+      if (!ptr)
+      {
+         throw std::bad_alloc();
+      }
+      
+      return ptr;
    }
    
-   bool sample(const Field3D::V3d &P, int interp, SampleMergeType mergeType, AtParamValue *outValue, AtByte *outType)
+   // Memory reserved from the system
+   size_t reservedBytes() const
    {
-      bool rv = false;
-      
-      switch (type)
+      size_t bytes = 0;
+      for (size_t i=0; i<mChunks.size(); ++i)
       {
-      case FT_sparse:
-         switch (dataType)
-         {
-         case FDT_half:
-            rv = (isVector ? SampleField<Field3D::SparseField<Field3D::V3h> >::Sample(*vector.sparseh, P, interp, mergeType, outValue, outType)
-                           : SampleField<Field3D::SparseField<Field3D::half> >::Sample(*scalar.sparseh, P, interp, mergeType, outValue, outType));
-            break;
-         case FDT_float:
-            rv = (isVector ? SampleField<Field3D::SparseField<Field3D::V3f> >::Sample(*vector.sparsef, P, interp, mergeType, outValue, outType)
-                           : SampleField<Field3D::SparseField<float> >::Sample(*scalar.sparsef, P, interp, mergeType, outValue, outType));
-            break;
-         case FDT_double:
-            rv = (isVector ? SampleField<Field3D::SparseField<Field3D::V3d> >::Sample(*vector.sparsed, P, interp, mergeType, outValue, outType)
-                           : SampleField<Field3D::SparseField<double> >::Sample(*scalar.sparsed, P, interp, mergeType, outValue, outType));
-         default:
-            break;
-         }
-         break;
-      case FT_dense:
-         switch (dataType)
-         {
-         case FDT_half:
-            rv = (isVector ? SampleField<Field3D::DenseField<Field3D::V3h> >::Sample(*vector.denseh, P, interp, mergeType, outValue, outType)
-                           : SampleField<Field3D::DenseField<Field3D::half> >::Sample(*scalar.denseh, P, interp, mergeType, outValue, outType));
-            break;
-         case FDT_float:
-            rv = (isVector ? SampleField<Field3D::DenseField<Field3D::V3f> >::Sample(*vector.densef, P, interp, mergeType, outValue, outType)
-                           : SampleField<Field3D::DenseField<float> >::Sample(*scalar.densef, P, interp, mergeType, outValue, outType));
-            break;
-         case FDT_double:
-            rv = (isVector ? SampleField<Field3D::DenseField<Field3D::V3d> >::Sample(*vector.densed, P, interp, mergeType, outValue, outType)
-                           : SampleField<Field3D::DenseField<double> >::Sample(*scalar.densed, P, interp, mergeType, outValue, outType));
-         default:
-            break;
-         }
-         break;
-      case FT_mac:
-         if (isVector)
+         bytes += mChunks[i].size;
+      }
+      return bytes;
+   }
+   
+   size_t chunkCount() const
+   {
+      return mChunks.size();
+   }
+   
+   // Number of chunks actually backed by explicit huge pages
+   size_t hugeChunkCount() const
+   {
+      size_t count = 0;
+      for (size_t i=0; i<mChunks.size(); ++i)
+      {
+         if (mChunks[i].huge)
          {
-            switch (dataType)
-            {
-            case FDT_half:
-               rv = SampleField<Field3D::MACField<Field3D::V3h> >::Sample(*vector.mach, P, interp, mergeType, outValue, outType);
-               break;
-            case FDT_float:
-               rv = SampleField<Field3D::MACField<Field3D::V3f> >::Sample(*vector.macf, P, interp, mergeType, outValue, outType);
-               break;
-            case FDT_double:
-               rv = SampleField<Field3D::MACField<Field3D::V3d> >::Sample(*vector.macd, P, interp, mergeType, outValue, outType);
-            default:
-               break;
-            }
+            ++count;
          }
-      default:
-         break;
       }
-      
-      return rv;
+      return count;
    }
-};
-
-class VolumeData
-{
-public:
    
-   VolumeData()
-      : mNode(0)
-      , mF3DFile(0)
-      , mIgnoreTransform(false)
-      , mVerbose(false)
-      , mFrame(1.0f)
-      , mFPS(24.0f)
-      , mVelocityScale(1.0f)
-      , mWorldSpaceVelocity(false)
-      , mMotionStartFrame(1.0f)
-      , mMotionEndFrame(1.0f)
-      , mShutterTimeType(STT_normalized)
+   HugePages hugePages() const
    {
+      return mHugePages;
    }
    
-   ~VolumeData()
+private:
+   
+   struct Chunk
    {
-      reset();
-   }
+      unsigned char *data;
+      size_t size;
+      size_t used;
+      bool huge;
+   };
    
-   void reset()
+   Arena(HugePages hugePages)
+      : mHugePages(hugePages)
    {
-      mNode = 0;
-      mPath = "";
-      mPartition = "";
-      mIgnoreTransform = false;
-      mVerbose = false;
-      mFrame = 1.0f;
-      mFPS = 24.0f;
-      mVelocityScale = 1.0f;
-      mWorldSpaceVelocity = false;
-      mMotionStartFrame = mFrame;
-      mMotionEndFrame = mFrame;
-      mShutterTimeType = STT_normalized;
-      mVelocityFields.clear();
-      
-      mFields.clear();
-      mFieldIndices.clear();
-      
-      if (mF3DFile)
-      {
-         delete mF3DFile;
-         mF3DFile = 0;
-      }
+      AiCritSecInit(&mLock);
    }
    
-   bool isIdentical(const VolumeData &rhs) const
+   ~Arena()
    {
-      if (mPath != rhs.mPath)
-      {
-         return false;
-      }
-      
-      if (mPartition != rhs.mPartition)
+      for (size_t i=0; i<mChunks.size(); ++i)
       {
-         return false;
+         #ifdef _WIN32
+         VirtualFree(mChunks[i].data, 0, MEM_RELEASE);
+         #else
+         munmap(mChunks[i].data, mChunks[i].size);
+         #endif
       }
-      
-      // No influence the fields to be read
-      //   mIgnoreTransform 
-      //   mVerbose
-      //   mChannelsMergeType
-      //   mFPS
-      //   mVelocityFields
-      //   mVelocityScale
-      //   mWorldSpaceVelocity
-      //   mMotionStartFrame
-      //   mMotionEndFrame
-      //   mShutterTimeType
-      // 
-      // mFrame influences mPath
-      //
-      // Derived from mPath and mPartition
-      //   mFields
-      //   mFieldIndices
-      
-      return true;
+      AiCritSecClose(&mLock);
    }
    
-   bool init(const AtNode *node, const char *user_string, bool noSetup=false)
+   Arena(const Arena&);
+   Arena& operator=(const Arena&);
+   
+   bool allocChunk(size_t bytes, Chunk &chunk)
    {
-      reset();
-      
-      std::vector<std::string> mergeTypes;
-      std::vector<std::string> velocityFields;
-      std::string shutterTimeType;
-      bool hasMotionStart = false;
-      bool hasMotionEnd = false;
+      chunk.size = (bytes + HugePageSize - 1) & ~size_t(HugePageSize - 1);
+      chunk.used = 0;
+      chunk.huge = false;
+      chunk.data = 0;
       
-      // Figure out frame default value from options node
-      AtNode *opts = AiUniverseGetOptions();
+      #ifdef _WIN32
+      // large pages require the 'lock pages in memory' privilege, not requested here
+      chunk.data = (unsigned char*) VirtualAlloc(NULL, chunk.size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+      #else
+      void *data = MAP_FAILED;
       
-      if (readFloatUserAttr(opts, "frame", mFrame))
+      #ifdef MAP_HUGETLB
+      if (mHugePages == HP_explicit)
       {
-         AiMsgDebug("[volume_field3d] 'frame' read from options node");
+         // fails if not enough huge pages are reserved (vm.nr_hugepages)
+         data = mmap(0, chunk.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+         chunk.huge = (data != MAP_FAILED);
       }
-      if (readFloatUserAttr(opts, "fps", mFPS))
+      #endif
+      
+      if (data == MAP_FAILED)
       {
-         AiMsgDebug("[volume_field3d] 'fps' read from options node");
+         data = mmap(0, chunk.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+         
+         #ifdef MADV_HUGEPAGE
+         if (data != MAP_FAILED && mHugePages != HP_none)
+         {
+            madvise(data, chunk.size, MADV_HUGEPAGE);
+         }
+         #endif
       }
       
-      // Read params from string data
-      std::vector<std::string> args;
-      std::string paramString = (user_string ? user_string : "");
+      chunk.data = (data != MAP_FAILED ? (unsigned char*) data : 0);
+      #endif
       
-      splitParamString(user_string, args);
+      return (chunk.data != 0);
+   }
+   
+   HugePages mHugePages;
+   AtCritSec mLock;
+   std::vector<Chunk> mChunks;
+   AtomicInt mRefCount;
+};
+
+// Dense storage with voxels reordered in 8x8x8 bricks, Morton (z-order) ordered
+// within each brick, so that interpolation stencils and consecutive ray march
+// samples touch few cache lines. Derives from EmptyField only for the extents,
+// data window and mapping bookkeeping.
+template <typename T>
+class BrickedField : public Field3D::EmptyField<T>
+{
+public:
+   
+   typedef boost::intrusive_ptr<BrickedField> Ptr;
+   typedef T value_type;
+   typedef Field3D::LinearGenericFieldInterp<BrickedField> LinearInterp;
+   typedef Field3D::CubicGenericFieldInterp<BrickedField> CubicInterp;
+   
+   enum
+   {
+      BrickOrder = 3,
+      BrickSize = 1 << BrickOrder
+   };
+   
+   BrickedField()
+      : Field3D::EmptyField<T>()
+      , mData(0)
+      , mCount(0)
+      , mArena(0)
+   {
+   }
+   
+   virtual ~BrickedField()
+   {
+      if (mArena)
+      {
+         mArena->unref();
+      }
+      else
+      {
+         delete[] mData;
+      }
+   }
+   
+   // Not a Field3D registered class, use C++ RTTI
+   static Ptr Cast(Field3D::FieldRes::Ptr field)
+   {
+      return Ptr(dynamic_cast<BrickedField*>(field.get()));
+   }
+   
+   // Setup size and mapping from another field and allocate voxels, from the
+   // given arena if any
+   void setup(const Field3D::FieldRes &src, Arena *arena=0)
+   {
+      this->name = src.name;
+      this->attribute = src.attribute;
+      this->copyMetadata(src);
+      this->setMapping(src.mapping()->clone());
+      this->setSize(src.extents(), src.dataWindow());
+      
+      const Field3D::Box3i &dw = this->dataWindow();
+      
+      mOrigin = dw.min;
+      mBricks.x = ((dw.max.x - dw.min.x) >> BrickOrder) + 1;
+      mBricks.y = ((dw.max.y - dw.min.y) >> BrickOrder) + 1;
+      mBricks.z = ((dw.max.z - dw.min.z) >> BrickOrder) + 1;
+      
+      mCount = size_t(mBricks.x) * size_t(mBricks.y) * size_t(mBricks.z) << (3 * BrickOrder);
+      
+      if (arena)
+      {
+         // plain voxel types, arena memory is zero filled
+         mData = (T*) arena->allocate(mCount * sizeof(T));
+         mArena = arena;
+         mArena->ref();
+      }
+      else
+      {
+         // padding voxels match the arena case (Imath types don't initialize
+         // themselves)
+         mData = new T[mCount];
+         std::fill(mData, mData + mCount, T(0));
+      }
+   }
+   
+   inline const T& fastValue(int i, int j, int k) const
+   {
+      return mData[index(i, j, k)];
+   }
+   
+   inline T& fastLValue(int i, int j, int k)
+   {
+      return mData[index(i, j, k)];
+   }
+   
+   virtual T value(int i, int j, int k) const
+   {
+      return fastValue(i, j, k);
+   }
+   
+   virtual long long int memSize() const
+   {
+      return (long long int)(sizeof(*this) + mCount * sizeof(T));
+   }
+   
+   virtual std::string className() const
+   {
+      return "BrickedField";
+   }
+   
+   const Field3D::V3i& bricks() const
+   {
+      return mBricks;
+   }
+   
+private:
+   
+   inline size_t index(int i, int j, int k) const
+   {
+      // spread 3 bits, 2 zeros apart
+      static const size_t Spread[BrickSize] = {0, 1, 8, 9, 64, 65, 72, 73};
+      
+      i -= mOrigin.x;
+      j -= mOrigin.y;
+      k -= mOrigin.z;
+      
+      size_t brick = (size_t(k >> BrickOrder) * size_t(mBricks.y) + size_t(j >> BrickOrder)) * size_t(mBricks.x) + size_t(i >> BrickOrder);
+      
+      return ((brick << (3 * BrickOrder)) |
+              Spread[i & (BrickSize - 1)] |
+              (Spread[j & (BrickSize - 1)] << 1) |
+              (Spread[k & (BrickSize - 1)] << 2));
+   }
+   
+   BrickedField(const BrickedField&);
+   BrickedField& operator=(const BrickedField&);
+   
+   Field3D::V3i mOrigin;
+   Field3D::V3i mBricks;
+   T *mData;
+   size_t mCount;
+   Arena *mArena;
+};
+
+template <typename T>
+struct ComponentTraits
+{
+   typedef T Component;
+   enum { Count = 1 };
+   
+   static double Get(const T &v, int)
+   {
+      return double(v);
+   }
+   
+   static void Set(T &v, int, double c)
+   {
+      v = T(c);
+   }
+};
+
+template <typename T>
+struct ComponentTraits<FIELD3D_VEC3_T<T> >
+{
+   typedef T Component;
+   enum { Count = 3 };
+   
+   static double Get(const FIELD3D_VEC3_T<T> &v, int c)
+   {
+      return double(v[c]);
+   }
+   
+   static void Set(FIELD3D_VEC3_T<T> &v, int c, double x)
+   {
+      v[c] = T(x);
+   }
+};
+
+// MAC fields only exist for vector types
+template <typename T>
+struct MACFieldCheck
+{
+   static bool Is(typename Field3D::Field<T>::Ptr)
+   {
+      return false;
+   }
+};
+
+template <typename T>
+struct MACFieldCheck<FIELD3D_VEC3_T<T> >
+{
+   static bool Is(typename Field3D::Field<FIELD3D_VEC3_T<T> >::Ptr field)
+   {
+      return (Field3D::field_dynamic_cast<Field3D::MACField<FIELD3D_VEC3_T<T> > >(field).get() != 0);
+   }
+};
+
+struct QuantizeStats
+{
+   double maxError;
+   double sumSquaredError;
+   double count;
+   
+   QuantizeStats()
+      : maxError(0.0)
+      , sumSquaredError(0.0)
+      , count(0.0)
+   {
+   }
+   
+   void merge(const QuantizeStats &rhs)
+   {
+      maxError = std::max(maxError, rhs.maxError);
+      sumSquaredError += rhs.sumSquaredError;
+      count += rhs.count;
+   }
+};
+
+// Reduced precision storage (-precision): 8x8x8 bricks (Morton ordered like
+// BrickedField) stored as half, float, or 16/8 bits integers with a per brick
+// and per component scale and bias. Bricks with a single value store no voxels.
+// Values are decoded on the fly to the original value type.
+template <typename T>
+class QuantizedField : public Field3D::EmptyField<T>
+{
+public:
+   
+   typedef boost::intrusive_ptr<QuantizedField> Ptr;
+   typedef T value_type;
+   typedef Field3D::LinearGenericFieldInterp<QuantizedField> LinearInterp;
+   typedef Field3D::CubicGenericFieldInterp<QuantizedField> CubicInterp;
+   typedef ComponentTraits<T> Traits;
+   
+   enum
+   {
+      BrickOrder = 3,
+      BrickSize = 1 << BrickOrder,
+      BrickVoxels = BrickSize * BrickSize * BrickSize,
+      Components = Traits::Count
+   };
+   
+   struct Brick
+   {
+      // null for uniform bricks
+      unsigned char *data;
+      float scale[Components];
+      float bias[Components];
+   };
+   
+   QuantizedField()
+      : Field3D::EmptyField<T>()
+      , mPrecision(SP_float)
+      , mArena(0)
+   {
+   }
+   
+   virtual ~QuantizedField()
+   {
+      if (mArena)
+      {
+         mArena->unref();
+         return;
+      }
+      
+      for (size_t i=0; i<mBricks.size(); ++i)
+      {
+         delete[] mBricks[i].data;
+      }
+   }
+   
+   // Not a Field3D registered class, use C++ RTTI
+   static Ptr Cast(Field3D::FieldRes::Ptr field)
+   {
+      return Ptr(dynamic_cast<QuantizedField*>(field.get()));
+   }
+   
+   // Bricks data is allocated from the given arena if any
+   void setup(const Field3D::FieldRes &src, StoragePrecision precision, Arena *arena=0)
+   {
+      this->name = src.name;
+      this->attribute = src.attribute;
+      this->copyMetadata(src);
+      this->setMapping(src.mapping()->clone());
+      this->setSize(src.extents(), src.dataWindow());
+      
+      const Field3D::Box3i &dw = this->dataWindow();
+      
+      mPrecision = precision;
+      mArena = arena;
+      if (mArena)
+      {
+         mArena->ref();
+      }
+      mOrigin = dw.min;
+      mBrickRes.x = ((dw.max.x - dw.min.x) >> BrickOrder) + 1;
+      mBrickRes.y = ((dw.max.y - dw.min.y) >> BrickOrder) + 1;
+      mBrickRes.z = ((dw.max.z - dw.min.z) >> BrickOrder) + 1;
+      
+      Brick empty;
+      
+      empty.data = 0;
+      for (int c=0; c<Components; ++c)
+      {
+         empty.scale[c] = 0.0f;
+         empty.bias[c] = 0.0f;
+      }
+      
+      mBricks.assign(size_t(mBrickRes.x) * size_t(mBrickRes.y) * size_t(mBrickRes.z), empty);
+   }
+   
+   inline T fastValue(int i, int j, int k) const
+   {
+      i -= mOrigin.x;
+      j -= mOrigin.y;
+      k -= mOrigin.z;
+      
+      const Brick &b = mBricks[brickIndex(i, j, k)];
+      T val;
+      
+      if (!b.data)
+      {
+         for (int c=0; c<Components; ++c)
+         {
+            Traits::Set(val, c, b.bias[c]);
+         }
+         return val;
+      }
+      
+      size_t off = voxelIndex(i, j, k) * Components;
+      
+      switch (mPrecision)
+      {
+      case SP_q8:
+         for (int c=0; c<Components; ++c)
+         {
+            Traits::Set(val, c, double(b.bias[c]) + double(b.scale[c]) * double(b.data[off + c]));
+         }
+         break;
+      case SP_q16:
+         for (int c=0; c<Components; ++c)
+         {
+            Traits::Set(val, c, double(b.bias[c]) + double(b.scale[c]) * double(((const unsigned short*) b.data)[off + c]));
+         }
+         break;
+      case SP_half:
+         for (int c=0; c<Components; ++c)
+         {
+            Traits::Set(val, c, double(float(((const Field3D::half*) b.data)[off + c])));
+         }
+         break;
+      case SP_float:
+      default:
+         for (int c=0; c<Components; ++c)
+         {
+            Traits::Set(val, c, double(((const float*) b.data)[off + c]));
+         }
+      }
+      
+      return val;
+   }
+   
+   virtual T value(int i, int j, int k) const
+   {
+      return fastValue(i, j, k);
+   }
+   
+   virtual long long int memSize() const
+   {
+      size_t bytes = sizeof(*this) + mBricks.size() * sizeof(Brick);
+      size_t brickBytes = BrickVoxels * Components * StoragePrecisionSize(mPrecision);
+      
+      for (size_t i=0; i<mBricks.size(); ++i)
+      {
+         if (mBricks[i].data)
+         {
+            bytes += brickBytes;
+         }
+      }
+      
+      return (long long int) bytes;
+   }
+   
+   virtual std::string className() const
+   {
+      return "QuantizedField";
+   }
+   
+   const Field3D::V3i& brickRes() const
+   {
+      return mBrickRes;
+   }
+   
+   // Encode brick (bi, bj, bk) from source field values.
+   // Distinct bricks may be encoded concurrently.
+   void encode(const Field3D::Field<T> &src, int bi, int bj, int bk, QuantizeStats &stats)
+   {
+      const Field3D::Box3i &dw = this->dataWindow();
+      
+      int i0 = dw.min.x + (bi << BrickOrder);
+      int j0 = dw.min.y + (bj << BrickOrder);
+      int k0 = dw.min.z + (bk << BrickOrder);
+      int i1 = std::min(dw.max.x, i0 + BrickSize - 1);
+      int j1 = std::min(dw.max.y, j0 + BrickSize - 1);
+      int k1 = std::min(dw.max.z, k0 + BrickSize - 1);
+      
+      std::vector<double> values(BrickVoxels * Components);
+      double vmin[Components];
+      double vmax[Components];
+      bool uniform = true;
+      
+      for (int c=0; c<Components; ++c)
+      {
+         vmin[c] = std::numeric_limits<double>::max();
+         vmax[c] = -std::numeric_limits<double>::max();
+      }
+      
+      for (int k=k0; k<=k1; ++k)
+      {
+         for (int j=j0; j<=j1; ++j)
+         {
+            for (int i=i0; i<=i1; ++i)
+            {
+               T v = src.value(i, j, k);
+               size_t off = voxelIndex(i - mOrigin.x, j - mOrigin.y, k - mOrigin.z) * Components;
+               
+               for (int c=0; c<Components; ++c)
+               {
+                  double x = Traits::Get(v, c);
+                  values[off + c] = x;
+                  vmin[c] = std::min(vmin[c], x);
+                  vmax[c] = std::max(vmax[c], x);
+               }
+            }
+         }
+      }
+      
+      Brick &b = mBricks[brickIndex(i0 - mOrigin.x, j0 - mOrigin.y, k0 - mOrigin.z)];
+      
+      for (int c=0; c<Components; ++c)
+      {
+         if (vmax[c] > vmin[c])
+         {
+            uniform = false;
+         }
+         b.bias[c] = float(vmin[c]);
+         b.scale[c] = 0.0f;
+      }
+      
+      if (uniform)
+      {
+         double n = double(i1 - i0 + 1) * double(j1 - j0 + 1) * double(k1 - k0 + 1);
+         
+         for (int c=0; c<Components; ++c)
+         {
+            accumulate(stats, vmin[c], b.bias[c], n);
+         }
+         return;
+      }
+      
+      double levels = (mPrecision == SP_q8 ? 255.0 : 65535.0);
+      
+      for (int c=0; c<Components; ++c)
+      {
+         b.scale[c] = float((vmax[c] - vmin[c]) / levels);
+      }
+      
+      b.data = allocate(BrickVoxels * Components * StoragePrecisionSize(mPrecision));
+      
+      // only voxels inside the data window are encoded, padding voxels are never read
+      for (int k=k0; k<=k1; ++k)
+      {
+         for (int j=j0; j<=j1; ++j)
+         {
+            for (int i=i0; i<=i1; ++i)
+            {
+               size_t off = voxelIndex(i - mOrigin.x, j - mOrigin.y, k - mOrigin.z) * Components;
+               
+               for (int c=0; c<Components; ++c)
+               {
+                  double x = values[off + c];
+                  double d = x;
+                  
+                  switch (mPrecision)
+                  {
+                  case SP_q8:
+                  case SP_q16:
+                     {
+                        double q = (b.scale[c] > 0.0f ? floor((x - double(b.bias[c])) / double(b.scale[c]) + 0.5) : 0.0);
+                        q = std::max(0.0, std::min(levels, q));
+                        if (mPrecision == SP_q8)
+                        {
+                           b.data[off + c] = (unsigned char) q;
+                        }
+                        else
+                        {
+                           ((unsigned short*) b.data)[off + c] = (unsigned short) q;
+                        }
+                        d = double(b.bias[c]) + double(b.scale[c]) * q;
+                     }
+                     break;
+                  case SP_half:
+                     {
+                        Field3D::half h = Field3D::half(float(x));
+                        ((Field3D::half*) b.data)[off + c] = h;
+                        d = double(float(h));
+                     }
+                     break;
+                  case SP_float:
+                  default:
+                     ((float*) b.data)[off + c] = float(x);
+                     d = double(float(x));
+                  }
+                  
+                  accumulate(stats, x, d, 1.0);
+               }
+            }
+         }
+      }
+   }
+   
+private:
+   
+   QuantizedField(const QuantizedField&);
+   QuantizedField& operator=(const QuantizedField&);
+   
+   unsigned char* allocate(size_t bytes)
+   {
+      return (mArena ? (unsigned char*) mArena->allocate(bytes) : new unsigned char[bytes]);
+   }
+   
+   static void accumulate(QuantizeStats &stats, double x, double d, double weight)
+   {
+      double e = fabs(x - d);
+      stats.maxError = std::max(stats.maxError, e);
+      stats.sumSquaredError += weight * e * e;
+      stats.count += weight;
+   }
+   
+   // i, j, k relative to data window origin
+   inline size_t brickIndex(int i, int j, int k) const
+   {
+      return (size_t(k >> BrickOrder) * size_t(mBrickRes.y) + size_t(j >> BrickOrder)) * size_t(mBrickRes.x) + size_t(i >> BrickOrder);
+   }
+   
+   inline size_t voxelIndex(int i, int j, int k) const
+   {
+      // spread 3 bits, 2 zeros apart
+      static const size_t Spread[BrickSize] = {0, 1, 8, 9, 64, 65, 72, 73};
+      
+      return (Spread[i & (BrickSize - 1)] |
+              (Spread[j & (BrickSize - 1)] << 1) |
+              (Spread[k & (BrickSize - 1)] << 2));
+   }
+   
+   StoragePrecision mPrecision;
+   Field3D::V3i mOrigin;
+   Field3D::V3i mBrickRes;
+   std::vector<Brick> mBricks;
+   Arena *mArena;
+};
+
+template <typename C>
+struct ComponentBits
+{
+};
+
+template <>
+struct ComponentBits<Field3D::half>
+{
+   typedef unsigned short Type;
+};
+
+template <>
+struct ComponentBits<float>
+{
+   typedef unsigned int Type;
+};
+
+template <>
+struct ComponentBits<double>
+{
+   typedef unsigned long long Type;
+};
+
+static AtomicInt gCompressedFieldId;
+
+// Lossless compressed storage (-compress): 8x8x8 bricks (Morton ordered like
+// BrickedField), each component stored as the XOR of its bit pattern with the
+// previous voxel's, written as a variable length integer. Smooth data and
+// constant regions produce small deltas and encode to a byte or two per value.
+// Bricks with a single value store no voxels, bricks whose encoding isn't
+// smaller than their values (i.e. noise) store them as is.
+// Bricks are decoded on access into a small per render thread cache, use an
+// Accessor to sample the field.
+template <typename T>
+class CompressedField : public Field3D::EmptyField<T>
+{
+public:
+   
+   typedef boost::intrusive_ptr<CompressedField> Ptr;
+   typedef T value_type;
+   typedef ComponentTraits<T> Traits;
+   typedef typename Traits::Component Component;
+   typedef typename ComponentBits<Component>::Type Bits;
+   
+   enum
+   {
+      BrickOrder = 3,
+      BrickSize = 1 << BrickOrder,
+      BrickVoxels = BrickSize * BrickSize * BrickSize,
+      Components = Traits::Count,
+      RawBytes = BrickVoxels * sizeof(T)
+   };
+   
+   struct Brick
+   {
+      // null for uniform bricks, voxel values as is when size is RawBytes
+      unsigned char *data;
+      size_t size;
+      T value;
+   };
+   
+   // Most recently decoded bricks of one thread, shared by all fields of a type
+   struct DecodeCache
+   {
+      enum { Size = 16 };
+      
+      long field[Size];
+      size_t brick[Size];
+      T values[Size][BrickVoxels];
+      int last;
+      int next;
+      
+      DecodeCache()
+         : last(0)
+         , next(0)
+      {
+         for (int n=0; n<Size; ++n)
+         {
+            field[n] = 0;
+            brick[n] = 0;
+         }
+      }
+   };
+   
+   // Thread bound view of the field for Field3D interpolators
+   class Accessor
+   {
+   public:
+      
+      typedef T value_type;
+      typedef Field3D::LinearGenericFieldInterp<Accessor> LinearInterp;
+      typedef Field3D::CubicGenericFieldInterp<Accessor> CubicInterp;
+      
+      Accessor(const CompressedField &field, unsigned int tid)
+         : mField(field)
+         , mCache(CompressedField::Cache(tid))
+      {
+      }
+      
+      inline const Field3D::Box3i& dataWindow() const
+      {
+         return mField.dataWindow();
+      }
+      
+      inline T fastValue(int i, int j, int k) const
+      {
+         return mField.cachedValue(i, j, k, mCache);
+      }
+      
+   private:
+      
+      const CompressedField &mField;
+      DecodeCache &mCache;
+   };
+   
+   CompressedField()
+      : Field3D::EmptyField<T>()
+      , mId(gCompressedFieldId.add(1))
+      , mArena(0)
+   {
+   }
+   
+   virtual ~CompressedField()
+   {
+      if (mArena)
+      {
+         mArena->unref();
+         return;
+      }
+      
+      for (size_t i=0; i<mBricks.size(); ++i)
+      {
+         delete[] mBricks[i].data;
+      }
+   }
+   
+   // Not a Field3D registered class, use C++ RTTI
+   static Ptr Cast(Field3D::FieldRes::Ptr field)
+   {
+      return Ptr(dynamic_cast<CompressedField*>(field.get()));
+   }
+   
+   static DecodeCache& Cache(unsigned int tid)
+   {
+      // a thread id is only ever used by one thread at a time
+      DecodeCache *&cache = sCaches[tid % AI_MAX_THREADS];
+      if (!cache)
+      {
+         cache = new DecodeCache();
+      }
+      return *cache;
+   }
+   
+   static void ClearCaches()
+   {
+      for (int i=0; i<AI_MAX_THREADS; ++i)
+      {
+         delete sCaches[i];
+         sCaches[i] = 0;
+      }
+   }
+   
+   void setup(const Field3D::FieldRes &src)
+   {
+      this->name = src.name;
+      this->attribute = src.attribute;
+      this->copyMetadata(src);
+      this->setMapping(src.mapping()->clone());
+      this->setSize(src.extents(), src.dataWindow());
+      
+      const Field3D::Box3i &dw = this->dataWindow();
+      
+      mOrigin = dw.min;
+      mBrickRes.x = ((dw.max.x - dw.min.x) >> BrickOrder) + 1;
+      mBrickRes.y = ((dw.max.y - dw.min.y) >> BrickOrder) + 1;
+      mBrickRes.z = ((dw.max.z - dw.min.z) >> BrickOrder) + 1;
+      
+      Brick empty;
+      
+      empty.data = 0;
+      empty.size = 0;
+      empty.value = T(0);
+      
+      mBricks.assign(size_t(mBrickRes.x) * size_t(mBrickRes.y) * size_t(mBrickRes.z), empty);
+   }
+   
+   inline T cachedValue(int i, int j, int k, DecodeCache &cache) const
+   {
+      i -= mOrigin.x;
+      j -= mOrigin.y;
+      k -= mOrigin.z;
+      
+      size_t bi = brickIndex(i, j, k);
+      const Brick &b = mBricks[bi];
+      
+      if (!b.data)
+      {
+         return b.value;
+      }
+      
+      if (b.size == size_t(RawBytes))
+      {
+         return reinterpret_cast<const T*>(b.data)[voxelIndex(i, j, k)];
+      }
+      
+      return decoded(bi, cache)[voxelIndex(i, j, k)];
+   }
+   
+   virtual T value(int i, int j, int k) const
+   {
+      i -= mOrigin.x;
+      j -= mOrigin.y;
+      k -= mOrigin.z;
+      
+      const Brick &b = mBricks[brickIndex(i, j, k)];
+      
+      if (!b.data)
+      {
+         return b.value;
+      }
+      
+      std::vector<T> values(BrickVoxels);
+      decode(b, &values[0]);
+      
+      return values[voxelIndex(i, j, k)];
+   }
+   
+   virtual long long int memSize() const
+   {
+      size_t bytes = sizeof(*this) + mBricks.size() * sizeof(Brick);
+      
+      for (size_t i=0; i<mBricks.size(); ++i)
+      {
+         bytes += mBricks[i].size;
+      }
+      
+      return (long long int) bytes;
+   }
+   
+   virtual std::string className() const
+   {
+      return "CompressedField";
+   }
+   
+   const Field3D::V3i& brickRes() const
+   {
+      return mBrickRes;
+   }
+   
+   // Encode brick (bi, bj, bk) from source field values.
+   // Distinct bricks may be encoded concurrently.
+   void encode(const Field3D::Field<T> &src, int bi, int bj, int bk)
+   {
+      const Field3D::Box3i &dw = this->dataWindow();
+      
+      int i0 = dw.min.x + (bi << BrickOrder);
+      int j0 = dw.min.y + (bj << BrickOrder);
+      int k0 = dw.min.z + (bk << BrickOrder);
+      
+      std::vector<T> values(BrickVoxels);
+      
+      // padding voxels (outside of data window) repeat the border values to
+      // keep deltas small, they are never read
+      for (int k=0; k<BrickSize; ++k)
+      {
+         int sk = std::min(dw.max.z, k0 + k);
+         
+         for (int j=0; j<BrickSize; ++j)
+         {
+            int sj = std::min(dw.max.y, j0 + j);
+            
+            for (int i=0; i<BrickSize; ++i)
+            {
+               int si = std::min(dw.max.x, i0 + i);
+               
+               values[voxelIndex(i, j, k)] = src.value(si, sj, sk);
+            }
+         }
+      }
+      
+      Brick &b = mBricks[brickIndex(i0 - mOrigin.x, j0 - mOrigin.y, k0 - mOrigin.z)];
+      
+      b.value = values[0];
+      
+      bool uniform = true;
+      
+      for (int v=1; uniform && v<BrickVoxels; ++v)
+      {
+         uniform = (memcmp(&values[v], &values[0], sizeof(T)) == 0);
+      }
+      
+      if (uniform)
+      {
+         return;
+      }
+      
+      std::vector<unsigned char> bytes;
+      
+      bytes.reserve(RawBytes);
+      
+      for (int c=0; c<Components && bytes.size() < size_t(RawBytes); ++c)
+      {
+         Bits prev = 0;
+         
+         for (int v=0; v<BrickVoxels; ++v)
+         {
+            Bits cur;
+            memcpy(&cur, reinterpret_cast<const unsigned char*>(&values[v]) + c * sizeof(Component), sizeof(Bits));
+            
+            Bits delta = cur ^ prev;
+            prev = cur;
+            
+            while (delta >= 0x80)
+            {
+               bytes.push_back((unsigned char)(delta & 0x7F) | 0x80);
+               delta >>= 7;
+            }
+            bytes.push_back((unsigned char) delta);
+         }
+      }
+      
+      const unsigned char *data = &bytes[0];
+      
+      b.size = bytes.size();
+      
+      if (b.size >= size_t(RawBytes))
+      {
+         data = reinterpret_cast<const unsigned char*>(&values[0]);
+         b.size = RawBytes;
+      }
+      
+      b.data = new unsigned char[b.size];
+      memcpy(b.data, data, b.size);
+   }
+   
+   // Move encoded bricks to the given arena, once all bricks are encoded
+   void moveToArena(Arena *arena)
+   {
+      if (!arena || mArena)
+      {
+         return;
+      }
+      
+      for (size_t i=0; i<mBricks.size(); ++i)
+      {
+         Brick &b = mBricks[i];
+         
+         if (b.data)
+         {
+            unsigned char *data = (unsigned char*) arena->allocate(b.size);
+            memcpy(data, b.data, b.size);
+            delete[] b.data;
+            b.data = data;
+         }
+      }
+      
+      mArena = arena;
+      mArena->ref();
+   }
+   
+private:
+   
+   CompressedField(const CompressedField&);
+   CompressedField& operator=(const CompressedField&);
+   
+   void decode(const Brick &b, T *values) const
+   {
+      if (b.size == size_t(RawBytes))
+      {
+         memcpy(values, b.data, RawBytes);
+         return;
+      }
+      
+      const unsigned char *p = b.data;
+      
+      for (int c=0; c<Components; ++c)
+      {
+         Bits prev = 0;
+         
+         for (int v=0; v<BrickVoxels; ++v)
+         {
+            Bits delta = 0;
+            int shift = 0;
+            
+            while (*p & 0x80)
+            {
+               delta |= Bits(*p++ & 0x7F) << shift;
+               shift += 7;
+            }
+            delta |= Bits(*p++) << shift;
+            
+            prev ^= delta;
+            memcpy(reinterpret_cast<unsigned char*>(&values[v]) + c * sizeof(Component), &prev, sizeof(Bits));
+         }
+      }
+   }
+   
+   const T* decoded(size_t bi, DecodeCache &cache) const
+   {
+      // successive lookups of a ray march mostly hit the same brick
+      if (cache.field[cache.last] == mId && cache.brick[cache.last] == bi)
+      {
+         return cache.values[cache.last];
+      }
+      
+      for (int n=0; n<DecodeCache::Size; ++n)
+      {
+         if (cache.field[n] == mId && cache.brick[n] == bi)
+         {
+            cache.last = n;
+            return cache.values[n];
+         }
+      }
+      
+      int n = cache.next;
+      
+      decode(mBricks[bi], cache.values[n]);
+      cache.field[n] = mId;
+      cache.brick[n] = bi;
+      cache.last = n;
+      cache.next = (n + 1) % DecodeCache::Size;
+      
+      return cache.values[n];
+   }
+   
+   // i, j, k relative to data window origin
+   inline size_t brickIndex(int i, int j, int k) const
+   {
+      return (size_t(k >> BrickOrder) * size_t(mBrickRes.y) + size_t(j >> BrickOrder)) * size_t(mBrickRes.x) + size_t(i >> BrickOrder);
+   }
+   
+   inline size_t voxelIndex(int i, int j, int k) const
+   {
+      // spread 3 bits, 2 zeros apart
+      static const size_t Spread[BrickSize] = {0, 1, 8, 9, 64, 65, 72, 73};
+      
+      return (Spread[i & (BrickSize - 1)] |
+              (Spread[j & (BrickSize - 1)] << 1) |
+              (Spread[k & (BrickSize - 1)] << 2));
+   }
+   
+   long mId;
+   Field3D::V3i mOrigin;
+   Field3D::V3i mBrickRes;
+   std::vector<Brick> mBricks;
+   Arena *mArena;
+   
+   static DecodeCache *sCaches[AI_MAX_THREADS];
+};
+
+template <typename T>
+typename CompressedField<T>::DecodeCache* CompressedField<T>::sCaches[AI_MAX_THREADS] = {0};
+
+static void ClearDecodeCaches()
+{
+   CompressedField<Field3D::half>::ClearCaches();
+   CompressedField<float>::ClearCaches();
+   CompressedField<double>::ClearCaches();
+   CompressedField<Field3D::V3h>::ClearCaches();
+   CompressedField<Field3D::V3f>::ClearCaches();
+   CompressedField<Field3D::V3d>::ClearCaches();
+}
+
+// FNV-1a hash, used to derive shared memory and staged file names from keys
+static unsigned long long HashString(const std::string &str)
+{
+   unsigned long long h = 14695981039346656037ULL;
+   
+   for (size_t i=0; i<str.length(); ++i)
+   {
+      h ^= (unsigned char) str[i];
+      h *= 1099511628211ULL;
+   }
+   
+   return h;
+}
+
+#ifndef _WIN32
+
+// Shared memory segments (-sharedCache) reference counting across processes: a
+// companion segment lists the ids of the processes using a segment. The last
+// one to detach (or the first to find only dead processes) removes both.
+class SharedSegments
+{
+public:
+   
+   static std::string Name(const std::string &key)
+   {
+      char tmp[64];
+      sprintf(tmp, "/volume_field3d.%016llx", HashString(key));
+      
+      return tmp;
+   }
+   
+   static bool Attach(const std::string &name)
+   {
+      int *pids = MapRefs(name, true);
+      
+      if (!pids)
+      {
+         return false;
+      }
+      
+      int pid = int(getpid());
+      bool attached = false;
+      
+      for (int i=0; !attached && i<MaxProcesses; ++i)
+      {
+         attached = __sync_bool_compare_and_swap(&pids[i], 0, pid);
+      }
+      
+      munmap(pids, RefsSize);
+      
+      return attached;
+   }
+   
+   static void Detach(const std::string &name)
+   {
+      int *pids = MapRefs(name, false);
+      
+      if (!pids)
+      {
+         return;
+      }
+      
+      int pid = int(getpid());
+      
+      for (int i=0; i<MaxProcesses; ++i)
+      {
+         if (__sync_bool_compare_and_swap(&pids[i], pid, 0))
+         {
+            break;
+         }
+      }
+      
+      bool used = false;
+      
+      for (int i=0; i<MaxProcesses; ++i)
+      {
+         int p = pids[i];
+         
+         if (p == 0)
+         {
+            continue;
+         }
+         
+         if (kill(p, 0) == 0 || errno != ESRCH)
+         {
+            used = true;
+         }
+         else
+         {
+            // process died without detaching
+            __sync_bool_compare_and_swap(&pids[i], p, 0);
+         }
+      }
+      
+      munmap(pids, RefsSize);
+      
+      if (!used)
+      {
+         shm_unlink(name.c_str());
+         shm_unlink((name + ".refs").c_str());
+      }
+   }
+   
+   // Remove a segment left behind by dead processes. Segments that don't start with
+   // 'magic' yet are being published and left alone: their publisher removes them
+   // if it fails, or the next publisher does if it died (see RenderCache::Publish).
+   static void Cleanup(const std::string &name, const char *magic)
+   {
+      if (!IsComplete(name, magic))
+      {
+         return;
+      }
+      
+      int *pids = MapRefs(name, false);
+      
+      if (!pids)
+      {
+         shm_unlink(name.c_str());
+         return;
+      }
+      
+      munmap(pids, RefsSize);
+      
+      Attach(name);
+      Detach(name);
+   }
+   
+   // Remove all the segments left behind by dead processes (i.e. killed renders), including
+   // the ones no process looks up anymore. Publishers register before creating a segment:
+   // incomplete segments whose users are all dead were being published by a killed process.
+   // Called when the plugin is loaded and unloaded.
+   static void CleanupStale(const char *magic)
+   {
+      #ifdef __linux__
+      // POSIX shared memory objects are the files of /dev/shm on Linux
+      std::set<std::string> names;
+      DIR *d = opendir("/dev/shm");
+      
+      if (!d)
+      {
+         return;
+      }
+      
+      struct dirent *de;
+      
+      while ((de = readdir(d)) != 0)
+      {
+         std::string name = de->d_name;
+         
+         if (name.compare(0, 15, "volume_field3d.") != 0)
+         {
+            continue;
+         }
+         
+         if (name.length() > 5 && name.compare(name.length() - 5, 5, ".refs") == 0)
+         {
+            name = name.substr(0, name.length() - 5);
+         }
+         
+         names.insert("/" + name);
+      }
+      
+      closedir(d);
+      
+      for (std::set<std::string>::iterator it=names.begin(); it!=names.end(); ++it)
+      {
+         if (IsComplete(*it, magic))
+         {
+            Cleanup(*it, magic);
+         }
+         else
+         {
+            int *pids = MapRefs(*it, false);
+            
+            if (pids)
+            {
+               munmap(pids, RefsSize);
+               
+               // removes the segment (if any) and its users list if they are all dead
+               Attach(*it);
+               Detach(*it);
+            }
+         }
+      }
+      #else
+      (void) magic;
+      #endif
+   }
+   
+private:
+   
+   enum
+   {
+      MaxProcesses = 1024,
+      RefsSize = MaxProcesses * sizeof(int)
+   };
+   
+   static bool IsComplete(const std::string &name, const char *magic)
+   {
+      int fd = shm_open(name.c_str(), O_RDONLY, 0);
+      
+      if (fd == -1)
+      {
+         return false;
+      }
+      
+      size_t len = strlen(magic);
+      bool complete = false;
+      struct stat st;
+      
+      if (fstat(fd, &st) == 0 && size_t(st.st_size) >= len)
+      {
+         void *data = mmap(0, len, PROT_READ, MAP_SHARED, fd, 0);
+         
+         if (data != MAP_FAILED)
+         {
+            complete = (memcmp(data, magic, len) == 0);
+            munmap(data, len);
+         }
+      }
+      
+      close(fd);
+      
+      return complete;
+   }
+   
+   static int* MapRefs(const std::string &name, bool create)
+   {
+      int fd = shm_open((name + ".refs").c_str(), (create ? O_RDWR | O_CREAT : O_RDWR), 0666);
+      
+      if (fd == -1)
+      {
+         return 0;
+      }
+      
+      // new segments are zero filled
+      if (create && ftruncate(fd, RefsSize) != 0)
+      {
+         close(fd);
+         return 0;
+      }
+      
+      void *data = mmap(0, RefsSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      
+      close(fd);
+      
+      return (data != MAP_FAILED ? (int*) data : 0);
+   }
+};
+
+#endif
+
+// Read only file mapping, reference counted (shared by the fields it holds)
+class MappedFile
+{
+public:
+   
+   static MappedFile* Open(const std::string &path)
+   {
+      MappedFile *mf = new MappedFile();
+      
+      #ifdef _WIN32
+      mf->mFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+      if (mf->mFile != INVALID_HANDLE_VALUE)
+      {
+         LARGE_INTEGER size;
+         if (GetFileSizeEx(mf->mFile, &size) && size.QuadPart > 0)
+         {
+            mf->mSize = size_t(size.QuadPart);
+            mf->mMapping = CreateFileMappingA(mf->mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mf->mMapping)
+            {
+               mf->mData = (const unsigned char*) MapViewOfFile(mf->mMapping, FILE_MAP_READ, 0, 0, 0);
+            }
+         }
+      }
+      #else
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd != -1)
+      {
+         struct stat st;
+         if (fstat(fd, &st) == 0 && st.st_size > 0)
+         {
+            void *data = mmap(0, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            if (data != MAP_FAILED)
+            {
+               mf->mData = (const unsigned char*) data;
+               mf->mSize = size_t(st.st_size);
+            }
+         }
+         // the mapping keeps its own reference to the file
+         close(fd);
+      }
+      #endif
+      
+      if (!mf->mData)
+      {
+         delete mf;
+         return 0;
+      }
+      
+      mf->mRefCount.set(1);
+      
+      return mf;
+   }
+   
+   #ifndef _WIN32
+   
+   // Map a shared memory segment published by SharedCache, the process is
+   // registered as a user of the segment until the mapping is released
+   static MappedFile* OpenShared(const std::string &name)
+   {
+      int fd = shm_open(name.c_str(), O_RDONLY, 0);
+      
+      if (fd == -1)
+      {
+         return 0;
+      }
+      
+      MappedFile *mf = 0;
+      struct stat st;
+      
+      if (fstat(fd, &st) == 0 && st.st_size > 0 && SharedSegments::Attach(name))
+      {
+         void *data = mmap(0, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+         
+         if (data != MAP_FAILED)
+         {
+            mf = new MappedFile();
+            mf->mData = (const unsigned char*) data;
+            mf->mSize = size_t(st.st_size);
+            mf->mSharedName = name;
+            mf->mRefCount.set(1);
+         }
+         else
+         {
+            SharedSegments::Detach(name);
+         }
+      }
+      
+      close(fd);
+      
+      return mf;
+   }
+   
+   #endif
+   
+   void ref()
+   {
+      mRefCount.add(1);
+   }
+   
+   void unref()
+   {
+      if (mRefCount.add(-1) == 0)
+      {
+         delete this;
+      }
+   }
+   
+   inline const unsigned char* data() const
+   {
+      return mData;
+   }
+   
+   inline size_t size() const
+   {
+      return mSize;
+   }
+   
+private:
+   
+   MappedFile()
+      : mData(0)
+      , mSize(0)
+      #ifdef _WIN32
+      , mFile(INVALID_HANDLE_VALUE)
+      , mMapping(NULL)
+      #endif
+   {
+   }
+   
+   ~MappedFile()
+   {
+      #ifdef _WIN32
+      if (mData)
+      {
+         UnmapViewOfFile(mData);
+      }
+      if (mMapping)
+      {
+         CloseHandle(mMapping);
+      }
+      if (mFile != INVALID_HANDLE_VALUE)
+      {
+         CloseHandle(mFile);
+      }
+      #else
+      if (mData)
+      {
+         munmap((void*) mData, mSize);
+      }
+      if (!mSharedName.empty())
+      {
+         SharedSegments::Detach(mSharedName);
+      }
+      #endif
+   }
+   
+   MappedFile(const MappedFile&);
+   MappedFile& operator=(const MappedFile&);
+   
+   const unsigned char *mData;
+   size_t mSize;
+   AtomicInt mRefCount;
+   #ifdef _WIN32
+   HANDLE mFile;
+   HANDLE mMapping;
+   #else
+   std::string mSharedName;
+   #endif
+};
+
+// Render cache (-renderCache) field: 8x8x8 bricks (Morton ordered like
+// BrickedField) sampled straight from a mapped sidecar file. Each brick is
+// located by a 64 bits offset in the file, uniform bricks (flagged) point to
+// a single value. Pages are loaded on demand and shared through the OS cache.
+template <typename T>
+class MappedField : public Field3D::EmptyField<T>
+{
+public:
+   
+   typedef boost::intrusive_ptr<MappedField> Ptr;
+   typedef T value_type;
+   typedef Field3D::LinearGenericFieldInterp<MappedField> LinearInterp;
+   typedef Field3D::CubicGenericFieldInterp<MappedField> CubicInterp;
+   
+   enum
+   {
+      BrickOrder = 3,
+      BrickSize = 1 << BrickOrder,
+      BrickVoxels = BrickSize * BrickSize * BrickSize
+   };
+   
+   static const unsigned long long UniformBrick = 1ULL << 63;
+   
+   MappedField()
+      : Field3D::EmptyField<T>()
+      , mFile(0)
+      , mTable(0)
+   {
+   }
+   
+   virtual ~MappedField()
+   {
+      if (mFile)
+      {
+         mFile->unref();
+      }
+   }
+   
+   // Not a Field3D registered class, use C++ RTTI
+   static Ptr Cast(Field3D::FieldRes::Ptr field)
+   {
+      return Ptr(dynamic_cast<MappedField*>(field.get()));
+   }
+   
+   static void BrickRes(const Field3D::Box3i &dw, Field3D::V3i &bres)
+   {
+      bres.x = ((dw.max.x - dw.min.x) >> BrickOrder) + 1;
+      bres.y = ((dw.max.y - dw.min.y) >> BrickOrder) + 1;
+      bres.z = ((dw.max.z - dw.min.z) >> BrickOrder) + 1;
+   }
+   
+   // Name, metadata and mapping are taken from the file header.
+   // Returns false if the bricks table doesn't fit in the mapped file.
+   bool setup(const Field3D::FieldRes &header, const Field3D::Box3i &extents, const Field3D::Box3i &dw,
+              MappedFile *file, unsigned long long tableOffset)
+   {
+      this->name = header.name;
+      this->attribute = header.attribute;
+      this->copyMetadata(header);
+      this->setMapping(header.mapping()->clone());
+      this->setSize(extents, dw);
+      
+      mOrigin = dw.min;
+      BrickRes(dw, mBrickRes);
+      
+      size_t count = size_t(mBrickRes.x) * size_t(mBrickRes.y) * size_t(mBrickRes.z);
+      
+      if (tableOffset % sizeof(unsigned long long) != 0 ||
+          tableOffset + count * sizeof(unsigned long long) > file->size())
+      {
+         return false;
+      }
+      
+      mTable = (const unsigned long long*) (file->data() + tableOffset);
+      
+      for (size_t i=0; i<count; ++i)
+      {
+         unsigned long long off = mTable[i] & ~UniformBrick;
+         size_t bytes = ((mTable[i] & UniformBrick) ? 1 : size_t(BrickVoxels)) * sizeof(T);
+         
+         if (off + bytes > file->size())
+         {
+            mTable = 0;
+            return false;
+         }
+      }
+      
+      mFile = file;
+      mFile->ref();
+      
+      return true;
+   }
+   
+   inline T fastValue(int i, int j, int k) const
+   {
+      i -= mOrigin.x;
+      j -= mOrigin.y;
+      k -= mOrigin.z;
+      
+      unsigned long long off = mTable[brickIndex(i, j, k)];
+      
+      if (off & UniformBrick)
+      {
+         return *((const T*) (mFile->data() + (off & ~UniformBrick)));
+      }
+      
+      return ((const T*) (mFile->data() + off))[VoxelIndex(i, j, k)];
+   }
+   
+   virtual T value(int i, int j, int k) const
+   {
+      return fastValue(i, j, k);
+   }
+   
+   // mapped pages are not counted
+   virtual long long int memSize() const
+   {
+      return (long long int) sizeof(*this);
+   }
+   
+   virtual std::string className() const
+   {
+      return "MappedField";
+   }
+   
+   static inline size_t VoxelIndex(int i, int j, int k)
+   {
+      // spread 3 bits, 2 zeros apart
+      static const size_t Spread[BrickSize] = {0, 1, 8, 9, 64, 65, 72, 73};
+      
+      return (Spread[i & (BrickSize - 1)] |
+              (Spread[j & (BrickSize - 1)] << 1) |
+              (Spread[k & (BrickSize - 1)] << 2));
+   }
+   
+private:
+   
+   MappedField(const MappedField&);
+   MappedField& operator=(const MappedField&);
+   
+   // i, j, k relative to data window origin
+   inline size_t brickIndex(int i, int j, int k) const
+   {
+      return (size_t(k >> BrickOrder) * size_t(mBrickRes.y) + size_t(j >> BrickOrder)) * size_t(mBrickRes.x) + size_t(i >> BrickOrder);
+   }
+   
+   MappedFile *mFile;
+   const unsigned long long *mTable;
+   Field3D::V3i mOrigin;
+   Field3D::V3i mBrickRes;
+};
+
+struct ScalarFieldData
+{
+   Field3D::SparseField<Field3D::half>::Ptr sparseh;
+   Field3D::SparseField<float>::Ptr sparsef;
+   Field3D::SparseField<double>::Ptr sparsed;
+   
+   Field3D::DenseField<Field3D::half>::Ptr denseh;
+   Field3D::DenseField<float>::Ptr densef;
+   Field3D::DenseField<double>::Ptr densed;
+   
+   BrickedField<Field3D::half>::Ptr brickedh;
+   BrickedField<float>::Ptr brickedf;
+   BrickedField<double>::Ptr brickedd;
+   
+   QuantizedField<Field3D::half>::Ptr quantizedh;
+   QuantizedField<float>::Ptr quantizedf;
+   QuantizedField<double>::Ptr quantizedd;
+   
+   CompressedField<Field3D::half>::Ptr compressedh;
+   CompressedField<float>::Ptr compressedf;
+   CompressedField<double>::Ptr compressedd;
+   
+   MappedField<Field3D::half>::Ptr mappedh;
+   MappedField<float>::Ptr mappedf;
+   MappedField<double>::Ptr mappedd;
+};
+
+struct VectorFieldData
+{
+   Field3D::SparseField<Field3D::V3h>::Ptr sparseh;
+   Field3D::SparseField<Field3D::V3f>::Ptr sparsef;
+   Field3D::SparseField<Field3D::V3d>::Ptr sparsed;
+   
+   Field3D::DenseField<Field3D::V3h>::Ptr denseh;
+   Field3D::DenseField<Field3D::V3f>::Ptr densef;
+   Field3D::DenseField<Field3D::V3d>::Ptr densed;
+   
+   Field3D::MACField<Field3D::V3h>::Ptr mach;
+   Field3D::MACField<Field3D::V3f>::Ptr macf;
+   Field3D::MACField<Field3D::V3d>::Ptr macd;
+   
+   BrickedField<Field3D::V3h>::Ptr brickedh;
+   BrickedField<Field3D::V3f>::Ptr brickedf;
+   BrickedField<Field3D::V3d>::Ptr brickedd;
+   
+   QuantizedField<Field3D::V3h>::Ptr quantizedh;
+   QuantizedField<Field3D::V3f>::Ptr quantizedf;
+   QuantizedField<Field3D::V3d>::Ptr quantizedd;
+   
+   CompressedField<Field3D::V3h>::Ptr compressedh;
+   CompressedField<Field3D::V3f>::Ptr compressedf;
+   CompressedField<Field3D::V3d>::Ptr compressedd;
+   
+   MappedField<Field3D::V3h>::Ptr mappedh;
+   MappedField<Field3D::V3f>::Ptr mappedf;
+   MappedField<Field3D::V3d>::Ptr mappedd;
+};
+
+
+// Sparse fields read with dynamic block loading share a single process wide
+// memory budget managed by Field3D's SparseFileManager (blocks are paged in on
+// demand and the least recently used ones evicted).
+class SparseBlockCache
+{
+public:
+   
+   // The largest budget requested by any volume wins
+   static void Enable(long megabytes)
+   {
+      Field3D::SparseFileManager &sfm = Field3D::SparseFileManager::singleton();
+      
+      long cur = sMemoryLimit.get();
+      
+      while (megabytes > cur)
+      {
+         if (sMemoryLimit.compareAndSwap(cur, megabytes))
+         {
+            sfm.setMaxMemUse(float(megabytes));
+            break;
+         }
+         cur = sMemoryLimit.get();
+      }
+      
+      sfm.setLimitMemUse(true);
+   }
+   
+   static bool Enabled()
+   {
+      return (sMemoryLimit.get() > 0);
+   }
+   
+   static void AddField(size_t blockBytes)
+   {
+      long bytes = long(blockBytes);
+      long cur = sMinBlockBytes.get();
+      
+      while ((cur == 0 || bytes < cur) && !sMinBlockBytes.compareAndSwap(cur, bytes))
+      {
+         cur = sMinBlockBytes.get();
+      }
+      
+      cur = sMaxBlockBytes.get();
+      
+      while (bytes > cur && !sMaxBlockBytes.compareAndSwap(cur, bytes))
+      {
+         cur = sMaxBlockBytes.get();
+      }
+   }
+   
+   static void Report()
+   {
+      if (!Enabled())
+      {
+         return;
+      }
+      
+      Field3D::SparseFileManager &sfm = Field3D::SparseFileManager::singleton();
+      
+      double lookups = 0.0;
+      for (int i=0; i<AI_MAX_THREADS; ++i)
+      {
+         lookups += double(sLookups[i].count);
+      }
+      
+      // every block load (re-reads of evicted blocks included) is a miss
+      double misses = double(sfm.totalLoads());
+      double hitRate = (lookups > 0.0 ? std::max(0.0, 1.0 - misses / lookups) : 0.0);
+      double minMB = misses * double(sMinBlockBytes.get()) / (1024.0 * 1024.0);
+      double maxMB = misses * double(sMaxBlockBytes.get()) / (1024.0 * 1024.0);
+      
+      // Field3D only counts loads process wide: the bytes read are estimated from the
+      // smallest and largest block sizes of the paged fields. Lookups are block changes
+      // within each sample's interpolation footprint (accessors don't outlive a sample),
+      // not Field3D block cache accesses: the hit rate is an estimate too
+      AiMsgInfo("[volume_field3d] Sparse block cache (%ld MB budget):", sMemoryLimit.get());
+      if (minMB == maxMB)
+      {
+         AiMsgInfo("[volume_field3d]   %.0f block load(s) (~%.2f MB estimated), %ld block(s) resident", misses, maxMB, sfm.numLoadedBlocks());
+      }
+      else
+      {
+         AiMsgInfo("[volume_field3d]   %.0f block load(s) (%.2f to %.2f MB estimated), %ld block(s) resident", misses, minMB, maxMB, sfm.numLoadedBlocks());
+      }
+      AiMsgInfo("[volume_field3d]   ~%.0f block lookup(s), ~%.2f%% hit rate (estimates)", lookups, 100.0 * hitRate);
+   }
+   
+private:
+   
+   struct Counter
+   {
+      long long count;
+      // avoid false sharing between threads
+      char pad[64 - sizeof(long long)];
+   };
+   
+public:
+   
+   // Thread bound view of a sparse field read with dynamic block loading for
+   // Field3D interpolators, counts a block lookup each time a sample moves to
+   // another block (per-thread counters, no synchronization required)
+   template <typename T>
+   class Accessor
+   {
+   public:
+      
+      typedef T value_type;
+      typedef Field3D::LinearGenericFieldInterp<Accessor> LinearInterp;
+      typedef Field3D::CubicGenericFieldInterp<Accessor> CubicInterp;
+      
+      Accessor(const Field3D::SparseField<T> &field, unsigned int tid)
+         : mField(field)
+         , mCounter(sLookups[tid % AI_MAX_THREADS])
+         , mOrder(field.blockOrder())
+         , mBlock(-1, -1, -1)
+      {
+      }
+      
+      inline const Field3D::Box3i& dataWindow() const
+      {
+         return mField.dataWindow();
+      }
+      
+      inline T fastValue(int i, int j, int k) const
+      {
+         const Field3D::Box3i &dw = mField.dataWindow();
+         Field3D::V3i block((i - dw.min.x) >> mOrder, (j - dw.min.y) >> mOrder, (k - dw.min.z) >> mOrder);
+         
+         if (block != mBlock)
+         {
+            mBlock = block;
+            ++(mCounter.count);
+         }
+         
+         return mField.fastValue(i, j, k);
+      }
+      
+   private:
+      
+      const Field3D::SparseField<T> &mField;
+      Counter &mCounter;
+      int mOrder;
+      mutable Field3D::V3i mBlock;
+   };
+   
+private:
+   
+   static AtomicInt sMemoryLimit;
+   static AtomicInt sMinBlockBytes;
+   static AtomicInt sMaxBlockBytes;
+   static Counter sLookups[AI_MAX_THREADS];
+};
+
+AtomicInt SparseBlockCache::sMemoryLimit(0);
+AtomicInt SparseBlockCache::sMinBlockBytes(0);
+AtomicInt SparseBlockCache::sMaxBlockBytes(0);
+SparseBlockCache::Counter SparseBlockCache::sLookups[AI_MAX_THREADS];
+
+// Identifies a file's content: resolved path, modification time and size
+static std::string FileKey(const std::string &path)
+{
+   std::string rpath = path;
+   
+   #ifdef _WIN32
+   char buffer[_MAX_PATH];
+   if (_fullpath(buffer, path.c_str(), _MAX_PATH))
+   {
+      rpath = buffer;
+   }
+   #else
+   char *buffer = realpath(path.c_str(), 0);
+   if (buffer)
+   {
+      rpath = buffer;
+      free(buffer);
+   }
+   #endif
+   
+   struct stat st;
+   
+   if (stat(rpath.c_str(), &st) != 0)
+   {
+      return rpath;
+   }
+   
+   char tmp[64];
+   sprintf(tmp, "|%lld|%lld", (long long) st.st_mtime, (long long) st.st_size);
+   
+   return rpath + tmp;
+}
+
+// Container format from the file signature
+static FileFormat DetectFileFormat(const std::string &path)
+{
+   // OpenVDB files are selected by extension
+   if (path.length() > 4)
+   {
+      std::string ext = path.substr(path.length() - 4);
+      
+      for (size_t i=0; i<ext.length(); ++i)
+      {
+         ext[i] = char(tolower(ext[i]));
+      }
+      
+      if (ext == ".vdb")
+      {
+         return FF_vdb;
+      }
+   }
+   
+   static const unsigned char HDF5Magic[8] = {0x89, 'H', 'D', 'F', '\r', '\n', 0x1A, '\n'};
+   static const unsigned char OgawaMagic[5] = {'O', 'g', 'a', 'w', 'a'};
+   
+   unsigned char magic[8];
+   FILE *f = fopen(path.c_str(), "rb");
+   
+   if (!f)
+   {
+      return FF_unknown;
+   }
+   
+   size_t n = fread(magic, 1, 8, f);
+   
+   fclose(f);
+   
+   if (n >= 8 && !memcmp(magic, HDF5Magic, 8))
+   {
+      return FF_hdf5;
+   }
+   else if (n >= 5 && !memcmp(magic, OgawaMagic, 5))
+   {
+      return FF_ogawa;
+   }
+   else
+   {
+      return FF_unknown;
+   }
+}
+
+static const char* FileFormatToString(FileFormat ff)
+{
+   switch (ff)
+   {
+   case FF_hdf5:
+      return "HDF5";
+   case FF_ogawa:
+      return "Ogawa";
+   case FF_vdb:
+      return "OpenVDB";
+   default:
+      return "unknown";
+   }
+}
+
+// Ask the system to read a whole file into its cache (-sequentialRead), so that
+// the many small reads issued when it is opened and its fields read afterwards
+// are served from memory. The file is read in the background with large
+// sequential reads, nothing is copied to the process. Returns the file size, or
+// -1 if it is larger than 'maxBytes' or the hint isn't available (Linux only).
+static long long ReadAhead(const std::string &path, long long maxBytes)
+{
+   #ifdef __linux__
+   struct stat st;
+   
+   if (stat(path.c_str(), &st) != 0 || (long long) st.st_size > maxBytes)
+   {
+      return -1;
+   }
+   
+   int fd = open(path.c_str(), O_RDONLY);
+   
+   if (fd < 0)
+   {
+      return -1;
+   }
+   
+   // only queues the reads
+   int rv = posix_fadvise(fd, 0, st.st_size, POSIX_FADV_WILLNEED);
+   
+   close(fd);
+   
+   return (rv == 0 ? (long long) st.st_size : -1);
+   #else
+   return -1;
+   #endif
+}
+
+// Local copies of source files read from network storage (-stageDir). Each
+// version of a file (see FileKey) is copied once to '<dir>/<hash>_<basename>':
+// data is written to a temporary name and renamed in place so that concurrent
+// processes only ever open complete copies. Render cache sidecars of staged
+// files are written next to the copy, and the least recently used files are
+// evicted together with their sidecars to keep the directory under budget.
+class StagingCache
+{
+public:
+   
+   // Returns the path of the local copy, or the source path if it could not be staged
+   static std::string Stage(const std::string &path, const std::string &dir, float maxMB, bool verbose)
+   {
+      std::string key = FileKey(path);
+      
+      size_t p = path.find_last_of("\\/");
+      std::string basename = (p != std::string::npos ? path.substr(p + 1) : path);
+      
+      char prefix[32];
+      sprintf(prefix, "%016llx_", HashString(key));
+      
+      std::string local = dir + "/" + prefix + basename;
+      
+      struct stat st;
+      
+      if (stat(local.c_str(), &st) == 0)
+      {
+         Touch(local);
+      }
+      else
+      {
+         double t0 = GetTime();
+         
+         if (!MakeDir(dir) || !Copy(path, local))
+         {
+            AiMsgWarning("[volume_field3d] Could not stage \"%s\" in \"%s\", reading it in place", path.c_str(), dir.c_str());
+            return path;
+         }
+         
+         // source modified while being copied
+         if (FileKey(path) != key)
+         {
+            remove(local.c_str());
+            AiMsgWarning("[volume_field3d] \"%s\" modified while being staged, reading it in place", path.c_str());
+            return path;
+         }
+         
+         if (verbose)
+         {
+            AiMsgInfo("[volume_field3d] Staged \"%s\" to \"%s\" in %.3f second(s)", path.c_str(), local.c_str(), GetTime() - t0);
+         }
+      }
+      
+      if (maxMB > 0.0f)
+      {
+         Evict(dir, (long long)(double(maxMB) * 1024.0 * 1024.0), std::string(prefix), verbose);
+      }
+      
+      return local;
+   }
+   
+   // Mark a local copy as recently used. Staged files are opened again after
+   // staging (layers read on demand, additional Ogawa handles, sidecars): each
+   // use restarts the eviction grace period.
+   static void Touch(const std::string &local)
+   {
+      utime(local.c_str(), 0);
+   }
+   
+private:
+   
+   // Files used (or being written) within this delay are never evicted so that a
+   // process doesn't lose a copy between staging and opening it
+   static const int GracePeriod = 60;
+   
+   // Temporary files older than this were left by a process that died while copying
+   static const int StaleTemporary = 3600;
+   
+   struct Entry
+   {
+      std::vector<std::string> files;
+      long long size;
+      time_t used;
+      
+      Entry() : size(0), used(0) {}
+   };
+   
+   static bool IsTemporary(const std::string &name)
+   {
+      return (name.length() > 4 && name.compare(name.length() - 4, 4, ".tmp") == 0);
+   }
+   
+   static bool IsStaged(const std::string &name)
+   {
+      if (name.length() < 17 || name[16] != '_')
+      {
+         return false;
+      }
+      
+      for (size_t i=0; i<16; ++i)
+      {
+         if (!isxdigit((unsigned char) name[i]))
+         {
+            return false;
+         }
+      }
+      
+      return true;
+   }
+   
+   static bool MakeDir(const std::string &dir)
+   {
+      struct stat st;
+      
+      if (stat(dir.c_str(), &st) == 0)
+      {
+         return ((st.st_mode & S_IFDIR) != 0);
+      }
+      
+      #ifdef _WIN32
+      return (CreateDirectoryA(dir.c_str(), NULL) || GetLastError() == ERROR_ALREADY_EXISTS);
+      #else
+      return (mkdir(dir.c_str(), 0777) == 0 || errno == EEXIST);
+      #endif
+   }
+   
+   static bool Copy(const std::string &src, const std::string &dst)
+   {
+      static AtomicInt sTemporaryCount(0);
+      
+      FILE *in = fopen(src.c_str(), "rb");
+      
+      if (!in)
+      {
+         return false;
+      }
+      
+      // unique among processes and threads
+      char suffix[64];
+      #ifdef _WIN32
+      sprintf(suffix, ".%lu.%ld.tmp", (unsigned long) GetCurrentProcessId(), sTemporaryCount.add(1));
+      #else
+      sprintf(suffix, ".%ld.%ld.tmp", (long) getpid(), sTemporaryCount.add(1));
+      #endif
+      
+      std::string tmp = dst + suffix;
+      
+      FILE *out = fopen(tmp.c_str(), "wb");
+      
+      if (!out)
+      {
+         fclose(in);
+         return false;
+      }
+      
+      // large sequential reads
+      std::vector<char> buffer(4 << 20);
+      bool ok = true;
+      size_t n;
+      
+      while (ok && (n = fread(&buffer[0], 1, buffer.size(), in)) > 0)
+      {
+         ok = (fwrite(&buffer[0], 1, n, out) == n);
+      }
+      
+      ok = (ok && !ferror(in));
+      ok = (fclose(out) == 0 && ok);
+      
+      fclose(in);
+      
+      if (ok)
+      {
+         #ifdef _WIN32
+         // fails if the copy is in use, in which case it's already complete
+         ok = (MoveFileExA(tmp.c_str(), dst.c_str(), MOVEFILE_REPLACE_EXISTING) != 0);
+         if (!ok)
+         {
+            struct stat st;
+            ok = (stat(dst.c_str(), &st) == 0);
+         }
+         #else
+         ok = (rename(tmp.c_str(), dst.c_str()) == 0);
+         #endif
+      }
+      
+      if (!ok)
+      {
+         remove(tmp.c_str());
+      }
+      
+      return ok;
+   }
+   
+   static void ListFiles(const std::string &dir, std::vector<std::string> &names)
+   {
+      #ifdef _WIN32
+      WIN32_FIND_DATAA fd;
+      HANDLE h = FindFirstFileA((dir + "\\*").c_str(), &fd);
+      if (h != INVALID_HANDLE_VALUE)
+      {
+         do
+         {
+            names.push_back(fd.cFileName);
+         } while (FindNextFileA(h, &fd));
+         FindClose(h);
+      }
+      #else
+      DIR *d = opendir(dir.c_str());
+      if (d)
+      {
+         struct dirent *de;
+         while ((de = readdir(d)) != 0)
+         {
+            names.push_back(de->d_name);
+         }
+         closedir(d);
+      }
+      #endif
+   }
+   
+   // Remove least recently used files (with their sidecars) until the directory
+   // content fits in 'maxBytes'. 'keep' is the prefix of the file just staged.
+   static void Evict(const std::string &dir, long long maxBytes, const std::string &keep, bool verbose)
+   {
+      std::vector<std::string> names;
+      std::map<std::string, Entry> entries;
+      long long total = 0;
+      time_t now = time(0);
+      
+      ListFiles(dir, names);
+      
+      for (size_t i=0; i<names.size(); ++i)
+      {
+         if (!IsStaged(names[i]))
+         {
+            continue;
+         }
+         
+         std::string path = dir + "/" + names[i];
+         struct stat st;
+         
+         if (stat(path.c_str(), &st) != 0 || (st.st_mode & S_IFDIR) != 0)
+         {
+            continue;
+         }
+         
+         if (IsTemporary(names[i]))
+         {
+            if (now - st.st_mtime > StaleTemporary)
+            {
+               remove(path.c_str());
+               continue;
+            }
+         }
+         
+         Entry &e = entries[names[i].substr(0, 17)];
+         
+         e.files.push_back(path);
+         e.size += (long long) st.st_size;
+         e.used = std::max(e.used, st.st_mtime);
+         
+         total += (long long) st.st_size;
+      }
+      
+      if (total <= maxBytes)
+      {
+         return;
+      }
+      
+      std::vector<std::pair<time_t, std::string> > order;
+      
+      for (std::map<std::string, Entry>::iterator it=entries.begin(); it!=entries.end(); ++it)
+      {
+         if (it->first != keep && now - it->second.used > GracePeriod)
+         {
+            order.push_back(std::make_pair(it->second.used, it->first));
+         }
+      }
+      
+      std::sort(order.begin(), order.end());
+      
+      for (size_t i=0; i<order.size() && total > maxBytes; ++i)
+      {
+         Entry &e = entries[order[i].second];
+         
+         for (size_t j=0; j<e.files.size(); ++j)
+         {
+            remove(e.files[j].c_str());
+         }
+         
+         total -= e.size;
+         
+         if (verbose)
+         {
+            AiMsgInfo("[volume_field3d] Evicted %s from staging directory (%.2f MB)", e.files[0].c_str(), double(e.size) / (1024.0 * 1024.0));
+         }
+      }
+   }
+};
+
+// Downsampling (-downsample): each coarse voxel averages the source voxels whose
+// center falls within it. Coarse fields cover the same extents in local space so
+// their mapping only differs by resolution.
+
+template <typename T> struct DownsampleTraits { typedef T Accum; };
+template <> struct DownsampleTraits<Field3D::half> { typedef float Accum; };
+template <> struct DownsampleTraits<float> { typedef double Accum; };
+template <> struct DownsampleTraits<Field3D::V3h> { typedef Field3D::V3f Accum; };
+template <> struct DownsampleTraits<Field3D::V3f> { typedef Field3D::V3d Accum; };
+
+inline int DivFloor(int a, int b)
+{
+   return (a >= 0 ? a / b : -((b - 1 - a) / b));
+}
+
+inline int DownsampledResolution(int res, int n)
+{
+   return std::max(1, (res + n - 1) / n);
+}
+
+// Setup coarse field size and mapping, and compute the range of source voxels
+// covered by each coarse voxel along each axis
+template <class SrcField, class DstField>
+void SetupDownsample(const SrcField &src, DstField &dst, int n, std::vector<int> lo[3], std::vector<int> hi[3])
+{
+   const Field3D::Box3i &ext = src.extents();
+   const Field3D::Box3i &dw = src.dataWindow();
+   Field3D::Box3i cext;
+   Field3D::Box3i cdw;
+   
+   for (int a=0; a<3; ++a)
+   {
+      cext.min[a] = DivFloor(ext.min[a], n);
+      cext.max[a] = cext.min[a] + DownsampledResolution(ext.max[a] - ext.min[a] + 1, n) - 1;
+      cdw.min[a] = cext.min[a] + DivFloor(dw.min[a] - ext.min[a], n);
+      cdw.max[a] = cext.min[a] + DivFloor(dw.max[a] - ext.min[a], n);
+   }
+   
+   dst.name = src.name;
+   dst.attribute = src.attribute;
+   dst.copyMetadata(src);
+   dst.setMapping(src.mapping()->clone());
+   dst.setSize(cext, cdw);
+   
+   for (int a=0; a<3; ++a)
+   {
+      int count = cdw.max[a] - cdw.min[a] + 1;
+      
+      lo[a].resize(count);
+      hi[a].resize(count);
+      
+      for (int i=0; i<count; ++i)
+      {
+         Field3D::V3d c0(0.0), c1(0.0), l0, l1, s0, s1;
+         
+         c0[a] = double(cdw.min[a] + i);
+         c1[a] = c0[a] + 1.0;
+         
+         dst.mapping()->voxelToLocal(c0, l0);
+         dst.mapping()->voxelToLocal(c1, l1);
+         src.mapping()->localToVoxel(l0, s0);
+         src.mapping()->localToVoxel(l1, s1);
+         
+         // voxel v center is at v + 0.5
+         lo[a][i] = std::max(dw.min[a], int(ceil(s0[a] - 0.5)));
+         hi[a][i] = std::min(dw.max[a], int(ceil(s1[a] - 0.5)) - 1);
+      }
+   }
+}
+
+template <class F>
+typename F::value_type BoxAverage(const F &src, int i0, int i1, int j0, int j1, int k0, int k1,
+                                  const typename F::value_type &defval)
+{
+   typedef typename F::value_type T;
+   typedef typename DownsampleTraits<T>::Accum Accum;
+   
+   if (i1 < i0 || j1 < j0 || k1 < k0)
+   {
+      return defval;
+   }
+   
+   Accum sum(0);
+   
+   for (int k=k0; k<=k1; ++k)
+   {
+      for (int j=j0; j<=j1; ++j)
+      {
+         for (int i=i0; i<=i1; ++i)
+         {
+            sum += Accum(src.fastValue(i, j, k));
+         }
+      }
+   }
+   
+   return T(sum * (1.0 / double((i1 - i0 + 1) * (j1 - j0 + 1) * (k1 - k0 + 1))));
+}
+
+template <typename T>
+typename Field3D::DenseField<T>::Ptr DownsampleDense(const Field3D::DenseField<T> &src, int n)
+{
+   typename Field3D::DenseField<T>::Ptr dst(new Field3D::DenseField<T>());
+   std::vector<int> lo[3], hi[3];
+   
+   SetupDownsample(src, *dst, n, lo, hi);
+   
+   const Field3D::Box3i &cdw = dst->dataWindow();
+   
+   for (int k=cdw.min.z; k<=cdw.max.z; ++k)
+   {
+      int ck = k - cdw.min.z;
+      
+      for (int j=cdw.min.y; j<=cdw.max.y; ++j)
+      {
+         int cj = j - cdw.min.y;
+         
+         for (int i=cdw.min.x; i<=cdw.max.x; ++i)
+         {
+            int ci = i - cdw.min.x;
+            
+            dst->fastLValue(i, j, k) = BoxAverage(src, lo[0][ci], hi[0][ci], lo[1][cj], hi[1][cj], lo[2][ck], hi[2][ck], T(0));
+         }
+      }
+   }
+   
+   return dst;
+}
+
+template <typename T>
+typename Field3D::SparseField<T>::Ptr DownsampleSparse(const Field3D::SparseField<T> &src, int n)
+{
+   typename Field3D::SparseField<T>::Ptr dst(new Field3D::SparseField<T>());
+   std::vector<int> lo[3], hi[3];
+   
+   dst->setBlockOrder(src.blockOrder());
+   
+   SetupDownsample(src, *dst, n, lo, hi);
+   
+   const Field3D::Box3i &dw = src.dataWindow();
+   const Field3D::Box3i &cdw = dst->dataWindow();
+   
+   int order = src.blockOrder();
+   int bsize = dst->blockSize();
+   Field3D::V3i bres = dst->blockRes();
+   
+   // empty blocks value, usually 0
+   T background = src.getBlockEmptyValue(0, 0, 0);
+   
+   dst->clear(background);
+   
+   for (int bk=0; bk<bres.z; ++bk)
+   {
+      int k0 = cdw.min.z + bk * bsize;
+      int k1 = std::min(cdw.max.z, k0 + bsize - 1);
+      
+      for (int bj=0; bj<bres.y; ++bj)
+      {
+         int j0 = cdw.min.y + bj * bsize;
+         int j1 = std::min(cdw.max.y, j0 + bsize - 1);
+         
+         for (int bi=0; bi<bres.x; ++bi)
+         {
+            int i0 = cdw.min.x + bi * bsize;
+            int i1 = std::min(cdw.max.x, i0 + bsize - 1);
+            
+            int si0 = lo[0][i0 - cdw.min.x];
+            int si1 = hi[0][i1 - cdw.min.x];
+            int sj0 = lo[1][j0 - cdw.min.y];
+            int sj1 = hi[1][j1 - cdw.min.y];
+            int sk0 = lo[2][k0 - cdw.min.z];
+            int sk1 = hi[2][k1 - cdw.min.z];
+            
+            if (si1 < si0 || sj1 < sj0 || sk1 < sk0)
+            {
+               continue;
+            }
+            
+            // keep block empty if all the source blocks it covers are
+            bool empty = true;
+            
+            for (int sbk=((sk0 - dw.min.z) >> order); empty && sbk<=((sk1 - dw.min.z) >> order); ++sbk)
+            {
+               for (int sbj=((sj0 - dw.min.y) >> order); empty && sbj<=((sj1 - dw.min.y) >> order); ++sbj)
+               {
+                  for (int sbi=((si0 - dw.min.x) >> order); empty && sbi<=((si1 - dw.min.x) >> order); ++sbi)
+                  {
+                     if (src.blockIsAllocated(sbi, sbj, sbk) || src.getBlockEmptyValue(sbi, sbj, sbk) != background)
+                     {
+                        empty = false;
+                     }
+                  }
+               }
+            }
+            
+            if (empty)
+            {
+               continue;
+            }
+            
+            for (int k=k0; k<=k1; ++k)
+            {
+               int ck = k - cdw.min.z;
+               
+               for (int j=j0; j<=j1; ++j)
+               {
+                  int cj = j - cdw.min.y;
+                  
+                  for (int i=i0; i<=i1; ++i)
+                  {
+                     int ci = i - cdw.min.x;
+                     
+                     dst->fastLValue(i, j, k) = BoxAverage(src, lo[0][ci], hi[0][ci], lo[1][cj], hi[1][cj], lo[2][ck], hi[2][ck], background);
+                  }
+               }
+            }
+         }
+      }
+   }
+   
+   return dst;
+}
+
+// Cell centered values of a MAC field (average of the cell's faces), sampled as
+// a dense field by BoxAverage
+template <typename T>
+struct MACCellValues
+{
+   typedef T value_type;
+   
+   MACCellValues(const Field3D::MACField<T> &field)
+      : mField(field)
+   {
+   }
+   
+   inline T fastValue(int i, int j, int k) const
+   {
+      return mField.value(i, j, k);
+   }
+   
+   const Field3D::MACField<T> &mField;
+};
+
+template <typename T>
+typename Field3D::DenseField<T>::Ptr DownsampleMAC(const Field3D::MACField<T> &src, int n)
+{
+   typename Field3D::DenseField<T>::Ptr dst(new Field3D::DenseField<T>());
+   std::vector<int> lo[3], hi[3];
+   MACCellValues<T> values(src);
+   
+   SetupDownsample(src, *dst, n, lo, hi);
+   
+   const Field3D::Box3i &cdw = dst->dataWindow();
+   
+   for (int k=cdw.min.z; k<=cdw.max.z; ++k)
+   {
+      int ck = k - cdw.min.z;
+      
+      for (int j=cdw.min.y; j<=cdw.max.y; ++j)
+      {
+         int cj = j - cdw.min.y;
+         
+         for (int i=cdw.min.x; i<=cdw.max.x; ++i)
+         {
+            int ci = i - cdw.min.x;
+            
+            dst->fastLValue(i, j, k) = BoxAverage(values, lo[0][ci], hi[0][ci], lo[1][cj], hi[1][cj], lo[2][ck], hi[2][ck], T(0));
+         }
+      }
+   }
+   
+   return dst;
+}
+
+// MAC fields only exist for vector types
+template <typename T>
+struct MACDownsample
+{
+   static typename Field3D::Field<T>::Ptr Run(typename Field3D::Field<T>::Ptr, int)
+   {
+      return typename Field3D::Field<T>::Ptr();
+   }
+};
+
+template <typename T>
+struct MACDownsample<FIELD3D_VEC3_T<T> >
+{
+   typedef FIELD3D_VEC3_T<T> V;
+   
+   static typename Field3D::Field<V>::Ptr Run(typename Field3D::Field<V>::Ptr field, int n)
+   {
+      typename Field3D::MACField<V>::Ptr mac = Field3D::field_dynamic_cast<Field3D::MACField<V> >(field);
+      
+      if (!mac)
+      {
+         return typename Field3D::Field<V>::Ptr();
+      }
+      
+      return DownsampleMAC<V>(*mac, n);
+   }
+};
+
+// Sparse and dense fields are downsampled to the same class, MAC fields to dense
+// fields of their cell centered values. Others are returned as is
+template <typename T>
+typename Field3D::Field<T>::Ptr DownsampleField(typename Field3D::Field<T>::Ptr field, int n)
+{
+   if (n <= 1 || !field)
+   {
+      return field;
+   }
+   
+   typename Field3D::SparseField<T>::Ptr sparse = Field3D::field_dynamic_cast<Field3D::SparseField<T> >(field);
+   
+   if (sparse)
+   {
+      return DownsampleSparse<T>(*sparse, n);
+   }
+   
+   typename Field3D::DenseField<T>::Ptr dense = Field3D::field_dynamic_cast<Field3D::DenseField<T> >(field);
+   
+   if (dense)
+   {
+      return DownsampleDense<T>(*dense, n);
+   }
+   
+   typename Field3D::Field<T>::Ptr mac = MACDownsample<T>::Run(field, n);
+   
+   if (mac)
+   {
+      return mac;
+   }
+   
+   return field;
+}
+
+// Returns the number of fields left at full resolution
+template <typename T>
+size_t DownsampleFields(typename Field3D::Field<T>::Vec &fields, int n)
+{
+   size_t kept = 0;
+   
+   for (size_t i=0; i<fields.size(); ++i)
+   {
+      typename Field3D::Field<T>::Ptr field = DownsampleField<T>(fields[i], n);
+      
+      if (field == fields[i])
+      {
+         ++kept;
+      }
+      
+      fields[i] = field;
+   }
+   
+   return kept;
+}
+
+// Low resolution copies of the given fields, at most 'res' voxels along any axis
+template <typename T>
+void BuildProxyFields(typename Field3D::Field<T>::Vec &fields, int res)
+{
+   for (size_t i=0; i<fields.size(); ++i)
+   {
+      Field3D::V3i dres = fields[i]->dataResolution();
+      int maxRes = std::max(dres.x, std::max(dres.y, dres.z));
+      
+      fields[i] = DownsampleField<T>(fields[i], (maxRes + res - 1) / res);
+   }
+}
+
+// Replace MIP fields by their coarsest level. Field3D reads MIP levels on demand: the
+// finer levels are not read. Returns false (fields unchanged) if a field isn't a MIP field
+template <typename T>
+bool CoarsestMipLevels(typename Field3D::Field<T>::Vec &fields)
+{
+   typename Field3D::Field<T>::Vec levels(fields.size());
+   
+   for (size_t i=0; i<fields.size(); ++i)
+   {
+      typename Field3D::MIPField<Field3D::SparseField<T> >::Ptr sparse = Field3D::field_dynamic_cast<Field3D::MIPField<Field3D::SparseField<T> > >(fields[i]);
+      typename Field3D::MIPField<Field3D::DenseField<T> >::Ptr dense = Field3D::field_dynamic_cast<Field3D::MIPField<Field3D::DenseField<T> > >(fields[i]);
+      
+      if (sparse && sparse->numLevels() > 0)
+      {
+         levels[i] = sparse->concreteMipLevel(sparse->numLevels() - 1);
+      }
+      else if (dense && dense->numLevels() > 0)
+      {
+         levels[i] = dense->concreteMipLevel(dense->numLevels() - 1);
+      }
+      else
+      {
+         return false;
+      }
+   }
+   
+   fields.swap(levels);
+   
+   return true;
+}
+
+// MIP levels (coarser resolutions) of a field, finest first
+
+typedef std::map<const Field3D::FieldRes*, Field3D::FieldRes::Vec> MipLevels;
+
+// Replace MIP fields read from file by their finest level, coarser levels go to 'levels'
+template <typename T>
+void ExpandMipFields(typename Field3D::Field<T>::Vec &fields, MipLevels &levels)
+{
+   for (size_t i=0; i<fields.size(); ++i)
+   {
+      typename Field3D::MIPField<Field3D::SparseField<T> >::Ptr sparse = Field3D::field_dynamic_cast<Field3D::MIPField<Field3D::SparseField<T> > >(fields[i]);
+      
+      if (sparse && sparse->numLevels() > 0)
+      {
+         fields[i] = sparse->concreteMipLevel(0);
+         
+         Field3D::FieldRes::Vec &fl = levels[fields[i].get()];
+         
+         for (size_t l=1; l<sparse->numLevels(); ++l)
+         {
+            fl.push_back(sparse->concreteMipLevel(l));
+         }
+         
+         continue;
+      }
+      
+      typename Field3D::MIPField<Field3D::DenseField<T> >::Ptr dense = Field3D::field_dynamic_cast<Field3D::MIPField<Field3D::DenseField<T> > >(fields[i]);
+      
+      if (dense && dense->numLevels() > 0)
+      {
+         fields[i] = dense->concreteMipLevel(0);
+         
+         Field3D::FieldRes::Vec &fl = levels[fields[i].get()];
+         
+         for (size_t l=1; l<dense->numLevels(); ++l)
+         {
+            fl.push_back(dense->concreteMipLevel(l));
+         }
+      }
+   }
+}
+
+// Generate levels by successive 2x downsampling for fields without MIP levels,
+// down to a resolution of 'minRes' voxels
+template <typename T>
+void BuildMipLevels(const typename Field3D::Field<T>::Vec &fields, MipLevels &levels, int minRes)
+{
+   for (size_t i=0; i<fields.size(); ++i)
+   {
+      if (levels.find(fields[i].get()) != levels.end())
+      {
+         continue;
+      }
+      
+      if (!Field3D::field_dynamic_cast<Field3D::SparseField<T> >(fields[i]) &&
+          !Field3D::field_dynamic_cast<Field3D::DenseField<T> >(fields[i]))
+      {
+         continue;
+      }
+      
+      Field3D::FieldRes::Vec &fl = levels[fields[i].get()];
+      typename Field3D::Field<T>::Ptr level = fields[i];
+      
+      while (true)
+      {
+         Field3D::V3i res = level->dataResolution();
+         
+         if (std::max(res.x, std::max(res.y, res.z)) <= minRes)
+         {
+            break;
+         }
+         
+         level = DownsampleField<T>(level, 2);
+         
+         fl.push_back(level);
+      }
+   }
+}
+
+// Dense to sparse conversion (-denseToSparse): blocks holding only zeros are
+// left unallocated. Rows of blocks are converted in parallel (each row writes
+// distinct blocks).
+
+template <typename T>
+class DenseToSparseTask : public ParallelTask
+{
+public:
+   
+   DenseToSparseTask(const Field3D::DenseField<T> &src, Field3D::SparseField<T> &dst)
+      : mSrc(src)
+      , mDst(dst)
+   {
+   }
+   
+   virtual void run(size_t index)
+   {
+      const Field3D::Box3i &dw = mDst.dataWindow();
+      int bsize = mDst.blockSize();
+      Field3D::V3i bres = mDst.blockRes();
+      T background(0);
+      
+      int bj = int(index) % bres.y;
+      int bk = int(index) / bres.y;
+      
+      int j0 = dw.min.y + bj * bsize;
+      int j1 = std::min(dw.max.y, j0 + bsize - 1);
+      int k0 = dw.min.z + bk * bsize;
+      int k1 = std::min(dw.max.z, k0 + bsize - 1);
+      
+      for (int bi=0; bi<bres.x; ++bi)
+      {
+         int i0 = dw.min.x + bi * bsize;
+         int i1 = std::min(dw.max.x, i0 + bsize - 1);
+         
+         bool empty = true;
+         
+         for (int k=k0; empty && k<=k1; ++k)
+         {
+            for (int j=j0; empty && j<=j1; ++j)
+            {
+               for (int i=i0; empty && i<=i1; ++i)
+               {
+                  if (mSrc.fastValue(i, j, k) != background)
+                  {
+                     empty = false;
+                  }
+               }
+            }
+         }
+         
+         if (empty)
+         {
+            continue;
+         }
+         
+         for (int k=k0; k<=k1; ++k)
+         {
+            for (int j=j0; j<=j1; ++j)
+            {
+               for (int i=i0; i<=i1; ++i)
+               {
+                  mDst.fastLValue(i, j, k) = mSrc.fastValue(i, j, k);
+               }
+            }
+         }
+      }
+   }
+   
+private:
+   
+   const Field3D::DenseField<T> &mSrc;
+   Field3D::SparseField<T> &mDst;
+};
+
+template <typename T>
+typename Field3D::Field<T>::Ptr DenseToSparse(typename Field3D::Field<T>::Ptr field, int numThreads)
+{
+   typename Field3D::DenseField<T>::Ptr dense = Field3D::field_dynamic_cast<Field3D::DenseField<T> >(field);
+   
+   if (!dense)
+   {
+      return field;
+   }
+   
+   typename Field3D::SparseField<T>::Ptr sparse(new Field3D::SparseField<T>());
+   
+   sparse->name = dense->name;
+   sparse->attribute = dense->attribute;
+   sparse->copyMetadata(*dense);
+   sparse->setMapping(dense->mapping()->clone());
+   sparse->setSize(dense->extents(), dense->dataWindow());
+   sparse->clear(T(0));
+   
+   Field3D::V3i bres = sparse->blockRes();
+   DenseToSparseTask<T> task(*dense, *sparse);
+   
+   RunParallel(task, size_t(bres.y) * size_t(bres.z), numThreads);
+   
+   return sparse;
+}
+
+// Dense to bricked conversion (-bricked): rows of bricks are filled in parallel
+
+template <typename T>
+class DenseToBrickedTask : public ParallelTask
+{
+public:
+   
+   DenseToBrickedTask(const Field3D::DenseField<T> &src, BrickedField<T> &dst)
+      : mSrc(src)
+      , mDst(dst)
+   {
+   }
+   
+   virtual void run(size_t index)
+   {
+      const Field3D::Box3i &dw = mDst.dataWindow();
+      int bsize = BrickedField<T>::BrickSize;
+      Field3D::V3i bricks = mDst.bricks();
+      
+      int bj = int(index) % bricks.y;
+      int bk = int(index) / bricks.y;
+      
+      int j0 = dw.min.y + bj * bsize;
+      int j1 = std::min(dw.max.y, j0 + bsize - 1);
+      int k0 = dw.min.z + bk * bsize;
+      int k1 = std::min(dw.max.z, k0 + bsize - 1);
+      
+      for (int k=k0; k<=k1; ++k)
+      {
+         for (int j=j0; j<=j1; ++j)
+         {
+            for (int i=dw.min.x; i<=dw.max.x; ++i)
+            {
+               mDst.fastLValue(i, j, k) = mSrc.fastValue(i, j, k);
+            }
+         }
+      }
+   }
+   
+private:
+   
+   const Field3D::DenseField<T> &mSrc;
+   BrickedField<T> &mDst;
+};
+
+template <typename T>
+typename Field3D::Field<T>::Ptr DenseToBricked(typename Field3D::Field<T>::Ptr field, int numThreads, Arena *arena)
+{
+   typename Field3D::DenseField<T>::Ptr dense = Field3D::field_dynamic_cast<Field3D::DenseField<T> >(field);
+   
+   if (!dense)
+   {
+      return field;
+   }
+   
+   typename BrickedField<T>::Ptr bricked(new BrickedField<T>());
+   
+   bricked->setup(*dense, arena);
+   
+   Field3D::V3i bricks = bricked->bricks();
+   DenseToBrickedTask<T> task(*dense, *bricked);
+   
+   RunParallel(task, size_t(bricks.y) * size_t(bricks.z), numThreads);
+   
+   return bricked;
+}
+
+// Reduced precision conversion (-precision): rows of bricks are encoded in parallel
+
+template <typename T>
+class QuantizeTask : public ParallelTask
+{
+public:
+   
+   QuantizeTask(const Field3D::Field<T> &src, QuantizedField<T> &dst)
+      : mSrc(src)
+      , mDst(dst)
+      , mStats(size_t(dst.brickRes().y) * size_t(dst.brickRes().z))
+   {
+   }
+   
+   virtual void run(size_t index)
+   {
+      Field3D::V3i bres = mDst.brickRes();
+      
+      int bj = int(index) % bres.y;
+      int bk = int(index) / bres.y;
+      
+      for (int bi=0; bi<bres.x; ++bi)
+      {
+         mDst.encode(mSrc, bi, bj, bk, mStats[index]);
+      }
+   }
+   
+   void stats(QuantizeStats &out) const
+   {
+      for (size_t i=0; i<mStats.size(); ++i)
+      {
+         out.merge(mStats[i]);
+      }
+   }
+   
+private:
+   
+   const Field3D::Field<T> &mSrc;
+   QuantizedField<T> &mDst;
+   std::vector<QuantizeStats> mStats;
+};
+
+template <typename T>
+typename Field3D::Field<T>::Ptr Quantize(typename Field3D::Field<T>::Ptr field, StoragePrecision precision,
+                                         int numThreads, QuantizeStats &stats, Arena *arena)
+{
+   // only reduce precision, MAC fields keep their storage
+   if (!field ||
+       StoragePrecisionSize(precision) >= sizeof(typename ComponentTraits<T>::Component) ||
+       QuantizedField<T>::Cast(field) ||
+       MACFieldCheck<T>::Is(field))
+   {
+      return field;
+   }
+   
+   typename QuantizedField<T>::Ptr quantized(new QuantizedField<T>());
+   
+   quantized->setup(*field, precision, arena);
+   
+   Field3D::V3i bres = quantized->brickRes();
+   QuantizeTask<T> task(*field, *quantized);
+   
+   RunParallel(task, size_t(bres.y) * size_t(bres.z), numThreads);
+   
+   task.stats(stats);
+   
+   return quantized;
+}
+
+// Lossless compression (-compress): rows of bricks are encoded in parallel
+
+template <typename T>
+class CompressTask : public ParallelTask
+{
+public:
+   
+   CompressTask(const Field3D::Field<T> &src, CompressedField<T> &dst)
+      : mSrc(src)
+      , mDst(dst)
+   {
+   }
+   
+   virtual void run(size_t index)
+   {
+      Field3D::V3i bres = mDst.brickRes();
+      
+      int bj = int(index) % bres.y;
+      int bk = int(index) / bres.y;
+      
+      for (int bi=0; bi<bres.x; ++bi)
+      {
+         mDst.encode(mSrc, bi, bj, bk);
+      }
+   }
+   
+private:
+   
+   const Field3D::Field<T> &mSrc;
+   CompressedField<T> &mDst;
+};
+
+template <typename T>
+typename Field3D::Field<T>::Ptr Compress(typename Field3D::Field<T>::Ptr field, int numThreads, Arena *arena)
+{
+   // MAC and reduced precision fields keep their storage, sparse fields read
+   // with dynamic block loading are not made resident
+   if (!field ||
+       CompressedField<T>::Cast(field) ||
+       QuantizedField<T>::Cast(field) ||
+       MACFieldCheck<T>::Is(field) ||
+       (Field3D::field_dynamic_cast<Field3D::SparseField<T> >(field) && Field3D::SparseFileManager::singleton().doLimitMemUse()))
+   {
+      return field;
+   }
+   
+   typename CompressedField<T>::Ptr compressed(new CompressedField<T>());
+   
+   compressed->setup(*field);
+   
+   Field3D::V3i bres = compressed->brickRes();
+   CompressTask<T> task(*field, *compressed);
+   
+   RunParallel(task, size_t(bres.y) * size_t(bres.z), numThreads);
+   
+   // i.e. noisy data, or sparse fields whose empty blocks are already free
+   if (compressed->memSize() >= field->memSize())
+   {
+      return field;
+   }
+   
+   // bricks are encoded to private memory first, so that the arena is left
+   // untouched when the field isn't kept
+   compressed->moveToArena(arena);
+   
+   return compressed;
+}
+
+template <typename T>
+struct Quantizer
+{
+   StoragePrecision precision;
+   QuantizeStats *stats;
+   Arena *arena;
+   
+   Quantizer(StoragePrecision p, QuantizeStats &s, Arena *a)
+      : precision(p)
+      , stats(&s)
+      , arena(a)
+   {
+   }
+   
+   typename Field3D::Field<T>::Ptr operator()(typename Field3D::Field<T>::Ptr field, int numThreads) const
+   {
+      return Quantize<T>(field, precision, numThreads, *stats, arena);
+   }
+};
+
+// Binds the arena (if any) new fields voxels are allocated from to a conversion
+template <typename T>
+struct ArenaConverter
+{
+   typedef typename Field3D::Field<T>::Ptr (*Function)(typename Field3D::Field<T>::Ptr, int, Arena*);
+   
+   Function function;
+   Arena *arena;
+   
+   ArenaConverter(Function f, Arena *a)
+      : function(f)
+      , arena(a)
+   {
+   }
+   
+   typename Field3D::Field<T>::Ptr operator()(typename Field3D::Field<T>::Ptr field, int numThreads) const
+   {
+      return function(field, numThreads, arena);
+   }
+};
+
+// Convert fields (and their MIP levels) using the given function or functor.
+// Returns the number of fields converted
+template <typename T, class Converter>
+size_t ConvertFields(typename Field3D::Field<T>::Vec &fields, MipLevels &levels, Converter convert,
+                     int numThreads, size_t &inBytes, size_t &outBytes)
+{
+   size_t count = 0;
+   
+   for (size_t i=0; i<fields.size(); ++i)
+   {
+      typename Field3D::Field<T>::Ptr field = convert(fields[i], numThreads);
+      
+      if (field == fields[i])
+      {
+         continue;
+      }
+      
+      inBytes += size_t(fields[i]->memSize());
+      outBytes += size_t(field->memSize());
+      
+      // MIP levels are keyed by their finest level
+      MipLevels::iterator it = levels.find(fields[i].get());
+      
+      if (it != levels.end())
+      {
+         Field3D::FieldRes::Vec fl = it->second;
+         
+         levels.erase(it);
+         
+         for (size_t l=0; l<fl.size(); ++l)
+         {
+            fl[l] = convert(Field3D::field_dynamic_cast<Field3D::Field<T> >(fl[l]), numThreads);
+         }
+         
+         levels[field.get()] = fl;
+      }
+      
+      fields[i] = field;
+      ++count;
+   }
+   
+   return count;
+}
+
+// Fields of a file layer, shared by all the volumes reading it
+struct SharedLayer
+{
+   std::string key;
+   // guarded by FieldCache lock
+   long refCount;
+   
+   AtomicInt loaded;
+   AtCritSec lock;
+   
+   Field3D::Field<Field3D::half>::Vec scalarh;
+   Field3D::Field<float>::Vec scalarf;
+   Field3D::Field<double>::Vec scalard;
+   
+   Field3D::Field<Field3D::V3h>::Vec vectorh;
+   Field3D::Field<Field3D::V3f>::Vec vectorf;
+   Field3D::Field<Field3D::V3d>::Vec vectord;
+   
+   // coarser MIP levels, keyed by full resolution field
+   MipLevels mipLevels;
+   
+   // index in the layer headers (file order) of each field above, half, float
+   // then double fields (see VolumeData::bindHeaders)
+   std::vector<size_t> headerIndices;
+   
+   // storage of the fields built by -bricked, -precision and -compress (-arena)
+   Arena *arena;
+   
+   SharedLayer(const std::string &k)
+      : key(k)
+      , refCount(0)
+      , loaded(0)
+      , arena(0)
+   {
+      AiCritSecInit(&lock);
+   }
+   
+   ~SharedLayer()
+   {
+      // chunks are released with the last field using them
+      if (arena)
+      {
+         arena->unref();
+      }
+      AiCritSecClose(&lock);
+   }
+   
+private:
+   
+   SharedLayer(const SharedLayer&);
+   SharedLayer& operator=(const SharedLayer&);
+};
+
+// Render cache sidecar (-renderCache), in native byte order:
+//   RenderCacheHeader
+//   key (source file key and processing settings), padded to 8 bytes
+//   RenderCacheEntry per field (half, float then double fields), with the index
+//   of the field in the file layer (see SharedLayer::headerIndices)
+//   bricks (64 bytes aligned, uniform bricks 8 bytes aligned) and bricks tables
+
+struct RenderCacheHeader
+{
+   char magic[8];
+   unsigned int version;
+   unsigned int keyLength;
+   unsigned int fieldCount;
+   unsigned int reserved;
+};
+
+struct RenderCacheEntry
+{
+   int dataType;
+   int extents[6];
+   int dataWindow[6];
+   int headerIndex;
+   unsigned long long table;
+};
+
+class RenderCache
+{
+public:
+   
+   static const char *Magic;
+   
+   static std::string Path(const std::string &path, const std::string &partition, const std::string &layer)
+   {
+      std::string rv = path + "." + partition + "." + layer;
+      
+      // keep the sidecar in the same directory
+      for (size_t i=path.length(); i<rv.length(); ++i)
+      {
+         if (rv[i] == '/' || rv[i] == '\\' || rv[i] == ':')
+         {
+            rv[i] = '_';
+         }
+      }
+      
+      return rv + ".f3dc";
+   }
+   
+   // headers: layer fields as declared in the file, each entry names its own
+   // (sl.headerIndices is filled in entry order, see VolumeData::loadFields)
+   static bool Read(const std::string &path, const std::string &key, bool isVector,
+                    const Field3D::FieldRes::Vec &headers, SharedLayer &sl)
+   {
+      return Map(MappedFile::Open(path), key, isVector, headers, sl);
+   }
+   
+   // Create fields from mapped render cache data, file reference is released
+   static bool Map(MappedFile *file, const std::string &key, bool isVector,
+                   const Field3D::FieldRes::Vec &headers, SharedLayer &sl)
+   {
+      if (!file)
+      {
+         return false;
+      }
+      
+      const unsigned char *data = file->data();
+      const RenderCacheHeader *header = (const RenderCacheHeader*) data;
+      size_t entriesOffset = Align(sizeof(RenderCacheHeader) + key.length(), 8);
+      bool valid = (file->size() >= sizeof(RenderCacheHeader) &&
+                    !strncmp(header->magic, Magic, 8) &&
+                    header->version == Version &&
+                    header->keyLength == key.length() &&
+                    header->fieldCount == headers.size() &&
+                    entriesOffset + headers.size() * sizeof(RenderCacheEntry) <= file->size() &&
+                    !memcmp(data + sizeof(RenderCacheHeader), key.c_str(), key.length()));
+      
+      const RenderCacheEntry *entries = (const RenderCacheEntry*) (data + entriesOffset);
+      std::vector<bool> bound(headers.size(), false);
+      int lastType = FDT_half;
+      
+      sl.headerIndices.clear();
+      
+      for (size_t i=0; valid && i<headers.size(); ++i)
+      {
+         size_t index = size_t(entries[i].headerIndex);
+         
+         // entries are grouped by type as the shared layer fields they fill
+         valid = (entries[i].headerIndex >= 0 && index < headers.size() && !bound[index] &&
+                  entries[i].dataType >= lastType);
+         
+         if (!valid)
+         {
+            break;
+         }
+         
+         bound[index] = true;
+         lastType = entries[i].dataType;
+         
+         sl.headerIndices.push_back(index);
+         
+         const Field3D::FieldRes &fh = *headers[index];
+         
+         switch (entries[i].dataType)
+         {
+         case FDT_half:
+            valid = (isVector ? MapField<Field3D::V3h>(fh, entries[i], file, sl.vectorh)
+                              : MapField<Field3D::half>(fh, entries[i], file, sl.scalarh));
+            break;
+         case FDT_float:
+            valid = (isVector ? MapField<Field3D::V3f>(fh, entries[i], file, sl.vectorf)
+                              : MapField<float>(fh, entries[i], file, sl.scalarf));
+            break;
+         case FDT_double:
+            valid = (isVector ? MapField<Field3D::V3d>(fh, entries[i], file, sl.vectord)
+                              : MapField<double>(fh, entries[i], file, sl.scalard));
+            break;
+         default:
+            valid = false;
+         }
+      }
+      
+      // fields hold their own reference
+      file->unref();
+      
+      if (!valid)
+      {
+         sl.scalarh.clear();
+         sl.scalarf.clear();
+         sl.scalard.clear();
+         sl.vectorh.clear();
+         sl.vectorf.clear();
+         sl.vectord.clear();
+         sl.headerIndices.clear();
+      }
+      
+      return valid;
+   }
+   
+   // Only layers without MAC fields or MIP levels are written
+   static bool CanWrite(const SharedLayer &sl)
+   {
+      return (sl.mipLevels.empty() &&
+              Writable<Field3D::V3h>(sl.vectorh) &&
+              Writable<Field3D::V3f>(sl.vectorf) &&
+              Writable<Field3D::V3d>(sl.vectord));
+   }
+   
+   static bool Write(const std::string &path, const std::string &key, const SharedLayer &sl)
+   {
+      if (!CanWrite(sl))
+      {
+         return false;
+      }
+      
+      // write to a temporary file first, renamed once complete
+      char suffix[64];
+      #ifdef _WIN32
+      sprintf(suffix, ".%lu.tmp", (unsigned long) GetCurrentProcessId());
+      #else
+      sprintf(suffix, ".%lu.tmp", (unsigned long) getpid());
+      #endif
+      std::string tmpPath = path + suffix;
+      
+      FILE *f = fopen(tmpPath.c_str(), "wb");
+      
+      if (!f)
+      {
+         return false;
+      }
+      
+      bool ok = WriteLayer(f, key, sl);
+      
+      ok = (fclose(f) == 0 && ok);
+      
+      if (ok)
+      {
+         #ifdef _WIN32
+         remove(path.c_str());
+         #endif
+         ok = (rename(tmpPath.c_str(), path.c_str()) == 0);
+      }
+      
+      if (!ok)
+      {
+         remove(tmpPath.c_str());
+      }
+      
+      return ok;
+   }
+   
+   #ifndef _WIN32
+   
+   // Publish layer data in a new shared memory segment. On success the calling
+   // process is registered as a user of the segment and must detach from it.
+   static bool Publish(const std::string &name, const std::string &key, const SharedLayer &sl)
+   {
+      if (!CanWrite(sl))
+      {
+         return false;
+      }
+      
+      // shared memory objects don't support write on all platforms,
+      // data is written to a temporary file and copied in a mapping
+      FILE *f = tmpfile();
+      
+      if (!f)
+      {
+         return false;
+      }
+      
+      bool ok = (WriteLayer(f, key, sl) && fseek(f, 0, SEEK_END) == 0);
+      long size = (ok ? ftell(f) : -1);
+      
+      if (size <= 0)
+      {
+         fclose(f);
+         return false;
+      }
+      
+      // registered before the segment exists so that other processes never see
+      // it without a live user while it is being filled
+      if (!SharedSegments::Attach(name))
+      {
+         fclose(f);
+         return false;
+      }
+      
+      // fails if another process already published (or is publishing) this layer
+      int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+      
+      if (fd == -1)
+      {
+         // also removes the segment if its publisher died while writing it
+         SharedSegments::Detach(name);
+         fclose(f);
+         return false;
+      }
+      
+      void *data = MAP_FAILED;
+      
+      ok = (ftruncate(fd, off_t(size)) == 0);
+      
+      #ifdef __linux__
+      // reserve the pages now: a full /dev/shm would otherwise only show up as
+      // a SIGBUS while copying, the layer then stays in private memory
+      ok = (ok && posix_fallocate(fd, 0, off_t(size)) == 0);
+      #endif
+      
+      if (ok)
+      {
+         data = mmap(0, size_t(size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+         ok = (data != MAP_FAILED);
+      }
+      
+      close(fd);
+      
+      if (ok)
+      {
+         rewind(f);
+         ok = (fread(data, 1, size_t(size), f) == size_t(size));
+         munmap(data, size_t(size));
+      }
+      
+      fclose(f);
+      
+      if (!ok)
+      {
+         shm_unlink(name.c_str());
+         SharedSegments::Detach(name);
+      }
+      
+      return ok;
+   }
+   
+   #endif
+   
+   // The header magic is written last: incomplete data is never valid
+   static bool WriteLayer(FILE *f, const std::string &key, const SharedLayer &sl)
+   {
+      RenderCacheHeader header;
+      
+      memset(header.magic, 0, 8);
+      header.version = Version;
+      header.keyLength = (unsigned int) key.length();
+      header.fieldCount = (unsigned int) (sl.scalarh.size() + sl.scalarf.size() + sl.scalard.size() +
+                                          sl.vectorh.size() + sl.vectorf.size() + sl.vectord.size());
+      header.reserved = 0;
+      
+      unsigned long long offset = 0;
+      std::vector<RenderCacheEntry> entries;
+      
+      // entries are re-written once their tables are known
+      bool ok = (Write(f, &header, sizeof(header), offset) &&
+                 Write(f, key.c_str(), key.length(), offset) &&
+                 Pad(f, 8, offset));
+      
+      size_t entriesOffset = size_t(offset);
+      
+      if (ok)
+      {
+         RenderCacheEntry empty;
+         memset(&empty, 0, sizeof(empty));
+         entries.assign(header.fieldCount, empty);
+         
+         ok = (header.fieldCount == 0 || Write(f, &entries[0], entries.size() * sizeof(RenderCacheEntry), offset));
+      }
+      
+      size_t index = 0;
+      
+      for (size_t i=0; i<entries.size(); ++i)
+      {
+         entries[i].headerIndex = int(i < sl.headerIndices.size() ? sl.headerIndices[i] : i);
+      }
+      
+      ok = (ok &&
+            WriteFields<Field3D::half>(f, sl.scalarh, FDT_half, entries, index, offset) &&
+            WriteFields<float>(f, sl.scalarf, FDT_float, entries, index, offset) &&
+            WriteFields<double>(f, sl.scalard, FDT_double, entries, index, offset) &&
+            WriteFields<Field3D::V3h>(f, sl.vectorh, FDT_half, entries, index, offset) &&
+            WriteFields<Field3D::V3f>(f, sl.vectorf, FDT_float, entries, index, offset) &&
+            WriteFields<Field3D::V3d>(f, sl.vectord, FDT_double, entries, index, offset));
+      
+      if (ok && header.fieldCount > 0)
+      {
+         ok = (fseek(f, long(entriesOffset), SEEK_SET) == 0 &&
+               fwrite(&entries[0], sizeof(RenderCacheEntry), entries.size(), f) == entries.size());
+      }
+      
+      if (ok)
+      {
+         memcpy(header.magic, Magic, 8);
+         
+         ok = (fseek(f, 0, SEEK_SET) == 0 &&
+               fwrite(&header, sizeof(header), 1, f) == 1 &&
+               fflush(f) == 0);
+      }
+      
+      return ok;
+   }
+   
+private:
+   
+   static const unsigned int Version = 2;
+   
+   static size_t Align(size_t offset, size_t alignment)
+   {
+      return ((offset + alignment - 1) / alignment) * alignment;
+   }
+   
+   static bool Write(FILE *f, const void *data, size_t size, unsigned long long &offset)
+   {
+      if (size > 0 && fwrite(data, 1, size, f) != size)
+      {
+         return false;
+      }
+      offset += size;
+      return true;
+   }
+   
+   static bool Pad(FILE *f, size_t alignment, unsigned long long &offset)
+   {
+      static const char Zeros[64] = {0};
+      size_t n = size_t((alignment - offset % alignment) % alignment);
+      return Write(f, Zeros, n, offset);
+   }
+   
+   template <typename T>
+   static bool Writable(const typename Field3D::Field<T>::Vec &fields)
+   {
+      for (size_t i=0; i<fields.size(); ++i)
+      {
+         if (MACFieldCheck<T>::Is(fields[i]))
+         {
+            return false;
+         }
+      }
+      return true;
+   }
+   
+   template <typename T>
+   static bool MapField(const Field3D::FieldRes &header, const RenderCacheEntry &entry, MappedFile *file,
+                        typename Field3D::Field<T>::Vec &fields)
+   {
+      Field3D::Box3i extents(Field3D::V3i(entry.extents[0], entry.extents[1], entry.extents[2]),
+                             Field3D::V3i(entry.extents[3], entry.extents[4], entry.extents[5]));
+      Field3D::Box3i dw(Field3D::V3i(entry.dataWindow[0], entry.dataWindow[1], entry.dataWindow[2]),
+                        Field3D::V3i(entry.dataWindow[3], entry.dataWindow[4], entry.dataWindow[5]));
+      
+      if (dw.isEmpty())
+      {
+         return false;
+      }
+      
+      typename MappedField<T>::Ptr field(new MappedField<T>());
+      
+      if (!field->setup(header, extents, dw, file, entry.table))
+      {
+         return false;
+      }
+      
+      fields.push_back(field);
+      
+      return true;
+   }
+   
+   template <typename T>
+   static bool WriteFields(FILE *f, const typename Field3D::Field<T>::Vec &fields, FieldDataType dataType,
+                           std::vector<RenderCacheEntry> &entries, size_t &index, unsigned long long &offset)
+   {
+      typedef MappedField<T> MF;
+      
+      std::vector<T> values(MF::BrickVoxels);
+      std::vector<unsigned long long> table;
+      
+      for (size_t n=0; n<fields.size(); ++n, ++index)
+      {
+         const Field3D::Field<T> &field = *fields[n];
+         const Field3D::Box3i &ext = field.extents();
+         const Field3D::Box3i &dw = field.dataWindow();
+         RenderCacheEntry &entry = entries[index];
+         Field3D::V3i bres;
+         
+         entry.dataType = dataType;
+         entry.extents[0] = ext.min.x;
+         entry.extents[1] = ext.min.y;
+         entry.extents[2] = ext.min.z;
+         entry.extents[3] = ext.max.x;
+         entry.extents[4] = ext.max.y;
+         entry.extents[5] = ext.max.z;
+         entry.dataWindow[0] = dw.min.x;
+         entry.dataWindow[1] = dw.min.y;
+         entry.dataWindow[2] = dw.min.z;
+         entry.dataWindow[3] = dw.max.x;
+         entry.dataWindow[4] = dw.max.y;
+         entry.dataWindow[5] = dw.max.z;
+         
+         MF::BrickRes(dw, bres);
+         
+         table.clear();
+         
+         for (int bk=0; bk<bres.z; ++bk)
+         {
+            for (int bj=0; bj<bres.y; ++bj)
+            {
+               for (int bi=0; bi<bres.x; ++bi)
+               {
+                  int i0 = dw.min.x + (bi << MF::BrickOrder);
+                  int j0 = dw.min.y + (bj << MF::BrickOrder);
+                  int k0 = dw.min.z + (bk << MF::BrickOrder);
+                  
+                  // padding voxels (outside of data window) are never read
+                  for (int k=0; k<MF::BrickSize; ++k)
+                  {
+                     int sk = std::min(dw.max.z, k0 + k);
+                     
+                     for (int j=0; j<MF::BrickSize; ++j)
+                     {
+                        int sj = std::min(dw.max.y, j0 + j);
+                        
+                        for (int i=0; i<MF::BrickSize; ++i)
+                        {
+                           values[MF::VoxelIndex(i, j, k)] = field.value(std::min(dw.max.x, i0 + i), sj, sk);
+                        }
+                     }
+                  }
+                  
+                  bool uniform = true;
+                  
+                  for (int v=1; uniform && v<MF::BrickVoxels; ++v)
+                  {
+                     uniform = (memcmp(&values[v], &values[0], sizeof(T)) == 0);
+                  }
+                  
+                  if (!Pad(f, (uniform ? 8 : 64), offset))
+                  {
+                     return false;
+                  }
+                  
+                  table.push_back(offset | (uniform ? MF::UniformBrick : 0));
+                  
+                  if (!Write(f, &values[0], (uniform ? 1 : size_t(MF::BrickVoxels)) * sizeof(T), offset))
+                  {
+                     return false;
+                  }
+               }
+            }
+         }
+         
+         if (!Pad(f, 8, offset))
+         {
+            return false;
+         }
+         
+         entry.table = offset;
+         
+         if (!Write(f, &table[0], table.size() * sizeof(unsigned long long), offset))
+         {
+            return false;
+         }
+      }
+      
+      return true;
+   }
+};
+
+const char *RenderCache::Magic = "F3DRCACH";
+
+// Process wide, reference counted, layers cache: volumes reading the same file
+// layer share its fields (memory scales with unique data, not volumes count)
+class FieldCache
+{
+public:
+   
+   static void Init()
+   {
+      if (!sInitialized)
+      {
+         AiCritSecInit(&sLock);
+         sInitialized = true;
+      }
+   }
+   
+   static void Cleanup()
+   {
+      if (!sInitialized)
+      {
+         return;
+      }
+      
+      AiCritSecEnter(&sLock);
+      
+      for (Entries::iterator it=sEntries.begin(); it!=sEntries.end(); ++it)
+      {
+         AiMsgWarning("[volume_field3d] Shared layer still referenced (%ld): %s", it->second->refCount, it->first.c_str());
+         delete it->second;
+      }
+      sEntries.clear();
+      
+      AiCritSecLeave(&sLock);
+      
+      AiCritSecClose(&sLock);
+      sInitialized = false;
+   }
+   
+   static SharedLayer* Acquire(const std::string &key)
+   {
+      SharedLayer *layer = 0;
+      
+      AiCritSecEnter(&sLock);
+      
+      Entries::iterator it = sEntries.find(key);
+      
+      if (it == sEntries.end())
+      {
+         layer = new SharedLayer(key);
+         sEntries[key] = layer;
+      }
+      else
+      {
+         layer = it->second;
+      }
+      
+      ++(layer->refCount);
+      
+      AiCritSecLeave(&sLock);
+      
+      return layer;
+   }
+   
+   static void Release(SharedLayer *layer)
+   {
+      if (!layer || !sInitialized)
+      {
+         return;
+      }
+      
+      AiCritSecEnter(&sLock);
+      
+      if (--(layer->refCount) <= 0)
+      {
+         sEntries.erase(layer->key);
+         delete layer;
+      }
+      
+      AiCritSecLeave(&sLock);
+   }
+   
+private:
+   
+   typedef std::map<std::string, SharedLayer*> Entries;
+   
+   static bool sInitialized;
+   static AtCritSec sLock;
+   static Entries sEntries;
+};
+
+bool FieldCache::sInitialized = false;
+AtCritSec FieldCache::sLock;
+FieldCache::Entries FieldCache::sEntries;
+
+// All the fields sharing a partition and layer name in the file.
+// Voxel data is read for all of them at once, and at most once.
+struct LayerData;
+
+struct FieldData
+{
+   std::string partition;
+   std::string name;
+   size_t globalIndex;
+   size_t partitionIndex;
+   
+   // Field header (data window and mapping), available before voxel data is read
+   Field3D::FieldRes::Ptr base;
+   // Field with voxel data, null until its layer has been read
+   Field3D::FieldRes::Ptr field;
+   
+   LayerData *layer;
+   
+   FieldType type;
+   FieldDataType dataType;
+   bool isVector;
+   // sparse field read with dynamic block loading
+   bool paged;
+   // no voxel data once its layer has been read (unsupported field type)
+   bool unsupported;
+   
+   ScalarFieldData scalar;
+   VectorFieldData vector;
+   
+   FieldData *velocityField[3];
+   
+   // coarser resolutions, from finer to coarser (owned by layer)
+   std::vector<FieldData*> levels;
+   // progressive mode low resolution copy, sampled until the layer is published (owned by layer)
+   FieldData *proxy;
+   // smallest voxel dimension in world and local space
+   double wsVoxelSize;
+   double lsVoxelSize;
+   
+   void setup(Field3D::FieldRes::Ptr header, bool vec, LayerData *l)
+   {
+      type = FT_unknown;
+      dataType = FDT_unknown;
+      isVector = vec;
+      paged = false;
+      unsupported = false;
+      base = header;
+      field = 0;
+      layer = l;
+      velocityField[0] = 0;
+      velocityField[1] = 0;
+      velocityField[2] = 0;
+      levels.clear();
+      proxy = 0;
+      wsVoxelSize = 0.0;
+      lsVoxelSize = 0.0;
+   }
+   
+   bool load(Field3D::FieldRes::Ptr baseField, FieldDataType dt)
+   {
+      type = FT_unknown;
+      dataType = FDT_unknown;
+      paged = false;
+      field = 0;
+      
+      if (isVector)
+      {
+         switch (dt)
+         {
+         case FDT_half:
+            vector.mappedh = MappedField<Field3D::V3h>::Cast(baseField);
+            if (vector.mappedh)
+            {
+               type = FT_mapped;
+               break;
+            }
+            vector.compressedh = CompressedField<Field3D::V3h>::Cast(baseField);
+            if (vector.compressedh)
+            {
+               type = FT_compressed;
+               break;
+            }
+            vector.quantizedh = QuantizedField<Field3D::V3h>::Cast(baseField);
+            if (vector.quantizedh)
+            {
+               type = FT_quantized;
+               break;
+            }
+            vector.brickedh = BrickedField<Field3D::V3h>::Cast(baseField);
+            if (vector.brickedh)
+            {
+               type = FT_bricked;
+               break;
+            }
+            vector.sparseh = Field3D::field_dynamic_cast<Field3D::SparseField<Field3D::V3h> >(baseField);
+            if (!vector.sparseh)
+            {
+               vector.denseh = Field3D::field_dynamic_cast<Field3D::DenseField<Field3D::V3h> >(baseField);
+               if (!vector.denseh)
+               {
+                  vector.mach = Field3D::field_dynamic_cast<Field3D::MACField<Field3D::V3h> >(baseField);
+                  if (!vector.mach)
+                  {
+                     return false;
+                  }
+                  else
+                  {
+                     type = FT_mac;
+                  }
+               }
+               else
+               {
+                  type = FT_dense;
+               }
+            }
+            else
+            {
+               type = FT_sparse;
+            }
+            break;
+         case FDT_float:
+            vector.mappedf = MappedField<Field3D::V3f>::Cast(baseField);
+            if (vector.mappedf)
+            {
+               type = FT_mapped;
+               break;
+            }
+            vector.compressedf = CompressedField<Field3D::V3f>::Cast(baseField);
+            if (vector.compressedf)
+            {
+               type = FT_compressed;
+               break;
+            }
+            vector.quantizedf = QuantizedField<Field3D::V3f>::Cast(baseField);
+            if (vector.quantizedf)
+            {
+               type = FT_quantized;
+               break;
+            }
+            vector.brickedf = BrickedField<Field3D::V3f>::Cast(baseField);
+            if (vector.brickedf)
+            {
+               type = FT_bricked;
+               break;
+            }
+            vector.sparsef = Field3D::field_dynamic_cast<Field3D::SparseField<Field3D::V3f> >(baseField);
+            if (!vector.sparsef)
+            {
+               vector.densef = Field3D::field_dynamic_cast<Field3D::DenseField<Field3D::V3f> >(baseField);
+               if (!vector.densef)
+               {
+                  vector.macf = Field3D::field_dynamic_cast<Field3D::MACField<Field3D::V3f> >(baseField);
+                  if (!vector.macf)
+                  {
+                     return false;
+                  }
+                  else
+                  {
+                     type = FT_mac;
+                  }
+               }
+               else
+               {
+                  type = FT_dense;
+               }
+            }
+            else
+            {
+               type = FT_sparse;
+            }
+            break;
+         case FDT_double:
+            vector.mappedd = MappedField<Field3D::V3d>::Cast(baseField);
+            if (vector.mappedd)
+            {
+               type = FT_mapped;
+               break;
+            }
+            vector.compressedd = CompressedField<Field3D::V3d>::Cast(baseField);
+            if (vector.compressedd)
+            {
+               type = FT_compressed;
+               break;
+            }
+            vector.quantizedd = QuantizedField<Field3D::V3d>::Cast(baseField);
+            if (vector.quantizedd)
+            {
+               type = FT_quantized;
+               break;
+            }
+            vector.brickedd = BrickedField<Field3D::V3d>::Cast(baseField);
+            if (vector.brickedd)
+            {
+               type = FT_bricked;
+               break;
+            }
+            vector.sparsed = Field3D::field_dynamic_cast<Field3D::SparseField<Field3D::V3d> >(baseField);
+            if (!vector.sparsed)
+            {
+               vector.densed = Field3D::field_dynamic_cast<Field3D::DenseField<Field3D::V3d> >(baseField);
+               if (!vector.densed)
+               {
+                  vector.macd = Field3D::field_dynamic_cast<Field3D::MACField<Field3D::V3d> >(baseField);
+                  if (!vector.macd)
+                  {
+                     return false;
+                  }
+                  else
+                  {
+                     type = FT_mac;
+                  }
+               }
+               else
+               {
+                  type = FT_dense;
+               }
+            }
+            else
+            {
+               type = FT_sparse;
+            }
+            break;
+         default:
+            return false;
+         }
+      }
+      else
+      {
+         switch (dt)
+         {
+         case FDT_half:
+            scalar.mappedh = MappedField<Field3D::half>::Cast(baseField);
+            if (scalar.mappedh)
+            {
+               type = FT_mapped;
+               break;
+            }
+            scalar.compressedh = CompressedField<Field3D::half>::Cast(baseField);
+            if (scalar.compressedh)
+            {
+               type = FT_compressed;
+               break;
+            }
+            scalar.quantizedh = QuantizedField<Field3D::half>::Cast(baseField);
+            if (scalar.quantizedh)
+            {
+               type = FT_quantized;
+               break;
+            }
+            scalar.brickedh = BrickedField<Field3D::half>::Cast(baseField);
+            if (scalar.brickedh)
+            {
+               type = FT_bricked;
+               break;
+            }
+            scalar.sparseh = Field3D::field_dynamic_cast<Field3D::SparseField<Field3D::half> >(baseField);
+            if (!scalar.sparseh)
+            {
+               scalar.denseh = Field3D::field_dynamic_cast<Field3D::DenseField<Field3D::half> >(baseField);
+               if (!scalar.denseh)
+               {
+                  return false;
+               }
+               else
+               {
+                  type = FT_dense;
+               }
+            }
+            else
+            {
+               type = FT_sparse;
+            }
+            break;
+         case FDT_float:
+            scalar.mappedf = MappedField<float>::Cast(baseField);
+            if (scalar.mappedf)
+            {
+               type = FT_mapped;
+               break;
+            }
+            scalar.compressedf = CompressedField<float>::Cast(baseField);
+            if (scalar.compressedf)
+            {
+               type = FT_compressed;
+               break;
+            }
+            scalar.quantizedf = QuantizedField<float>::Cast(baseField);
+            if (scalar.quantizedf)
+            {
+               type = FT_quantized;
+               break;
+            }
+            scalar.brickedf = BrickedField<float>::Cast(baseField);
+            if (scalar.brickedf)
+            {
+               type = FT_bricked;
+               break;
+            }
+            scalar.sparsef = Field3D::field_dynamic_cast<Field3D::SparseField<float> >(baseField);
+            if (!scalar.sparsef)
+            {
+               scalar.densef = Field3D::field_dynamic_cast<Field3D::DenseField<float> >(baseField);
+               if (!scalar.densef)
+               {
+                  return false;
+               }
+               else
+               {
+                  type = FT_dense;
+               }
+            }
+            else
+            {
+               type = FT_sparse;
+            }
+            break;
+         case FDT_double:
+            scalar.mappedd = MappedField<double>::Cast(baseField);
+            if (scalar.mappedd)
+            {
+               type = FT_mapped;
+               break;
+            }
+            scalar.compressedd = CompressedField<double>::Cast(baseField);
+            if (scalar.compressedd)
+            {
+               type = FT_compressed;
+               break;
+            }
+            scalar.quantizedd = QuantizedField<double>::Cast(baseField);
+            if (scalar.quantizedd)
+            {
+               type = FT_quantized;
+               break;
+            }
+            scalar.brickedd = BrickedField<double>::Cast(baseField);
+            if (scalar.brickedd)
+            {
+               type = FT_bricked;
+               break;
+            }
+            scalar.sparsed = Field3D::field_dynamic_cast<Field3D::SparseField<double> >(baseField);
+            if (!scalar.sparsed)
+            {
+               scalar.densed = Field3D::field_dynamic_cast<Field3D::DenseField<double> >(baseField);
+               if (!scalar.densed)
+               {
+                  return false;
+               }
+               else
+               {
+                  type = FT_dense;
+               }
+            }
+            else
+            {
+               type = FT_sparse;
+            }
+            break;
+         default:
+            return false;
+         }
+      }
+      
+      field = baseField;
+      dataType = dt;
+      
+      computeVoxelSize();
+      
+      if (type == FT_sparse && Field3D::SparseFileManager::singleton().doLimitMemUse())
+      {
+         paged = true;
+         SparseBlockCache::AddField(blockBytes());
+      }
+      
+      return true;
+   }
+   
+   void computeVoxelSize()
+   {
+      Field3D::V3i res = field->dataResolution();
+      Field3D::V3d lstep(1.0 / double(res.x),
+                         1.0 / double(res.y),
+                         1.0 / double(res.z));
+      Field3D::V3d ex, ey, ez, origin;
+      
+      lsVoxelSize = std::min(lstep.x, std::min(lstep.y, lstep.z));
+      
+      // length of each voxel edge in world space (rotated mappings included)
+      field->mapping()->localToWorld(Field3D::V3d(0.0, 0.0, 0.0), origin);
+      field->mapping()->localToWorld(Field3D::V3d(lstep.x, 0.0, 0.0), ex);
+      field->mapping()->localToWorld(Field3D::V3d(0.0, lstep.y, 0.0), ey);
+      field->mapping()->localToWorld(Field3D::V3d(0.0, 0.0, lstep.z), ez);
+      
+      wsVoxelSize = std::min((ex - origin).length(), std::min((ey - origin).length(), (ez - origin).length()));
+   }
+   
+   // Pick level whose voxels best match the given footprint
+   FieldData* level(double footprint, bool localSpace)
+   {
+      double voxelSize = (localSpace ? lsVoxelSize : wsVoxelSize);
+      
+      if (levels.size() == 0 || footprint <= voxelSize || voxelSize <= 0.0)
+      {
+         return this;
+      }
+      
+      // each level halves the resolution
+      size_t l = size_t(floor(log(footprint / voxelSize) / log(2.0)));
+      
+      return (l == 0 ? this : levels[std::min(l, levels.size()) - 1]);
+   }
+   
+   size_t blockBytes() const
+   {
+      if (type != FT_sparse)
+      {
+         return 0;
+      }
+      
+      switch (dataType)
+      {
+      case FDT_half:
+         return (isVector ? BlockBytes(*vector.sparseh) : BlockBytes(*scalar.sparseh));
+      case FDT_float:
+         return (isVector ? BlockBytes(*vector.sparsef) : BlockBytes(*scalar.sparsef));
+      case FDT_double:
+         return (isVector ? BlockBytes(*vector.sparsed) : BlockBytes(*scalar.sparsed));
+      default:
+         return 0;
+      }
+   }
+   
+   template <typename DataType>
+   static size_t BlockBytes(const Field3D::SparseField<DataType> &f)
+   {
+      size_t n = size_t(f.blockSize());
+      return n * n * n * sizeof(DataType);
+   }
+   
+   // Block lookups of paged fields are counted (see SparseBlockCache::Report)
+   template <typename DataType>
+   static bool SampleSparse(Field3D::SparseField<DataType> &f, bool paged, const Field3D::V3d &P, int interp, unsigned int tid,
+                            SampleMergeType mergeType, AtParamValue *outValue, AtByte *outType)
+   {
+      if (paged)
+      {
+         SparseBlockCache::Accessor<DataType> accessor(f, tid);
+         return SampleField<SparseBlockCache::Accessor<DataType> >::Sample(accessor, P, interp, mergeType, outValue, outType);
+      }
+      else
+      {
+         return SampleField<Field3D::SparseField<DataType> >::Sample(f, P, interp, mergeType, outValue, outType);
+      }
+   }
+   
+   bool sample(const Field3D::V3d &P, int interp, unsigned int tid, SampleMergeType mergeType, AtParamValue *outValue, AtByte *outType)
+   {
+      bool rv = false;
+      
+      switch (type)
+      {
+      case FT_sparse:
+         switch (dataType)
+         {
+         case FDT_half:
+            rv = (isVector ? SampleSparse(*vector.sparseh, paged, P, interp, tid, mergeType, outValue, outType)
+                           : SampleSparse(*scalar.sparseh, paged, P, interp, tid, mergeType, outValue, outType));
+            break;
+         case FDT_float:
+            rv = (isVector ? SampleSparse(*vector.sparsef, paged, P, interp, tid, mergeType, outValue, outType)
+                           : SampleSparse(*scalar.sparsef, paged, P, interp, tid, mergeType, outValue, outType));
+            break;
+         case FDT_double:
+            rv = (isVector ? SampleSparse(*vector.sparsed, paged, P, interp, tid, mergeType, outValue, outType)
+                           : SampleSparse(*scalar.sparsed, paged, P, interp, tid, mergeType, outValue, outType));
+         default:
+            break;
+         }
+         break;
+      case FT_dense:
+         switch (dataType)
+         {
+         case FDT_half:
+            rv = (isVector ? SampleField<Field3D::DenseField<Field3D::V3h> >::Sample(*vector.denseh, P, interp, mergeType, outValue, outType)
+                           : SampleField<Field3D::DenseField<Field3D::half> >::Sample(*scalar.denseh, P, interp, mergeType, outValue, outType));
+            break;
+         case FDT_float:
+            rv = (isVector ? SampleField<Field3D::DenseField<Field3D::V3f> >::Sample(*vector.densef, P, interp, mergeType, outValue, outType)
+                           : SampleField<Field3D::DenseField<float> >::Sample(*scalar.densef, P, interp, mergeType, outValue, outType));
+            break;
+         case FDT_double:
+            rv = (isVector ? SampleField<Field3D::DenseField<Field3D::V3d> >::Sample(*vector.densed, P, interp, mergeType, outValue, outType)
+                           : SampleField<Field3D::DenseField<double> >::Sample(*scalar.densed, P, interp, mergeType, outValue, outType));
+         default:
+            break;
+         }
+         break;
+      case FT_quantized:
+         switch (dataType)
+         {
+         case FDT_half:
+            rv = (isVector ? SampleField<QuantizedField<Field3D::V3h> >::Sample(*vector.quantizedh, P, interp, mergeType, outValue, outType)
+                           : SampleField<QuantizedField<Field3D::half> >::Sample(*scalar.quantizedh, P, interp, mergeType, outValue, outType));
+            break;
+         case FDT_float:
+            rv = (isVector ? SampleField<QuantizedField<Field3D::V3f> >::Sample(*vector.quantizedf, P, interp, mergeType, outValue, outType)
+                           : SampleField<QuantizedField<float> >::Sample(*scalar.quantizedf, P, interp, mergeType, outValue, outType));
+            break;
+         case FDT_double:
+            rv = (isVector ? SampleField<QuantizedField<Field3D::V3d> >::Sample(*vector.quantizedd, P, interp, mergeType, outValue, outType)
+                           : SampleField<QuantizedField<double> >::Sample(*scalar.quantizedd, P, interp, mergeType, outValue, outType));
+            break;
+         default:
+            break;
+         }
+         break;
+      case FT_compressed:
+         switch (dataType)
+         {
+         case FDT_half:
+            {
+               if (isVector)
+               {
+                  CompressedField<Field3D::V3h>::Accessor accessor(*vector.compressedh, tid);
+                  rv = SampleField<CompressedField<Field3D::V3h>::Accessor>::Sample(accessor, P, interp, mergeType, outValue, outType);
+               }
+               else
+               {
+                  CompressedField<Field3D::half>::Accessor accessor(*scalar.compressedh, tid);
+                  rv = SampleField<CompressedField<Field3D::half>::Accessor>::Sample(accessor, P, interp, mergeType, outValue, outType);
+               }
+            }
+            break;
+         case FDT_float:
+            {
+               if (isVector)
+               {
+                  CompressedField<Field3D::V3f>::Accessor accessor(*vector.compressedf, tid);
+                  rv = SampleField<CompressedField<Field3D::V3f>::Accessor>::Sample(accessor, P, interp, mergeType, outValue, outType);
+               }
+               else
+               {
+                  CompressedField<float>::Accessor accessor(*scalar.compressedf, tid);
+                  rv = SampleField<CompressedField<float>::Accessor>::Sample(accessor, P, interp, mergeType, outValue, outType);
+               }
+            }
+            break;
+         case FDT_double:
+            {
+               if (isVector)
+               {
+                  CompressedField<Field3D::V3d>::Accessor accessor(*vector.compressedd, tid);
+                  rv = SampleField<CompressedField<Field3D::V3d>::Accessor>::Sample(accessor, P, interp, mergeType, outValue, outType);
+               }
+               else
+               {
+                  CompressedField<double>::Accessor accessor(*scalar.compressedd, tid);
+                  rv = SampleField<CompressedField<double>::Accessor>::Sample(accessor, P, interp, mergeType, outValue, outType);
+               }
+            }
+            break;
+         default:
+            break;
+         }
+         break;
+      case FT_mapped:
+         switch (dataType)
+         {
+         case FDT_half:
+            rv = (isVector ? SampleField<MappedField<Field3D::V3h> >::Sample(*vector.mappedh, P, interp, mergeType, outValue, outType)
+                           : SampleField<MappedField<Field3D::half> >::Sample(*scalar.mappedh, P, interp, mergeType, outValue, outType));
+            break;
+         case FDT_float:
+            rv = (isVector ? SampleField<MappedField<Field3D::V3f> >::Sample(*vector.mappedf, P, interp, mergeType, outValue, outType)
+                           : SampleField<MappedField<float> >::Sample(*scalar.mappedf, P, interp, mergeType, outValue, outType));
+            break;
+         case FDT_double:
+            rv = (isVector ? SampleField<MappedField<Field3D::V3d> >::Sample(*vector.mappedd, P, interp, mergeType, outValue, outType)
+                           : SampleField<MappedField<double> >::Sample(*scalar.mappedd, P, interp, mergeType, outValue, outType));
+            break;
+         default:
+            break;
+         }
+         break;
+      case FT_bricked:
+         switch (dataType)
+         {
+         case FDT_half:
+            rv = (isVector ? SampleField<BrickedField<Field3D::V3h> >::Sample(*vector.brickedh, P, interp, mergeType, outValue, outType)
+                           : SampleField<BrickedField<Field3D::half> >::Sample(*scalar.brickedh, P, interp, mergeType, outValue, outType));
+            break;
+         case FDT_float:
+            rv = (isVector ? SampleField<BrickedField<Field3D::V3f> >::Sample(*vector.brickedf, P, interp, mergeType, outValue, outType)
+                           : SampleField<BrickedField<float> >::Sample(*scalar.brickedf, P, interp, mergeType, outValue, outType));
+            break;
+         case FDT_double:
+            rv = (isVector ? SampleField<BrickedField<Field3D::V3d> >::Sample(*vector.brickedd, P, interp, mergeType, outValue, outType)
+                           : SampleField<BrickedField<double> >::Sample(*scalar.brickedd, P, interp, mergeType, outValue, outType));
+            break;
+         default:
+            break;
+         }
+         break;
+      case FT_mac:
+         if (isVector)
+         {
+            switch (dataType)
+            {
+            case FDT_half:
+               rv = SampleField<Field3D::MACField<Field3D::V3h> >::Sample(*vector.mach, P, interp, mergeType, outValue, outType);
+               break;
+            case FDT_float:
+               rv = SampleField<Field3D::MACField<Field3D::V3f> >::Sample(*vector.macf, P, interp, mergeType, outValue, outType);
+               break;
+            case FDT_double:
+               rv = SampleField<Field3D::MACField<Field3D::V3d> >::Sample(*vector.macd, P, interp, mergeType, outValue, outType);
+            default:
+               break;
+            }
+         }
+      default:
+         break;
+      }
+      
+      return rv;
+   }
+};
+
+// Uniform grid over the fields world space bounds, so that samples and rays only
+// visit the fields they may hit (i.e. one file per simulation tile)
+class FieldGrid
+{
+public:
+   
+   FieldGrid()
+   {
+      clear();
+   }
+   
+   void clear()
+   {
+      mBounds.makeEmpty();
+      mRes = Field3D::V3i(0, 0, 0);
+      mCellSize = Field3D::V3d(0.0, 0.0, 0.0);
+      mCellStart.clear();
+      mItems.clear();
+   }
+   
+   void swap(FieldGrid &rhs)
+   {
+      std::swap(mBounds, rhs.mBounds);
+      std::swap(mRes, rhs.mRes);
+      std::swap(mCellSize, rhs.mCellSize);
+      mCellStart.swap(rhs.mCellStart);
+      mItems.swap(rhs.mItems);
+   }
+   
+   // Items are the indices in 'bounds', empty boxes are left out
+   void build(const std::vector<Field3D::Box3d> &bounds)
+   {
+      size_t count = 0;
+      
+      clear();
+      
+      for (size_t i=0; i<bounds.size(); ++i)
+      {
+         if (!bounds[i].isEmpty())
+         {
+            mBounds.extendBy(bounds[i]);
+            ++count;
+         }
+      }
+      
+      if (count == 0)
+      {
+         return;
+      }
+      
+      Field3D::V3d size = mBounds.size();
+      double maxSize = std::max(size.x, std::max(size.y, size.z));
+      
+      if (maxSize <= 0.0)
+      {
+         maxSize = 1.0;
+      }
+      
+      // points on a field boundary may be transformed to slightly outside of it
+      double pad = 1e-6 * maxSize;
+      
+      mBounds.min -= Field3D::V3d(pad, pad, pad);
+      mBounds.max += Field3D::V3d(pad, pad, pad);
+      size = mBounds.size();
+      
+      // about CellsPerItem roughly cubic cells per item, flat bounds (a single row
+      // of tiles) still get a sensible cell size
+      double minSize = 1e-3 * maxSize;
+      double volume = std::max(size.x, minSize) * std::max(size.y, minSize) * std::max(size.z, minSize);
+      double cellSize = pow(volume / double(CellsPerItem * count), 1.0 / 3.0);
+      
+      for (int a=0; a<3; ++a)
+      {
+         mRes[a] = int(ceil(size[a] / cellSize));
+         
+         if (mRes[a] < 1)
+         {
+            mRes[a] = 1;
+         }
+         else if (mRes[a] > MaxResolution)
+         {
+            mRes[a] = MaxResolution;
+         }
+         
+         mCellSize[a] = size[a] / double(mRes[a]);
+      }
+      
+      size_t ncells = size_t(mRes.x) * size_t(mRes.y) * size_t(mRes.z);
+      
+      // items count per cell, then cells start offset. Items are added in order so
+      // that each cell's items are sorted
+      mCellStart.assign(ncells + 1, 0);
+      
+      for (int pass=0; pass<2; ++pass)
+      {
+         if (pass == 1)
+         {
+            for (size_t c=0; c<ncells; ++c)
+            {
+               mCellStart[c + 1] += mCellStart[c];
+            }
+            
+            mItems.resize(mCellStart[ncells]);
+         }
+         
+         for (size_t i=0; i<bounds.size(); ++i)
+         {
+            if (bounds[i].isEmpty())
+            {
+               continue;
+            }
+            
+            Field3D::V3i lo = cell(bounds[i].min);
+            Field3D::V3i hi = cell(bounds[i].max);
+            
+            for (int z=lo.z; z<=hi.z; ++z)
+            {
+               for (int y=lo.y; y<=hi.y; ++y)
+               {
+                  for (int x=lo.x; x<=hi.x; ++x)
+                  {
+                     size_t c = index(x, y, z);
+                     
+                     if (pass == 0)
+                     {
+                        ++mCellStart[c + 1];
+                     }
+                     else
+                     {
+                        mItems[mCellStart[c]++] = i;
+                     }
+                  }
+               }
+            }
+         }
+      }
+      
+      // filling advanced each start offset to the next cell's
+      for (size_t c=ncells; c>0; --c)
+      {
+         mCellStart[c] = mCellStart[c - 1];
+      }
+      mCellStart[0] = 0;
+   }
+   
+   // Items whose bounds may contain P, sorted. Returns false if there are none
+   bool find(const Field3D::V3d &P, const size_t *&begin, const size_t *&end) const
+   {
+      begin = 0;
+      end = 0;
+      
+      if (mItems.empty() || !mBounds.intersects(P))
+      {
+         return false;
+      }
+      
+      Field3D::V3i c = cell(P);
+      size_t i = index(c.x, c.y, c.z);
+      
+      if (mCellStart[i] == mCellStart[i + 1])
+      {
+         return false;
+      }
+      
+      begin = &mItems[0] + mCellStart[i];
+      end = &mItems[0] + mCellStart[i + 1];
+      
+      return true;
+   }
+   
+   // Items whose bounds may intersect the segment [pos + t0 * dir, pos + t1 * dir],
+   // sorted and unique
+   void find(const Field3D::V3d &pos, const Field3D::V3d &dir, double t0, double t1, std::vector<size_t> &items) const
+   {
+      items.clear();
+      
+      if (mItems.empty())
+      {
+         return;
+      }
+      
+      // clip segment to grid bounds
+      for (int a=0; a<3; ++a)
+      {
+         if (fabs(dir[a]) < 1e-12)
+         {
+            if (pos[a] < mBounds.min[a] || pos[a] > mBounds.max[a])
+            {
+               return;
+            }
+         }
+         else
+         {
+            double ta = (mBounds.min[a] - pos[a]) / dir[a];
+            double tb = (mBounds.max[a] - pos[a]) / dir[a];
+            
+            t0 = std::max(t0, std::min(ta, tb));
+            t1 = std::min(t1, std::max(ta, tb));
+         }
+      }
+      
+      if (t0 > t1)
+      {
+         return;
+      }
+      
+      // cells traversal (Amanatides & Woo)
+      Field3D::V3i c = cell(pos + t0 * dir);
+      Field3D::V3i step;
+      Field3D::V3d tnext;
+      Field3D::V3d tdelta;
+      double inf = std::numeric_limits<double>::max();
+      
+      for (int a=0; a<3; ++a)
+      {
+         if (fabs(dir[a]) < 1e-12)
+         {
+            step[a] = 0;
+            tnext[a] = inf;
+            tdelta[a] = inf;
+         }
+         else
+         {
+            step[a] = (dir[a] > 0.0 ? 1 : -1);
+            
+            double boundary = mBounds.min[a] + double(c[a] + (step[a] > 0 ? 1 : 0)) * mCellSize[a];
+            
+            tnext[a] = (boundary - pos[a]) / dir[a];
+            tdelta[a] = mCellSize[a] / fabs(dir[a]);
+         }
+      }
+      
+      while (true)
+      {
+         size_t i = index(c.x, c.y, c.z);
+         
+         items.insert(items.end(), mItems.begin() + mCellStart[i], mItems.begin() + mCellStart[i + 1]);
+         
+         int a = (tnext.x < tnext.y ? (tnext.x < tnext.z ? 0 : 2) : (tnext.y < tnext.z ? 1 : 2));
+         
+         if (tnext[a] > t1)
+         {
+            break;
+         }
+         
+         c[a] += step[a];
+         
+         if (c[a] < 0 || c[a] >= mRes[a])
+         {
+            break;
+         }
+         
+         tnext[a] += tdelta[a];
+      }
+      
+      std::sort(items.begin(), items.end());
+      items.erase(std::unique(items.begin(), items.end()), items.end());
+   }
+   
+private:
+   
+   static const int CellsPerItem = 4;
+   static const int MaxResolution = 128;
+   
+   Field3D::V3i cell(const Field3D::V3d &P) const
+   {
+      Field3D::V3i c;
+      
+      for (int a=0; a<3; ++a)
+      {
+         c[a] = int(floor((P[a] - mBounds.min[a]) / mCellSize[a]));
+         c[a] = std::max(0, std::min(c[a], mRes[a] - 1));
+      }
+      
+      return c;
+   }
+   
+   inline size_t index(int x, int y, int z) const
+   {
+      return (size_t(z) * size_t(mRes.y) + size_t(y)) * size_t(mRes.x) + size_t(x);
+   }
+   
+   Field3D::Box3d mBounds;
+   Field3D::V3i mRes;
+   Field3D::V3d mCellSize;
+   // items of cell c are mItems[mCellStart[c]] ... mItems[mCellStart[c+1]-1]
+   std::vector<size_t> mCellStart;
+   std::vector<size_t> mItems;
+};
+
+// Fields header of a file layer, read when the file is opened
+struct LayerHeader
+{
+   std::string partition;
+   std::string name;
+   bool isVector;
+   Field3D::EmptyField<float>::Vec scalar;
+   Field3D::EmptyField<Field3D::V3f>::Vec vector;
+   
+   LayerHeader(const std::string &p, const std::string &n, bool vec)
+      : partition(p)
+      , name(n)
+      , isVector(vec)
+   {
+   }
+};
+
+// A file read by a volume. '-file' may list several files (one per simulation
+// tile for instance), the layers of all of them are read in the same volume.
+struct FileData
+{
+   std::string path;
+   // local copy of path when staged (-stageDir)
+   std::string openPath;
+   // see FileKey
+   std::string key;
+   // prepended to the file's partition names in channel names ('<label>:', see
+   // VolumeData::FileLabel), empty when '-file' is a single file without wildcards
+   std::string prefix;
+   FileFormat format;
+   bool opened;
+   Field3D::Field3DInputFile *f3d;
+   // additional handles for concurrent layer reads (see VolumeData::acquireFile)
+   std::vector<Field3D::Field3DInputFile*> freeFiles;
+   AtCritSec lock;
+   // held while reading from f3d when no additional Ogawa handle could be opened
+   AtCritSec fallbackLock;
+   // layers found when the file is opened, until added to the volume
+   std::vector<LayerHeader> headers;
+   // set once fields that can't be downsampled were reported
+   AtomicInt downsampleWarned;
+   
+   FileData(const std::string &p, const std::string &pre)
+      : path(p)
+      , prefix(pre)
+      , format(FF_unknown)
+      , opened(false)
+      , f3d(0)
+      , downsampleWarned(0)
+   {
+      AiCritSecInit(&lock);
+      AiCritSecInit(&fallbackLock);
+   }
+   
+   ~FileData()
+   {
+      for (size_t i=0; i<freeFiles.size(); ++i)
+      {
+         delete freeFiles[i];
+      }
+      delete f3d;
+      AiCritSecClose(&lock);
+      AiCritSecClose(&fallbackLock);
+   }
+   
+private:
+   
+   FileData(const FileData&);
+   FileData& operator=(const FileData&);
+};
+
+struct LayerData
+{
+   // partition name in the file
+   std::string partition;
+   std::string name;
+   bool isVector;
+   // shared layer key
+   std::string key;
+   
+   FileData *file;
+   
+   // indices in VolumeData fields
+   std::vector<size_t> fields;
+   // storage for fields MIP levels (see FieldData::levels)
+   std::deque<FieldData> levels;
+   // storage for fields proxies (see FieldData::proxy)
+   std::deque<FieldData> proxies;
+   
+   SharedLayer *shared;
+   SharedLayer *proxy;
+   
+   AtomicInt loaded;
+   AtCritSec lock;
+   // in seconds
+   double readTime;
+   
+   LayerData(FileData *f, const std::string &p, const std::string &n, bool vec, const std::string &k)
+      : partition(p)
+      , name(n)
+      , isVector(vec)
+      , key(k)
+      , file(f)
+      , shared(0)
+      , proxy(0)
+      , loaded(0)
+      , readTime(0.0)
+   {
+      AiCritSecInit(&lock);
+   }
+   
+   ~LayerData()
+   {
+      FieldCache::Release(shared);
+      FieldCache::Release(proxy);
+      AiCritSecClose(&lock);
+   }
+   
+private:
+   
+   LayerData(const LayerData&);
+   LayerData& operator=(const LayerData&);
+};
+
+class VolumeData
+{
+public:
+   
+   VolumeData()
+      : mNode(0)
+      , mIgnoreTransform(false)
+      , mVerbose(false)
+      , mFrame(1.0f)
+      , mFPS(24.0f)
+      , mVelocityScale(1.0f)
+      , mWorldSpaceVelocity(false)
+      , mMotionStartFrame(1.0f)
+      , mMotionEndFrame(1.0f)
+      , mShutterTimeType(STT_normalized)
+      , mLazyLoad(false)
+      , mRenderCache(false)
+      , mSharedCache(false)
+      , mStageSize(0.0f)
+      , mDownsample(1)
+      , mMipmap(false)
+      , mDenseToSparse(false)
+      , mBricked(false)
+      , mCompress(false)
+      , mArena(false)
+      , mHugePages(HP_none)
+      , mMemoryLimit(0.0f)
+      , mSequentialRead(64.0f)
+      , mBoundsOnly(false)
+      , mLoadThreads(0)
+      , mIOThreads(0)
+      , mPreload(false)
+      , mProgressive(false)
+      , mPreloadThread(0)
+      , mPreloadDone(0)
+      , mCancelLoad(0)
+      , mFrameCacheSize(0)
+      , mFrameCacheMemory(0.0f)
+      , mPrefetch(0)
+      , mPrefetchThread(0)
+      , mCancelPrefetch(0)
+   {
+   }
+   
+   ~VolumeData()
+   {
+      reset();
+   }
+   
+   void reset()
+   {
+      stopPreload();
+      stopPrefetch();
+      
+      mNode = 0;
+      mPath = "";
+      mPathPattern = "";
+      mPartition = "";
+      mIgnoreTransform = false;
+      mVerbose = false;
+      mFrame = 1.0f;
+      mFPS = 24.0f;
+      mVelocityScale = 1.0f;
+      mWorldSpaceVelocity = false;
+      mMotionStartFrame = mFrame;
+      mMotionEndFrame = mFrame;
+      mShutterTimeType = STT_normalized;
+      mVelocityFields.clear();
+      mLazyLoad = false;
+      mRenderCache = false;
+      mSharedCache = false;
+      mStageDir = "";
+      mStageSize = 0.0f;
+      mDownsample = 1;
+      mMipmap = false;
+      mDenseToSparse = false;
+      mBricked = false;
+      mChannelsPrecision.clear();
+      mCompress = false;
+      mArena = false;
+      mHugePages = HP_none;
+      mMemoryLimit = 0.0f;
+      mSequentialRead = 64.0f;
+      mBoundsOnly = false;
+      mLoadThreads = 0;
+      mIOThreads = 0;
+      mPreload = false;
+      mProgressive = false;
+      mFrameCacheSize = 0;
+      mFrameCacheMemory = 0.0f;
+      mPrefetch = 0;
+      
+      clearFrameCache();
+      
+      mFields.clear();
+      mFieldIndices.clear();
+      mFieldGrid.clear();
+      mFileKey = "";
+      
+      for (size_t i=0; i<mLayers.size(); ++i)
+      {
+         delete mLayers[i];
+      }
+      mLayers.clear();
+      
+      // after the layers referencing them
+      for (size_t i=0; i<mFiles.size(); ++i)
+      {
+         delete mFiles[i];
+      }
+      mFiles.clear();
+   }
+   
+   bool isIdentical(const VolumeData &rhs) const
+   {
+      if (mPath != rhs.mPath)
+      {
+         return false;
+      }
+      
+      if (mPartition != rhs.mPartition)
+      {
+         return false;
+      }
+      
+      // File modified on disk
+      if (mFileKey != rhs.mFileKey)
+      {
+         return false;
+      }
+      
+      if (mDownsample != rhs.mDownsample || mMipmap != rhs.mMipmap || mDenseToSparse != rhs.mDenseToSparse || mBricked != rhs.mBricked)
+      {
+         return false;
+      }
+      
+      if (mChannelsPrecision != rhs.mChannelsPrecision || mCompress != rhs.mCompress)
+      {
+         return false;
+      }
+      
+      // No influence the fields to be read
+      //   mIgnoreTransform 
+      //   mVerbose
+      //   mChannelsMergeType
+      //   mFPS
+      //   mVelocityFields
+      //   mVelocityScale
+      //   mWorldSpaceVelocity
+      //   mMotionStartFrame
+      //   mMotionEndFrame
+      //   mShutterTimeType
+      //   mLazyLoad
+      //   mRenderCache (voxel values unchanged)
+      //   mSharedCache (voxel values unchanged)
+      //   mStageDir (file content unchanged)
+      //   mStageSize
+      //   mArena (voxel values unchanged)
+      //   mHugePages
+      //   mMemoryLimit (process wide setting)
+      //   mSequentialRead
+      //   mBoundsOnly
+      //   mLoadThreads
+      //   mIOThreads
+      //   mPreload
+      //   mProgressive
+      //   mFrameCacheSize
+      //   mFrameCacheMemory
+      //   mPrefetch
+      // 
+      // mFrame influences mPath
+      // mFileKey is derived from mPath
+      //
+      // Derived from mPath, mStageDir
+      //   mFiles
+      //
+      // Derived from mPath and mPartition
+      //   mFields
+      //   mFieldIndices
+      //   mLayers
+      //
+      // Derived from mFields and mIgnoreTransform
+      //   mFieldGrid
+      
+      return true;
+   }
+   
+   // Convert file name frame tokens (###, <frame> or <frame:N>) to printf format
+   static std::string FramePattern(const std::string &path)
+   {
+      size_t p0 = path.find_last_of("\\/");
+      size_t p1;
+      size_t p2;
+      
+      std::string dirname = (p0 != std::string::npos ? path.substr(0, p0) : "");
+      std::string basename = (p0 != std::string::npos ? path.substr(p0 + 1) : path);
+      
+      char tmp[32];
+      bool foundFramePattern = false;
+      
+      p0 = basename.rfind("<frame");
+      if (p0 != std::string::npos)
+      {
+         // <frame> or <frame:N>
+         p2 = basename.find('>', p0);
+         
+         if (p2 != std::string::npos)
+         {
+            p1 = basename.rfind(':', p2);
+            
+            if (p1 != std::string::npos && p1 > p0)
+            {
+               std::string pads = basename.substr(p1 + 1, p2 - p1 - 1);
+               int pad = 0;
+               
+               if (sscanf(pads.c_str(), "%d", &pad) != 1)
+               {
+                  AiMsgWarning("[volume_field3d] Invalid <frame> token format: %s. Assume no padding", basename.substr(p0, p2-p1+1).c_str());
+                  pad = 0;
+               }
+               
+               if (pad > 1)
+               {
+                  sprintf(tmp, "%%0%dd", pad);
+                  basename = basename.substr(0, p0) + tmp + basename.substr(p2 + 1);
+               }
+               else
+               {
+                  basename = basename.substr(0, p0) + "%d" + basename.substr(p2 + 1);
+               }
+            }
+            else
+            {
+               basename = basename.substr(0, p0) + "%d" + basename.substr(p2 + 1);
+            }
+            
+            foundFramePattern = true;
+         }
+      }
+      
+      if (!foundFramePattern)
+      {
+         p1 = basename.rfind('#');
+         
+         if (p1 != std::string::npos)
+         {
+            if (p1 > 0)
+            {
+               p0 = basename.find_last_not_of("#", p1 - 1);
+               
+               if (p0 == std::string::npos)
+               {
+                  sprintf(tmp, "%%0%lud", p1 + 1);
+                  basename = tmp + basename.substr(p1 + 1);
+               }
+               else
+               {
+                  size_t n = p1 - p0;
+                  
+                  sprintf(tmp, "%%0%lud", n);
+                  basename = basename.substr(0, p0 + 1) + tmp + basename.substr(p1 + 1);
+               }
+            }
+            else
+            {
+               basename = std::string("%d") + basename.substr(p1 + 1);
+            }
+         }
+         else
+         {
+            // support already in printf format
+         }
+      }
+      
+      return (dirname.length() > 0 ? dirname + "/" + basename : basename);
+   }
+   
+   // Replace frame number in a path returned by FramePattern
+   static std::string ExpandFramePattern(const std::string &pattern, int frame)
+   {
+      size_t p0 = pattern.find_last_of("\\/");
+      
+      std::string dirname = (p0 != std::string::npos ? pattern.substr(0, p0 + 1) : "");
+      std::string basename = (p0 != std::string::npos ? pattern.substr(p0 + 1) : pattern);
+      
+      // Probably won't ever need more than 32 digits for the frame number
+      char *tmp = new char[basename.length() + 32];
+      
+      sprintf(tmp, basename.c_str(), frame);
+      
+      basename = tmp;
+      
+      delete[] tmp;
+      
+      return dirname + basename;
+   }
+   
+   // '-file' accepts several files, kept as a ';' separated list
+   static std::string JoinFiles(const std::vector<std::string> &files)
+   {
+      std::string paths;
+      
+      for (size_t i=0; i<files.size(); ++i)
+      {
+         if (files[i].length() == 0)
+         {
+            continue;
+         }
+         if (paths.length() > 0)
+         {
+            paths += ";";
+         }
+         paths += files[i];
+      }
+      
+      return paths;
+   }
+   
+   static void SplitFiles(const std::string &paths, std::vector<std::string> &files)
+   {
+      size_t p0 = 0;
+      size_t p1 = paths.find(';');
+      
+      files.clear();
+      
+      while (p0 < paths.length())
+      {
+         if (p1 == std::string::npos)
+         {
+            p1 = paths.length();
+         }
+         
+         if (p1 > p0)
+         {
+            files.push_back(paths.substr(p0, p1 - p0));
+         }
+         
+         p0 = p1 + 1;
+         p1 = paths.find(';', p0);
+      }
+   }
+   
+   static std::string FramePatterns(const std::string &paths)
+   {
+      std::vector<std::string> files;
+      
+      SplitFiles(paths, files);
+      
+      for (size_t i=0; i<files.size(); ++i)
+      {
+         files[i] = FramePattern(files[i]);
+      }
+      
+      return JoinFiles(files);
+   }
+   
+   static bool HasFramePattern(const std::string &patterns)
+   {
+      return (ExpandFiles(patterns, 0, false) != patterns);
+   }
+   
+   // Files matching a wildcards pattern ('*', '?' and '[...]'), sorted by name
+   static void GlobFiles(const std::string &pattern, std::vector<std::string> &files)
+   {
+      #ifdef _WIN32
+      // wildcards are only supported in the file name
+      size_t p = pattern.find_last_of("\\/");
+      std::string dirname = (p != std::string::npos ? pattern.substr(0, p + 1) : "");
+      std::vector<std::string> names;
+      WIN32_FIND_DATAA fd;
+      HANDLE h = FindFirstFileA(pattern.c_str(), &fd);
+      if (h != INVALID_HANDLE_VALUE)
+      {
+         do
+         {
+            if ((fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+            {
+               names.push_back(dirname + fd.cFileName);
+            }
+         } while (FindNextFileA(h, &fd));
+         FindClose(h);
+      }
+      std::sort(names.begin(), names.end());
+      files.insert(files.end(), names.begin(), names.end());
+      #else
+      glob_t g;
+      if (glob(pattern.c_str(), 0, 0, &g) == 0)
+      {
+         for (size_t i=0; i<size_t(g.gl_pathc); ++i)
+         {
+            files.push_back(g.gl_pathv[i]);
+         }
+      }
+      globfree(&g);
+      #endif
+   }
+   
+   // Frame substitution then wildcards expansion of each pattern
+   static std::string ExpandFiles(const std::string &patterns, int frame, bool expandWildcards=true)
+   {
+      std::vector<std::string> items;
+      std::vector<std::string> files;
+      
+      SplitFiles(patterns, items);
+      
+      for (size_t i=0; i<items.size(); ++i)
+      {
+         std::string path = ExpandFramePattern(items[i], frame);
+         
+         if (expandWildcards && path.find_first_of("*?[") != std::string::npos)
+         {
+            GlobFiles(path, files);
+         }
+         else
+         {
+            files.push_back(path);
+         }
+      }
+      
+      return JoinFiles(files);
+   }
+   
+   // File name without extension and frame number (the last digits matching it,
+   // with their separator), identifies a file across the frames of a sequence
+   static std::string FileLabel(const std::string &path, int frame)
+   {
+      size_t p = path.find_last_of("\\/");
+      std::string name = (p != std::string::npos ? path.substr(p + 1) : path);
+      
+      p = name.rfind('.');
+      
+      if (p != std::string::npos && p > 0)
+      {
+         name = name.substr(0, p);
+      }
+      
+      size_t p1 = name.find_last_of("0123456789");
+      
+      while (p1 != std::string::npos)
+      {
+         size_t p0 = name.find_last_not_of("0123456789", p1);
+         p0 = (p0 == std::string::npos ? 0 : p0 + 1);
+         
+         int value = 0;
+         bool valid = (sscanf(name.substr(p0, p1 - p0 + 1).c_str(), "%d", &value) == 1);
+         
+         // negative frames
+         if (p0 > 0 && name[p0 - 1] == '-' && frame < 0)
+         {
+            --p0;
+            value = -value;
+         }
+         
+         if (valid && value == frame)
+         {
+            if (p0 > 0 && strchr("._-", name[p0 - 1]))
+            {
+               --p0;
+            }
+            else if (p0 == 0 && p1 + 1 < name.length() && strchr("._-", name[p1 + 1]))
+            {
+               ++p1;
+            }
+            
+            name = name.substr(0, p0) + name.substr(p1 + 1);
+            break;
+         }
+         
+         p1 = (p0 > 0 ? name.find_last_of("0123456789", p0 - 1) : std::string::npos);
+      }
+      
+      return name;
+   }
+   
+   // Identifies the content of a list of files (see FileKey)
+   static std::string FilesKey(const std::string &paths)
+   {
+      std::vector<std::string> files;
+      
+      SplitFiles(paths, files);
+      
+      for (size_t i=0; i<files.size(); ++i)
+      {
+         files[i] = FileKey(files[i]);
+      }
+      
+      return JoinFiles(files);
+   }
+   
+   static bool FilesExist(const std::string &paths)
+   {
+      std::vector<std::string> files;
+      struct stat st;
+      
+      SplitFiles(paths, files);
+      
+      for (size_t i=0; i<files.size(); ++i)
+      {
+         if (stat(files[i].c_str(), &st) != 0)
+         {
+            return false;
+         }
+      }
+      
+      return !files.empty();
+   }
+   
+   bool init(const AtNode *node, const char *user_string, bool noSetup=false)
+   {
+      reset();
+      
+      std::vector<std::string> mergeTypes;
+      std::vector<std::string> precisions;
+      std::vector<std::string> velocityFields;
+      std::string shutterTimeType;
+      bool hasMotionStart = false;
+      bool hasMotionEnd = false;
+      
+      // Figure out frame default value from options node
+      AtNode *opts = AiUniverseGetOptions();
+      
+      if (readFloatUserAttr(opts, "frame", mFrame))
+      {
+         AiMsgDebug("[volume_field3d] 'frame' read from options node");
+      }
+      if (readFloatUserAttr(opts, "fps", mFPS))
+      {
+         AiMsgDebug("[volume_field3d] 'fps' read from options node");
+      }
+      
+      // Read params from string data
+      std::vector<std::string> args;
+      std::string paramString = (user_string ? user_string : "");
+      
+      splitParamString(user_string, args);
+      
+      for (size_t i=0; i<args.size(); ++i)
+      {
+         std::string &arg = args[i];
+         
+         if (arg.length() == 0)
+         {
+            continue;
+         }
+         
+         if (arg[0] != '-')
+         {
+            AiMsgWarning("[volume_field3d] Expected flag, ignoring '%s'", arg.c_str());
+            continue;
+         }
+         
+         if (arg == "-file")
+         {
+            std::vector<std::string> files;
+            
+            ++i;
+            
+            while (i < args.size())
+            {
+               if (args[i].length() > 0)
+               {
+                  if (args[i][0] == '-')
+                  {
+                     // found a flag
+                     --i;
+                     break;
+                  }
+                  else
+                  {
+                     files.push_back(args[i]);
+                  }
+               }
+               ++i;
+            }
+            
+            if (files.empty())
+            {
+               AiMsgWarning("[volume_field3d] -file flag expects an argument");
+            }
+            else
+            {
+               mPath = JoinFiles(files);
+            }
+         }
+         else if (arg == "-partition")
+         {
+            if (++i >= args.size())
+            {
+               AiMsgWarning("[volume_field3d] -partition flag expects an argument");
+            }
+            else
+            {
+               mPartition = args[i];
+            }
+         }
+         else if (arg == "-frame")
+         {
+            if (++i >= args.size())
+            {
+               AiMsgWarning("[volume_field3d] -frame flag expects an argument");
+            }
+            else
+            {
+               float farg = 0.0f;
+               
+               if (sscanf(args[i].c_str(), "%f", &farg) == 1)
+               {
+                  mFrame = farg;
+               }
+               else
+               {
+                  AiMsgWarning("[volume_field3d] -frame flag expects a float argument");
+               }
+            }
+         }
+         else if (arg == "-fps")
+         {
+            if (++i >= args.size())
+            {
+               AiMsgWarning("[volume_field3d] -fps flag expects an argument");
+            }
+            else
+            {
+               float farg = 0.0f;
+               
+               if (sscanf(args[i].c_str(), "%f", &farg) == 1)
+               {
+                  mFPS = farg;
+               }
+               else
+               {
+                  AiMsgWarning("[volume_field3d] -fps flag expects a float argument");
+               }
+            }
+         }
+         else if (arg == "-velocityField")
+         {
+            ++i;
+            
+            while (i < args.size())
+            {
+               if (args[i].length() > 0)
+               {
+                  if (args[i][0] == '-')
+                  {
+                     // found a flag
+                     --i;
+                     break;
+                  }
+                  else
+                  {
+                     velocityFields.push_back(args[i]);
+                  }
+               }
+               ++i;
+            }
+            
+            if (velocityFields.size() == 1 || velocityFields.size() == 3)
+            {
+               std::swap(velocityFields, mVelocityFields);
+            }
+            else
+            {
+               AiMsgWarning("[volume_field3d] -velocityField expects 1 or 3 field names");
+            }
+         }
+         else if (arg == "-velocityScale")
+         {
+            if (++i >= args.size())
+            {
+               AiMsgWarning("[volume_field3d] -velocityScale flag expects an argument");
+            }
+            else
+            {
+               float farg = 0.0f;
+               
+               if (sscanf(args[i].c_str(), "%f", &farg) == 1)
+               {
+                  mVelocityScale = farg;
+               }
+               else
+               {
+                  AiMsgWarning("[volume_field3d] -velocityScale flag expects a float argument");
+               }
+            }
+         }
+         else if (arg == "-worldSpaceVelocity")
+         {
+            mWorldSpaceVelocity = true;
+         }
+         else if (arg == "-motionStartFrame")
+         {
+            if (++i >= args.size())
+            {
+               AiMsgWarning("[volume_field3d] -motionStartFrame flag expects an argument");
+            }
+            else
+            {
+               float farg = 0.0f;
+               
+               if (sscanf(args[i].c_str(), "%f", &farg) == 1)
+               {
+                  mMotionStartFrame = farg;
+                  hasMotionStart = true;
+               }
+               else
+               {
+                  AiMsgWarning("[volume_field3d] -motionStartFrame flag expects a float argument");
+               }
+            }
+         }
+         else if (arg == "-motionEndFrame")
+         {
+            if (++i >= args.size())
+            {
+               AiMsgWarning("[volume_field3d] -motionEndFrame flag expects an argument");
+            }
+            else
+            {
+               float farg = 0.0f;
+               
+               if (sscanf(args[i].c_str(), "%f", &farg) == 1)
+               {
+                  mMotionEndFrame = farg;
+                  hasMotionEnd = true;
+               }
+               else
+               {
+                  AiMsgWarning("[volume_field3d] -motionEndFrame flag expects a float argument");
+               }
+            }
+         }
+         else if (arg == "-shutterTimeType")
+         {
+            if (++i >= args.size())
+            {
+               AiMsgWarning("[volume_field3d] -shutterTimeType flag expects an argument");
+            }
+            else
+            {
+               ShutterTimeType stt = ShutterTimeTypeFromString(args[i]);
+               if (stt != STT_unknown)
+               {
+                  mShutterTimeType = stt;
+               }
+               else
+               {
+                  AiMsgWarning("[volume_field3d] Invalid value for -shutterTimeType. Should be one of 'normalized', 'frame_relative' or 'absolute_frame'");
+               }
+            }
+         }
+         else if (arg == "-merge")
+         {
+            ++i;
+            
+            while (i < args.size())
+            {
+               if (args[i].length() > 0)
+               {
+                  if (args[i][0] == '-')
+                  {
+                     // found a flag
+                     --i;
+                     break;
+                  }
+                  else
+                  {
+                     mergeTypes.push_back(args[i]);
+                  }
+               }
+               ++i;
+            }
+         }
+         else if (arg == "-precision")
+         {
+            ++i;
+            
+            while (i < args.size())
+            {
+               if (args[i].length() > 0)
+               {
+                  if (args[i][0] == '-')
+                  {
+                     // found a flag
+                     --i;
+                     break;
+                  }
+                  else
+                  {
+                     precisions.push_back(args[i]);
+                  }
+               }
+               ++i;
+            }
+         }
+         else if (arg == "-verbose")
+         {
+            mVerbose = true;
+         }
+         else if (arg == "-ignoreXform")
+         {
+            mIgnoreTransform = true;
+         }
+         else if (arg == "-lazyLoad")
+         {
+            mLazyLoad = true;
+         }
+         else if (arg == "-renderCache")
+         {
+            mRenderCache = true;
+         }
+         else if (arg == "-sharedCache")
+         {
+            mSharedCache = true;
+         }
+         else if (arg == "-stageDir")
+         {
+            if (++i >= args.size())
+            {
+               AiMsgWarning("[volume_field3d] -stageDir flag expects an argument");
+            }
+            else
+            {
+               mStageDir = args[i];
+            }
+         }
+         else if (arg == "-stageSize")
+         {
+            if (++i >= args.size())
+            {
+               AiMsgWarning("[volume_field3d] -stageSize flag expects an argument");
+            }
+            else
+            {
+               float farg = 0.0f;
+               
+               if (sscanf(args[i].c_str(), "%f", &farg) == 1)
+               {
+                  mStageSize = farg;
+               }
+               else
+               {
+                  AiMsgWarning("[volume_field3d] -stageSize flag expects a float argument");
+               }
+            }
+         }
+         else if (arg == "-boundsOnly")
+         {
+            mBoundsOnly = true;
+         }
+         else if (arg == "-preload")
+         {
+            mPreload = true;
+         }
+         else if (arg == "-progressive")
+         {
+            mProgressive = true;
+         }
+         else if (arg == "-mipmap")
+         {
+            mMipmap = true;
+         }
+         else if (arg == "-denseToSparse")
+         {
+            mDenseToSparse = true;
+         }
+         else if (arg == "-bricked")
+         {
+            mBricked = true;
+         }
+         else if (arg == "-compress")
+         {
+            mCompress = true;
+         }
+         else if (arg == "-arena")
+         {
+            mArena = true;
+         }
+         else if (arg == "-hugePages")
+         {
+            if (++i >= args.size())
+            {
+               AiMsgWarning("[volume_field3d] -hugePages flag expects an argument");
+            }
+            else
+            {
+               HugePages hp = HugePagesFromString(args[i]);
+               if (hp != HP_unknown)
+               {
+                  mHugePages = hp;
+               }
+               else
+               {
+                  AiMsgWarning("[volume_field3d] Invalid value for -hugePages. Should be one of 'none', 'transparent' or 'explicit'");
+               }
+            }
+         }
+         else if (arg == "-loadThreads")
+         {
+            if (++i >= args.size())
+            {
+               AiMsgWarning("[volume_field3d] -loadThreads flag expects an argument");
+            }
+            else
+            {
+               int iarg = 0;
+               
+               if (sscanf(args[i].c_str(), "%d", &iarg) == 1)
+               {
+                  mLoadThreads = iarg;
+               }
+               else
+               {
+                  AiMsgWarning("[volume_field3d] -loadThreads flag expects an integer argument");
+               }
+            }
+         }
+         else if (arg == "-ioThreads")
+         {
+            if (++i >= args.size())
+            {
+               AiMsgWarning("[volume_field3d] -ioThreads flag expects an argument");
+            }
+            else
+            {
+               int iarg = 0;
+               
+               if (sscanf(args[i].c_str(), "%d", &iarg) == 1)
+               {
+                  mIOThreads = iarg;
+               }
+               else
+               {
+                  AiMsgWarning("[volume_field3d] -ioThreads flag expects an integer argument");
+               }
+            }
+         }
+         else if (arg == "-frameCache")
+         {
+            if (++i >= args.size())
+            {
+               AiMsgWarning("[volume_field3d] -frameCache flag expects an argument");
+            }
+            else
+            {
+               int iarg = 0;
+               
+               if (sscanf(args[i].c_str(), "%d", &iarg) == 1)
+               {
+                  mFrameCacheSize = iarg;
+               }
+               else
+               {
+                  AiMsgWarning("[volume_field3d] -frameCache flag expects an integer argument");
+               }
+            }
+         }
+         else if (arg == "-frameCacheMemory")
+         {
+            if (++i >= args.size())
+            {
+               AiMsgWarning("[volume_field3d] -frameCacheMemory flag expects an argument");
+            }
+            else
+            {
+               float farg = 0.0f;
+               
+               if (sscanf(args[i].c_str(), "%f", &farg) == 1)
+               {
+                  mFrameCacheMemory = farg;
+               }
+               else
+               {
+                  AiMsgWarning("[volume_field3d] -frameCacheMemory flag expects a float argument");
+               }
+            }
+         }
+         else if (arg == "-prefetch")
+         {
+            if (++i >= args.size())
+            {
+               AiMsgWarning("[volume_field3d] -prefetch flag expects an argument");
+            }
+            else
+            {
+               int iarg = 0;
+               
+               if (sscanf(args[i].c_str(), "%d", &iarg) == 1)
+               {
+                  mPrefetch = iarg;
+               }
+               else
+               {
+                  AiMsgWarning("[volume_field3d] -prefetch flag expects an integer argument");
+               }
+            }
+         }
+         else if (arg == "-downsample")
+         {
+            if (++i >= args.size())
+            {
+               AiMsgWarning("[volume_field3d] -downsample flag expects an argument");
+            }
+            else
+            {
+               int iarg = 0;
+               
+               if (sscanf(args[i].c_str(), "%d", &iarg) == 1)
+               {
+                  mDownsample = iarg;
+               }
+               else
+               {
+                  AiMsgWarning("[volume_field3d] -downsample flag expects an integer argument");
+               }
+            }
+         }
+         else if (arg == "-sequentialRead")
+         {
+            if (++i >= args.size())
+            {
+               AiMsgWarning("[volume_field3d] -sequentialRead flag expects an argument");
+            }
+            else
+            {
+               float farg = 0.0f;
+               
+               if (sscanf(args[i].c_str(), "%f", &farg) == 1)
+               {
+                  mSequentialRead = farg;
+               }
+               else
+               {
+                  AiMsgWarning("[volume_field3d] -sequentialRead flag expects a float argument");
+               }
+            }
+         }
+         else if (arg == "-memoryLimit")
+         {
+            if (++i >= args.size())
+            {
+               AiMsgWarning("[volume_field3d] -memoryLimit flag expects an argument");
+            }
+            else
+            {
+               float farg = 0.0f;
+               
+               if (sscanf(args[i].c_str(), "%f", &farg) == 1)
+               {
+                  mMemoryLimit = farg;
+               }
+               else
+               {
+                  AiMsgWarning("[volume_field3d] -memoryLimit flag expects a float argument");
+               }
+            }
+         }
+         else
+         {
+            AiMsgWarning("[volume_field3d] Invalid flag '%s'", arg.c_str());
+         }
+      }
+      
+      // Read params from user attributes
+      std::vector<std::string> files;
+      if (readStringArrayUserAttr(node, "file", ';', true, files))
+      {
+         mPath = JoinFiles(files);
+         AiMsgDebug("[volume_field3d] User attribute 'file' found. '-file' flag overridden");
+      }
+      if (readStringUserAttr(node, "partition", mPartition))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'partition' found. '-partition' flag overridden");
+      }
+      if (readStringArrayUserAttr(node, "merge", ' ', true, mergeTypes))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'merge' found. '-merge' flag overridden");
+      }
+      if (readStringArrayUserAttr(node, "precision", ' ', true, precisions))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'precision' found. '-precision' flag overridden");
+      }
+      if (readFloatUserAttr(node, "frame", mFrame))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'frame' found. '-frame' flag overridden");
+      }
+      if (readFloatUserAttr(node, "fps", mFPS))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'fps' found. '-fps' flag overridden");
+      }
+      if (readFloatUserAttr(node, "motionStartFrame", mMotionStartFrame))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'motionStartFrame' found. '-motionStartFrame' flag overridden");
+         hasMotionStart = true;
+      }
+      if (readFloatUserAttr(node, "motionEndFrame", mMotionEndFrame))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'motionEndFrame' found. '-motionEndFrame' flag overridden");
+         hasMotionEnd = true;
+      }
+      if (readFloatUserAttr(node, "velocityScale", mVelocityScale))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'velocityScale' found. '-velocityScale' flag overridden");
+      }
+      if (readStringArrayUserAttr(node, "velocityField", ' ', true, velocityFields))
+      {
+         if (velocityFields.size() != 1 && velocityFields.size() != 3)
+         {
+            AiMsgDebug("[volume_field3d] User attribute 'velocityField' found but invalid specification (expected 1 or 3 names)");
+         }
+         else
+         {
+            AiMsgDebug("[volume_field3d] User attribute 'velocityField' found. '-velocityField' flag overridden");
+            std::swap(velocityFields, mVelocityFields);
+         }
+      }
+      if (readStringUserAttr(node, "shutterTimeType", shutterTimeType))
+      {
+         ShutterTimeType stt = ShutterTimeTypeFromString(shutterTimeType);
+         if (stt != STT_unknown)
+         {
+            AiMsgDebug("[volume_field3d] User attribute 'shutterTimeType' found. '-shutterTimeType' flag overridden");
+            mShutterTimeType = stt;
+         }
+         else
+         {
+            AiMsgWarning("[volume_field3d] Invalid value for shutterTimeType attribute. Should be one of 'normalized', 'frame_relative' or 'absolute_frame'");
+         }
+      }
+      if (readBoolUserAttr(node, "worldSpaceVelocity", mWorldSpaceVelocity))
+      {
+         AiMsgDebug("[voluem_field3d] User attribute 'worldSpaceVelocity' found. '-worldSpaceVelocity' flag overridden");
+      }
+      if (readBoolUserAttr(node, "ignoreXform", mIgnoreTransform))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'ignoreXform' found. '-ignoreXform' flag overridden");
+      }
+      if (readBoolUserAttr(node, "verbose", mVerbose))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'verbose' found. '-verbose' flag overridden");
+      }
+      if (readBoolUserAttr(node, "lazyLoad", mLazyLoad))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'lazyLoad' found. '-lazyLoad' flag overridden");
+      }
+      if (readBoolUserAttr(node, "renderCache", mRenderCache))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'renderCache' found. '-renderCache' flag overridden");
+      }
+      if (readBoolUserAttr(node, "sharedCache", mSharedCache))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'sharedCache' found. '-sharedCache' flag overridden");
+      }
+      if (readStringUserAttr(node, "stageDir", mStageDir))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'stageDir' found. '-stageDir' flag overridden");
+      }
+      if (readFloatUserAttr(node, "stageSize", mStageSize))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'stageSize' found. '-stageSize' flag overridden");
+      }
+      #ifdef _WIN32
+      if (mSharedCache)
+      {
+         AiMsgWarning("[volume_field3d] '-sharedCache' is not supported on this platform");
+         mSharedCache = false;
+      }
+      #endif
+      if (readFloatUserAttr(node, "memoryLimit", mMemoryLimit))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'memoryLimit' found. '-memoryLimit' flag overridden");
+      }
+      if (readFloatUserAttr(node, "sequentialRead", mSequentialRead))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'sequentialRead' found. '-sequentialRead' flag overridden");
+      }
+      if (readBoolUserAttr(node, "boundsOnly", mBoundsOnly))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'boundsOnly' found. '-boundsOnly' flag overridden");
+      }
+      if (readBoolUserAttr(node, "preload", mPreload))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'preload' found. '-preload' flag overridden");
+      }
+      if (readBoolUserAttr(node, "progressive", mProgressive))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'progressive' found. '-progressive' flag overridden");
+      }
+      if (readIntUserAttr(node, "frameCache", mFrameCacheSize))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'frameCache' found. '-frameCache' flag overridden");
+      }
+      if (readFloatUserAttr(node, "frameCacheMemory", mFrameCacheMemory))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'frameCacheMemory' found. '-frameCacheMemory' flag overridden");
+      }
+      if (readIntUserAttr(node, "prefetch", mPrefetch))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'prefetch' found. '-prefetch' flag overridden");
+      }
+      if (readIntUserAttr(node, "downsample", mDownsample))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'downsample' found. '-downsample' flag overridden");
+      }
+      if (readBoolUserAttr(node, "mipmap", mMipmap))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'mipmap' found. '-mipmap' flag overridden");
+      }
+      if (readBoolUserAttr(node, "denseToSparse", mDenseToSparse))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'denseToSparse' found. '-denseToSparse' flag overridden");
+      }
+      if (readBoolUserAttr(node, "bricked", mBricked))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'bricked' found. '-bricked' flag overridden");
+      }
+      if (readBoolUserAttr(node, "compress", mCompress))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'compress' found. '-compress' flag overridden");
+      }
+      if (readBoolUserAttr(node, "arena", mArena))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'arena' found. '-arena' flag overridden");
+      }
+      std::string hugePages;
+      if (readStringUserAttr(node, "hugePages", hugePages))
+      {
+         HugePages hp = HugePagesFromString(hugePages);
+         if (hp != HP_unknown)
+         {
+            AiMsgDebug("[volume_field3d] User attribute 'hugePages' found. '-hugePages' flag overridden");
+            mHugePages = hp;
+         }
+         else
+         {
+            AiMsgWarning("[volume_field3d] Invalid value for hugePages attribute. Should be one of 'none', 'transparent' or 'explicit'");
+         }
+      }
+      // huge pages only back arena chunks
+      if (mHugePages != HP_none)
+      {
+         mArena = true;
+      }
+      if (readIntUserAttr(node, "loadThreads", mLoadThreads))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'loadThreads' found. '-loadThreads' flag overridden");
+      }
+      if (readIntUserAttr(node, "ioThreads", mIOThreads))
+      {
+         AiMsgDebug("[volume_field3d] User attribute 'ioThreads' found. '-ioThreads' flag overridden");
+      }
+      if (!node)
+      {
+         // Called without a volume node: the host (i.e. MtoA) only wants the bounds
+         AiMsgDebug("[volume_field3d] No volume node, only read fields header");
+         mBoundsOnly = true;
+      }
+      
+      if (mProgressive && !IsInteractiveSession())
+      {
+         // full resolution data is only used once the volume is updated, which never
+         // happens in batch renders
+         if (mVerbose)
+         {
+            AiMsgInfo("[volume_field3d] Not an interactive session (options.preserve_scene_data off), '-progressive' ignored");
+         }
+         mProgressive = false;
+      }
+      
+      if (mProgressive)
+      {
+         // full resolution data is read in the background, see loadProxy and publishLayers
+         mPreload = true;
+      }
+      
+      if (mDownsample < 1)
+      {
+         mDownsample = 1;
+      }
+      
+      // fill mChannelsMergeType dictionnary
+      for (size_t i=0; i<mergeTypes.size(); ++i)
+      {
+         std::string &md = mergeTypes[i];
+         
+         size_t p = md.find('=');
+         
+         if (p != std::string::npos)
+         {
+            std::string channel = md.substr(0, p);
+            SampleMergeType mtype = SampleMergeTypeFromString(md.substr(p + 1));
+            
+            if (channel.length() > 0 && mtype != SMT_unknown)
+            {
+               mChannelsMergeType[channel] = mtype;
+               AiMsgDebug("[volume_field3d] Using %s merge for channel \"%s\"", SampleMergeTypeToString(mtype), channel.c_str());
+            }
+         }
+      }
+      
+      // fill mChannelsPrecision dictionnary
+      for (size_t i=0; i<precisions.size(); ++i)
+      {
+         std::string &pd = precisions[i];
+         
+         size_t p = pd.find('=');
+         
+         if (p != std::string::npos)
+         {
+            std::string channel = pd.substr(0, p);
+            StoragePrecision ptype = StoragePrecisionFromString(pd.substr(p + 1));
+            
+            if (channel.length() > 0 && ptype != SP_unknown)
+            {
+               mChannelsPrecision[channel] = ptype;
+               AiMsgDebug("[volume_field3d] Using %s precision for channel \"%s\"", StoragePrecisionToString(ptype), channel.c_str());
+            }
+            else
+            {
+               AiMsgWarning("[volume_field3d] Invalid precision specification \"%s\"", pd.c_str());
+            }
+         }
+      }
       
-      for (size_t i=0; i<args.size(); ++i)
+      // setup motion start/end
+      if (!hasMotionStart)
       {
-         std::string &arg = args[i];
+         mMotionStartFrame = mFrame;
+      }
+      if (!hasMotionEnd)
+      {
+         mMotionEndFrame = mFrame;
+      }
+      if (mMotionEndFrame < mMotionStartFrame)
+      {
+         mMotionEndFrame = mMotionStartFrame;
+      }
+      
+      if (mFPS < AI_EPSILON)
+      {
+         mFPS = AI_EPSILON;
+      }
+      
+      if (mVerbose && !noSetup)
+      {
+         AiMsgInfo("[volume_field3d] Parameters:");
+         AiMsgInfo("[volume_field3d]   path = '%s'", mPath.c_str());
+         AiMsgInfo("[volume_field3d]   partition = '%s'", mPartition.c_str());
+         AiMsgInfo("[volume_field3d]   frame = %f", mFrame);
+         AiMsgInfo("[volume_field3d]   fps = %f", mFPS);
+         for (size_t i=0; i<mVelocityFields.size(); ++i)
+         {
+            AiMsgInfo("[volume_field3d]   velocity field %lu = '%s'", i, mVelocityFields[i].c_str());
+         }
+         AiMsgInfo("[volume_field3d]   velocity scale = %f", mVelocityScale);
+         AiMsgInfo("[volume_field3d]   world space velocity = %s", mWorldSpaceVelocity ? "true" : "false");
+         AiMsgInfo("[volume_field3d]   motion start frame = %f", mMotionStartFrame);
+         AiMsgInfo("[volume_field3d]   motion end frame = %f", mMotionEndFrame);
+         AiMsgInfo("[volume_field3d]   shutter time type = %s", ShutterTimeTypeToString(mShutterTimeType));
+         for (std::map<std::string, SampleMergeType>::iterator mtit=mChannelsMergeType.begin(); mtit!=mChannelsMergeType.end(); ++mtit)
+         {
+            AiMsgInfo("[volume_field3d]   '%s' channel merge = %s", mtit->first.c_str(), SampleMergeTypeToString(mtit->second));
+         }
+         AiMsgInfo("[volume_field3d]   ignore transform = %s", mIgnoreTransform ? "true" : "false");
+         AiMsgInfo("[volume_field3d]   lazy load = %s", mLazyLoad ? "true" : "false");
+         AiMsgInfo("[volume_field3d]   render cache = %s", mRenderCache ? "true" : "false");
+         AiMsgInfo("[volume_field3d]   shared cache = %s", mSharedCache ? "true" : "false");
+         AiMsgInfo("[volume_field3d]   staging directory = '%s' (%f MB)", mStageDir.c_str(), mStageSize);
+         AiMsgInfo("[volume_field3d]   memory limit = %f MB", mMemoryLimit);
+         AiMsgInfo("[volume_field3d]   sequential read = %f MB", mSequentialRead);
+         AiMsgInfo("[volume_field3d]   bounds only = %s", mBoundsOnly ? "true" : "false");
+         AiMsgInfo("[volume_field3d]   preload = %s", mPreload ? "true" : "false");
+         AiMsgInfo("[volume_field3d]   progressive = %s", mProgressive ? "true" : "false");
+         AiMsgInfo("[volume_field3d]   frame cache = %d frame(s), %f MB", mFrameCacheSize, mFrameCacheMemory);
+         AiMsgInfo("[volume_field3d]   prefetch = %d frame(s)", mPrefetch);
+         AiMsgInfo("[volume_field3d]   downsample = %d", mDownsample);
+         AiMsgInfo("[volume_field3d]   mipmap = %s", mMipmap ? "true" : "false");
+         AiMsgInfo("[volume_field3d]   dense to sparse = %s", mDenseToSparse ? "true" : "false");
+         AiMsgInfo("[volume_field3d]   bricked = %s", mBricked ? "true" : "false");
+         for (std::map<std::string, StoragePrecision>::iterator ptit=mChannelsPrecision.begin(); ptit!=mChannelsPrecision.end(); ++ptit)
+         {
+            AiMsgInfo("[volume_field3d]   %s precision = %s", ptit->first.c_str(), StoragePrecisionToString(ptit->second));
+         }
+         AiMsgInfo("[volume_field3d]   compress = %s", mCompress ? "true" : "false");
+         AiMsgInfo("[volume_field3d]   arena = %s (huge pages: %s)", mArena ? "true" : "false", HugePagesToString(mHugePages));
+         AiMsgInfo("[volume_field3d]   load threads = %d", mLoadThreads);
+         AiMsgInfo("[volume_field3d]   io threads = %d", mIOThreads);
+      }
+      
+      // Replace frame in path (if necessary)
+      // allow ###, %03d, or yet <frame> and <frame:pad> tokens in file path
+      mPathPattern = FramePatterns(mPath);
+      mPath = ExpandFiles(mPathPattern, int(floorf(mFrame)));
+      
+      if (!HasFramePattern(mPathPattern))
+      {
+         AiMsgWarning("[volume_field3d] No frame pattern in file name: \"%s\"", mPathPattern.c_str());
+      }
+      
+      if (mVerbose && !noSetup)
+      {
+         AiMsgInfo("[volume_field3d] Using %s", mPath.c_str());
+      }
+      
+      if (!noSetup)
+      {
+         if (!setup())
+         {
+            return false;
+         }
          
-         if (arg.length() == 0)
+         startPreload();
+         startPrefetch();
+         
+         return true;
+      }
+      else
+      {
+         return true;
+      }
+   }
+   
+   // Process wide settings (-memoryLimit, -ioThreads) are left untouched when called
+   // from a background thread (see prefetchFrames)
+   bool setup(bool processSettings=true)
+   {
+      std::vector<std::string> paths;
+      
+      SplitFiles(mPath, paths);
+      
+      if (paths.empty())
+      {
+         AiMsgWarning("[volume_field3d] No file matching \"%s\"", mPathPattern.c_str());
+         reset();
+         return false;
+      }
+      
+      mFileKey = FilesKey(mPath);
+      
+      // partitions of distinct files don't mix in channel names. Prefixes only depend
+      // on -file and on the file names so that channel names are the same for all
+      // the frames of a sequence (whatever the files count in each frame)
+      std::vector<std::string> patterns;
+      std::map<std::string, size_t> labelCount;
+      
+      SplitFiles(mPathPattern, patterns);
+      
+      bool prefixed = (patterns.size() > 1 || mPathPattern.find_first_of("*?[") != std::string::npos);
+      
+      for (size_t i=0; i<paths.size(); ++i)
+      {
+         std::string prefix;
+         
+         if (prefixed)
          {
-            continue;
+            prefix = FileLabel(paths[i], int(floorf(mFrame)));
+            
+            // same name in different directories
+            size_t count = labelCount[prefix]++;
+            
+            if (count > 0)
+            {
+               char suffix[32];
+               sprintf(suffix, "~%lu", (unsigned long) count);
+               prefix += suffix;
+            }
+            
+            prefix += ":";
          }
          
-         if (arg[0] != '-')
+         mFiles.push_back(new FileData(paths[i], prefix));
+      }
+      
+      if (processSettings && mMemoryLimit > 0.0f)
+      {
+         // Has to be set before fields are read.
+         // Note: process wide, all sparse fields read from now on use dynamic loading
+         SparseBlockCache::Enable(long(ceilf(mMemoryLimit)));
+      }
+      
+      // Files are staged, opened and their headers read in parallel
+      OpenFilesTask task(this);
+      
+      RunParallel(task, mFiles.size(), (mLoadThreads > 0 ? mLoadThreads : GetArnoldThreadCount()));
+      
+      #ifdef F3D_OGAWA_SUPPORT
+      for (size_t i=0; processSettings && i<mFiles.size(); ++i)
+      {
+         if (mFiles[i]->opened && mFiles[i]->format == FF_ogawa)
+         {
+            setupIOThreads();
+            break;
+         }
+      }
+      #endif
+      
+      // Fields are added in files order so that channel indices don't depend on threads timing
+      std::map<std::string, size_t> fieldCount;
+      std::map<std::string, std::map<std::string, size_t> > partitionsFieldCount;
+      size_t opened = 0;
+      
+      for (size_t i=0; i<mFiles.size(); ++i)
+      {
+         FileData &file = *(mFiles[i]);
+         
+         if (!file.opened)
          {
-            AiMsgWarning("[volume_field3d] Expected flag, ignoring '%s'", arg.c_str());
             continue;
          }
          
-         if (arg == "-file")
+         ++opened;
+         
+         for (size_t j=0; j<file.headers.size(); ++j)
          {
-            if (++i >= args.size())
+            LayerHeader &header = file.headers[j];
+            
+            size_t &partitionFieldCount = partitionsFieldCount[file.prefix + header.partition][header.name];
+            size_t &globalFieldCount = fieldCount[header.name];
+            
+            if (header.isVector)
             {
-               AiMsgWarning("[volume_field3d] -file flag expects an argument");
+               addFields<Field3D::V3f>(file, header.partition, header.name, true, header.vector, partitionFieldCount, globalFieldCount);
             }
             else
             {
-               mPath = args[i];
+               addFields<float>(file, header.partition, header.name, false, header.scalar, partitionFieldCount, globalFieldCount);
             }
          }
-         else if (arg == "-partition")
+         
+         file.headers.clear();
+      }
+      
+      if (opened == 0)
+      {
+         reset();
+         return false;
+      }
+      
+      // In bounds only mode, voxel data will still be read if the volume gets sampled
+      // In preload mode, voxel data is read in background once setup returns (see startPreload)
+      if (!mLazyLoad && !mBoundsOnly && !mPreload)
+      {
+         loadLayers();
+      }
+      else if (mProgressive && !mBoundsOnly)
+      {
+         loadProxies();
+      }
+      
+      setupVelocityFields();
+      
+      buildFieldGrid();
+      
+      return true;
+   }
+   
+   // Stage and open a file and read its layers header.
+   // Safe to call from several threads for distinct files.
+   bool openFile(FileData &file)
+   {
+      file.openPath = (mStageDir.length() > 0 ? StagingCache::Stage(file.path, mStageDir, mStageSize, mVerbose) : file.path);
+      file.key = FileKey(file.path);
+      file.format = DetectFileFormat(file.openPath);
+      
+      if (mVerbose)
+      {
+         AiMsgInfo("[volume_field3d] Open file: %s (%s)", file.openPath.c_str(), FileFormatToString(file.format));
+      }
+      
+      #ifndef F3D_OGAWA_SUPPORT
+      if (file.format == FF_ogawa)
+      {
+         AiMsgWarning("[volume_field3d] \"%s\" is an Ogawa backed file, Field3D 1.6 or newer is required to read it", file.path.c_str());
+         return false;
+      }
+      #endif
+      
+      if (file.format == FF_vdb)
+      {
+         AiMsgWarning("[volume_field3d] \"%s\" is an OpenVDB file, OpenVDB files are not supported", file.path.c_str());
+         return false;
+      }
+      
+      // only when all voxel data is read now, and likely from the file
+      if (mSequentialRead > 0.0f && !mLazyLoad && !mBoundsOnly && !mPreload && !mRenderCache && !mSharedCache)
+      {
+         long long bytes = ReadAhead(file.openPath, (long long)(double(mSequentialRead) * 1024.0 * 1024.0));
+         
+         if (mVerbose && bytes >= 0)
          {
-            if (++i >= args.size())
-            {
-               AiMsgWarning("[volume_field3d] -partition flag expects an argument");
-            }
-            else
+            AiMsgInfo("[volume_field3d] Reading %.2f MB ahead from %s", double(bytes) / (1024.0 * 1024.0), file.openPath.c_str());
+         }
+      }
+      
+      file.f3d = new Field3D::Field3DInputFile();
+      
+      if (!file.f3d->open(file.openPath))
+      {
+         delete file.f3d;
+         file.f3d = 0;
+         return false;
+      }
+      
+      std::vector<std::string> partitions;
+      std::vector<std::string> layers;
+      
+      if (mPartition.length() > 0)
+      {
+         partitions.push_back(mPartition);
+      }
+      else
+      {
+         // Note: partition names are made unique by 'getPartitionNames'
+         file.f3d->getPartitionNames(partitions);
+      }
+      
+      for (size_t i=0; i<partitions.size(); ++i)
+      {
+         const std::string &partition = partitions[i];
+         
+         layers.clear();   
+         file.f3d->getScalarLayerNames(layers, partition);
+         
+         for (size_t j=0; j<layers.size(); ++j)
+         {
+            LayerHeader header(partition, layers[j], false);
+            
+            // Only read fields header (data window, mapping), whatever their bit depth
+            header.scalar = file.f3d->readProxyLayer<float>(partition, layers[j], false);
+            
+            if (!header.scalar.empty())
             {
-               mPartition = args[i];
+               file.headers.push_back(header);
             }
          }
-         else if (arg == "-frame")
+         
+         layers.clear();
+         file.f3d->getVectorLayerNames(layers, partition);
+         
+         for (size_t j=0; j<layers.size(); ++j)
          {
-            if (++i >= args.size())
+            LayerHeader header(partition, layers[j], true);
+            
+            header.vector = file.f3d->readProxyLayer<Field3D::V3f>(partition, layers[j], true);
+            
+            if (!header.vector.empty())
             {
-               AiMsgWarning("[volume_field3d] -frame flag expects an argument");
+               file.headers.push_back(header);
             }
-            else
+         }
+      }
+      
+      file.opened = true;
+      
+      return true;
+   }
+   
+   // Read voxel data for all the fields of the given layer.
+   // Safe to call from several threads: data is only read once, other threads wait for it.
+   void loadLayer(LayerData &layer)
+   {
+      AiCritSecEnter(&layer.lock);
+      
+      if (layer.loaded.get() == 0)
+      {
+         size_t count = 0;
+         double t0 = GetTime();
+         
+         if (!layer.shared)
+         {
+            layer.shared = FieldCache::Acquire(layer.key);
+         }
+         
+         bool read = readSharedLayer(layer);
+         
+         SharedLayer &sl = *(layer.shared);
+         size_t offset = 0;
+         
+         if (layer.isVector)
+         {
+            loadFields<Field3D::V3h>(layer, FDT_half, sl.vectorh, sl.mipLevels, sl.headerIndices, offset, count);
+            loadFields<Field3D::V3f>(layer, FDT_float, sl.vectorf, sl.mipLevels, sl.headerIndices, offset, count);
+            loadFields<Field3D::V3d>(layer, FDT_double, sl.vectord, sl.mipLevels, sl.headerIndices, offset, count);
+         }
+         else
+         {
+            loadFields<Field3D::half>(layer, FDT_half, sl.scalarh, sl.mipLevels, sl.headerIndices, offset, count);
+            loadFields<float>(layer, FDT_float, sl.scalarf, sl.mipLevels, sl.headerIndices, offset, count);
+            loadFields<double>(layer, FDT_double, sl.scalard, sl.mipLevels, sl.headerIndices, offset, count);
+         }
+         
+         if (count < layer.fields.size())
+         {
+            AiMsgWarning("[volume_field3d] Could not read %lu field(s) from layer '%s.%s'",
+                         layer.fields.size() - count, layer.partition.c_str(), layer.name.c_str());
+            
+            // fields of unsupported type are left out of bounds, ray extents and sampling
+            for (size_t i=0; i<layer.fields.size(); ++i)
             {
-               float farg = 0.0f;
+               FieldData &fd = mFields[layer.fields[i]];
                
-               if (sscanf(args[i].c_str(), "%f", &farg) == 1)
-               {
-                  mFrame = farg;
-               }
-               else
+               if (fd.type == FT_unknown)
                {
-                  AiMsgWarning("[volume_field3d] -frame flag expects a float argument");
+                  fd.unsupported = true;
                }
             }
          }
-         else if (arg == "-fps")
+         
+         layer.readTime = GetTime() - t0;
+         
+         if (mVerbose)
          {
-            if (++i >= args.size())
-            {
-               AiMsgWarning("[volume_field3d] -fps flag expects an argument");
-            }
-            else
-            {
-               float farg = 0.0f;
-               
-               if (sscanf(args[i].c_str(), "%f", &farg) == 1)
-               {
-                  mFPS = farg;
-               }
-               else
-               {
-                  AiMsgWarning("[volume_field3d] -fps flag expects a float argument");
-               }
+            AiMsgInfo("[volume_field3d] %s %s layer '%s.%s' in %.3f second(s)", read ? "Read" : "Shared", layer.isVector ? "vector" : "scalar",
+                      layer.partition.c_str(), layer.name.c_str(), layer.readTime);
+         }
+         
+         layer.loaded.set(1);
+      }
+      
+      AiCritSecLeave(&layer.lock);
+   }
+   
+   // Read layer fields from file unless another volume already did.
+   // Returns true if the fields were actually read.
+   bool readSharedLayer(LayerData &layer)
+   {
+      SharedLayer &sl = *(layer.shared);
+      FileData &file = *(layer.file);
+      bool read = false;
+      
+      AiCritSecEnter(&sl.lock);
+      
+      if (sl.loaded.get() == 0)
+      {
+         if (file.openPath != file.path)
+         {
+            StagingCache::Touch(file.openPath);
+         }
+         
+         // sidecar and shared memory voxel data match the file layer after
+         // downsampling (MIP levels are not stored)
+         bool mapped = false;
+         bool useRenderCache = (mRenderCache && !mMipmap);
+         #ifdef _WIN32
+         bool useSharedCache = false;
+         #else
+         bool useSharedCache = (mSharedCache && !mMipmap);
+         #endif
+         std::string rcPath;
+         std::string rcKey;
+         std::string shmName;
+         Field3D::FieldRes::Vec headers;
+         
+         if (useRenderCache || useSharedCache)
+         {
+            char tmp[32];
+            sprintf(tmp, "|%d", mDownsample);
+            
+            rcKey = file.key + "|" + layer.partition + "|" + layer.name + tmp;
+            
+            for (size_t i=0; i<layer.fields.size(); ++i)
+            {
+               headers.push_back(mFields[layer.fields[i]].base);
             }
          }
-         else if (arg == "-velocityField")
+         
+         #ifndef _WIN32
+         if (useSharedCache)
          {
-            ++i;
+            shmName = SharedSegments::Name(rcKey);
             
-            while (i < args.size())
+            double t0 = GetTime();
+            
+            mapped = RenderCache::Map(MappedFile::OpenShared(shmName), rcKey, layer.isVector, headers, sl);
+            
+            if (mapped)
             {
-               if (args[i].length() > 0)
+               if (mVerbose)
                {
-                  if (args[i][0] == '-')
-                  {
-                     // found a flag
-                     --i;
-                     break;
-                  }
-                  else
-                  {
-                     velocityFields.push_back(args[i]);
-                  }
+                  AiMsgInfo("[volume_field3d] Attached layer %s.%s from shared memory segment \"%s\" in %.3f second(s)", layer.partition.c_str(), layer.name.c_str(), shmName.c_str(), GetTime() - t0);
                }
-               ++i;
-            }
-            
-            if (velocityFields.size() == 1 || velocityFields.size() == 3)
-            {
-               std::swap(velocityFields, mVelocityFields);
             }
             else
             {
-               AiMsgWarning("[volume_field3d] -velocityField expects 1 or 3 field names");
+               SharedSegments::Cleanup(shmName, RenderCache::Magic);
             }
          }
-         else if (arg == "-velocityScale")
+         #endif
+         
+         if (useRenderCache && !mapped)
          {
-            if (++i >= args.size())
+            rcPath = RenderCache::Path(file.openPath, layer.partition, layer.name);
+            
+            double t0 = GetTime();
+            
+            mapped = RenderCache::Read(rcPath, rcKey, layer.isVector, headers, sl);
+            
+            if (mVerbose && mapped)
             {
-               AiMsgWarning("[volume_field3d] -velocityScale flag expects an argument");
+               AiMsgInfo("[volume_field3d] Mapped layer %s.%s from render cache \"%s\" in %.3f second(s)", layer.partition.c_str(), layer.name.c_str(), rcPath.c_str(), GetTime() - t0);
             }
-            else
+         }
+         
+         if (!mapped)
+         {
+            readFileLayer(layer, sl);
+            
+            if (mDenseToSparse)
             {
-               float farg = 0.0f;
+               double t0 = GetTime();
+               int numThreads = (mLoadThreads > 0 ? mLoadThreads : GetArnoldThreadCount());
+               size_t denseBytes = 0;
+               size_t sparseBytes = 0;
+               size_t count = 0;
                
-               if (sscanf(args[i].c_str(), "%f", &farg) == 1)
-               {
-                  mVelocityScale = farg;
-               }
-               else
+               count += ConvertFields<Field3D::half>(sl.scalarh, sl.mipLevels, DenseToSparse<Field3D::half>, numThreads, denseBytes, sparseBytes);
+               count += ConvertFields<float>(sl.scalarf, sl.mipLevels, DenseToSparse<float>, numThreads, denseBytes, sparseBytes);
+               count += ConvertFields<double>(sl.scalard, sl.mipLevels, DenseToSparse<double>, numThreads, denseBytes, sparseBytes);
+               count += ConvertFields<Field3D::V3h>(sl.vectorh, sl.mipLevels, DenseToSparse<Field3D::V3h>, numThreads, denseBytes, sparseBytes);
+               count += ConvertFields<Field3D::V3f>(sl.vectorf, sl.mipLevels, DenseToSparse<Field3D::V3f>, numThreads, denseBytes, sparseBytes);
+               count += ConvertFields<Field3D::V3d>(sl.vectord, sl.mipLevels, DenseToSparse<Field3D::V3d>, numThreads, denseBytes, sparseBytes);
+               
+               if (mVerbose && count > 0)
                {
-                  AiMsgWarning("[volume_field3d] -velocityScale flag expects a float argument");
+                  AiMsgInfo("[volume_field3d] Converted %lu dense field(s) of layer %s.%s to sparse in %.3f second(s) (%.2f MB -> %.2f MB)",
+                            count, layer.partition.c_str(), layer.name.c_str(), GetTime() - t0,
+                            double(denseBytes) / (1024.0 * 1024.0), double(sparseBytes) / (1024.0 * 1024.0));
                }
             }
-         }
-         else if (arg == "-worldSpaceVelocity")
-         {
-            mWorldSpaceVelocity = true;
-         }
-         else if (arg == "-motionStartFrame")
-         {
-            if (++i >= args.size())
-            {
-               AiMsgWarning("[volume_field3d] -motionStartFrame flag expects an argument");
-            }
-            else
+            
+            if (mDownsample > 1)
             {
-               float farg = 0.0f;
+               // file MIP levels are dropped (regenerated below if requested)
+               sl.mipLevels.clear();
                
-               if (sscanf(args[i].c_str(), "%f", &farg) == 1)
+               double t0 = GetTime();
+               
+               size_t kept = 0;
+               
+               kept += DownsampleFields<Field3D::half>(sl.scalarh, mDownsample);
+               kept += DownsampleFields<float>(sl.scalarf, mDownsample);
+               kept += DownsampleFields<double>(sl.scalard, mDownsample);
+               kept += DownsampleFields<Field3D::V3h>(sl.vectorh, mDownsample);
+               kept += DownsampleFields<Field3D::V3f>(sl.vectorf, mDownsample);
+               kept += DownsampleFields<Field3D::V3d>(sl.vectord, mDownsample);
+               
+               if (kept > 0 && file.downsampleWarned.compareAndSwap(0, 1))
                {
-                  mMotionStartFrame = farg;
-                  hasMotionStart = true;
+                  // once per file, not for each of its layers
+                  AiMsgWarning("[volume_field3d] Cannot downsample some fields of \"%s\", use full resolution", file.path.c_str());
                }
-               else
+               
+               if (mVerbose)
                {
-                  AiMsgWarning("[volume_field3d] -motionStartFrame flag expects a float argument");
+                  AiMsgInfo("[volume_field3d] Downsampled layer %s.%s by %d in %.3f second(s)", layer.partition.c_str(), layer.name.c_str(), mDownsample, GetTime() - t0);
                }
             }
-         }
-         else if (arg == "-motionEndFrame")
-         {
-            if (++i >= args.size())
+            
+            if (mMipmap)
             {
-               AiMsgWarning("[volume_field3d] -motionEndFrame flag expects an argument");
+               double t0 = GetTime();
+               
+               BuildMipLevels<Field3D::half>(sl.scalarh, sl.mipLevels, MinMipResolution);
+               BuildMipLevels<float>(sl.scalarf, sl.mipLevels, MinMipResolution);
+               BuildMipLevels<double>(sl.scalard, sl.mipLevels, MinMipResolution);
+               BuildMipLevels<Field3D::V3h>(sl.vectorh, sl.mipLevels, MinMipResolution);
+               BuildMipLevels<Field3D::V3f>(sl.vectorf, sl.mipLevels, MinMipResolution);
+               BuildMipLevels<Field3D::V3d>(sl.vectord, sl.mipLevels, MinMipResolution);
+               
+               if (mVerbose)
+               {
+                  AiMsgInfo("[volume_field3d] Built MIP levels for layer %s.%s in %.3f second(s)", layer.partition.c_str(), layer.name.c_str(), GetTime() - t0);
+               }
             }
-            else
+            
+            if (useRenderCache)
             {
-               float farg = 0.0f;
+               double t0 = GetTime();
                
-               if (sscanf(args[i].c_str(), "%f", &farg) == 1)
+               if (RenderCache::Write(rcPath, rcKey, sl))
                {
-                  mMotionEndFrame = farg;
-                  hasMotionEnd = true;
+                  if (mVerbose)
+                  {
+                     AiMsgInfo("[volume_field3d] Wrote layer %s.%s render cache \"%s\" in %.3f second(s)", layer.partition.c_str(), layer.name.c_str(), rcPath.c_str(), GetTime() - t0);
+                  }
                }
                else
                {
-                  AiMsgWarning("[volume_field3d] -motionEndFrame flag expects a float argument");
+                  AiMsgDebug("[volume_field3d] Could not write layer %s.%s render cache \"%s\"", layer.partition.c_str(), layer.name.c_str(), rcPath.c_str());
                }
             }
-         }
-         else if (arg == "-shutterTimeType")
-         {
-            if (++i >= args.size())
-            {
-               AiMsgWarning("[volume_field3d] -shutterTimeType flag expects an argument");
-            }
-            else
+            
+            #ifndef _WIN32
+            if (useSharedCache)
             {
-               ShutterTimeType stt = ShutterTimeTypeFromString(args[i]);
-               if (stt != STT_unknown)
+               double t0 = GetTime();
+               
+               if (RenderCache::Publish(shmName, rcKey, sl))
                {
-                  mShutterTimeType = stt;
+                  // use the shared copy, private data is released with tmp
+                  SharedLayer tmp(sl.key);
+                  
+                  if (RenderCache::Map(MappedFile::OpenShared(shmName), rcKey, layer.isVector, headers, tmp))
+                  {
+                     std::swap(sl.scalarh, tmp.scalarh);
+                     std::swap(sl.scalarf, tmp.scalarf);
+                     std::swap(sl.scalard, tmp.scalard);
+                     std::swap(sl.vectorh, tmp.vectorh);
+                     std::swap(sl.vectorf, tmp.vectorf);
+                     std::swap(sl.vectord, tmp.vectord);
+                     
+                     if (mVerbose)
+                     {
+                        AiMsgInfo("[volume_field3d] Published layer %s.%s to shared memory segment \"%s\" in %.3f second(s)", layer.partition.c_str(), layer.name.c_str(), shmName.c_str(), GetTime() - t0);
+                     }
+                  }
+                  
+                  SharedSegments::Detach(shmName);
                }
                else
                {
-                  AiMsgWarning("[volume_field3d] Invalid value for -shutterTimeType. Should be one of 'normalized', 'frame_relative' or 'absolute_frame'");
+                  AiMsgDebug("[volume_field3d] Could not publish layer %s.%s to shared memory", layer.partition.c_str(), layer.name.c_str());
                }
             }
+            #endif
          }
-         else if (arg == "-merge")
+         
+         StoragePrecision precision = channelPrecision(layer.name);
+         
+         if (mArena && !sl.arena && (mBricked || precision != SP_native || mCompress))
          {
-            ++i;
+            sl.arena = Arena::Create(mHugePages);
+         }
+         
+         // the arena only releases memory with the layer: only the last
+         // conversion allocates from it, intermediate fields are freed as soon
+         // as the next conversion is done
+         Arena *brickedArena = ((mCompress || precision != SP_native) ? 0 : sl.arena);
+         Arena *quantizedArena = (mCompress ? 0 : sl.arena);
+         
+         if (mBricked)
+         {
+            double t0 = GetTime();
+            int numThreads = (mLoadThreads > 0 ? mLoadThreads : GetArnoldThreadCount());
+            size_t denseBytes = 0;
+            size_t brickedBytes = 0;
+            size_t count = 0;
             
-            while (i < args.size())
+            count += ConvertFields<Field3D::half>(sl.scalarh, sl.mipLevels, ArenaConverter<Field3D::half>(DenseToBricked<Field3D::half>, brickedArena), numThreads, denseBytes, brickedBytes);
+            count += ConvertFields<float>(sl.scalarf, sl.mipLevels, ArenaConverter<float>(DenseToBricked<float>, brickedArena), numThreads, denseBytes, brickedBytes);
+            count += ConvertFields<double>(sl.scalard, sl.mipLevels, ArenaConverter<double>(DenseToBricked<double>, brickedArena), numThreads, denseBytes, brickedBytes);
+            count += ConvertFields<Field3D::V3h>(sl.vectorh, sl.mipLevels, ArenaConverter<Field3D::V3h>(DenseToBricked<Field3D::V3h>, brickedArena), numThreads, denseBytes, brickedBytes);
+            count += ConvertFields<Field3D::V3f>(sl.vectorf, sl.mipLevels, ArenaConverter<Field3D::V3f>(DenseToBricked<Field3D::V3f>, brickedArena), numThreads, denseBytes, brickedBytes);
+            count += ConvertFields<Field3D::V3d>(sl.vectord, sl.mipLevels, ArenaConverter<Field3D::V3d>(DenseToBricked<Field3D::V3d>, brickedArena), numThreads, denseBytes, brickedBytes);
+            
+            if (mVerbose && count > 0)
             {
-               if (args[i].length() > 0)
-               {
-                  if (args[i][0] == '-')
-                  {
-                     // found a flag
-                     --i;
-                     break;
-                  }
-                  else
-                  {
-                     mergeTypes.push_back(args[i]);
-                  }
-               }
-               ++i;
+               AiMsgInfo("[volume_field3d] Converted %lu dense field(s) of layer %s.%s to bricked layout in %.3f second(s) (%.2f MB -> %.2f MB)",
+                         count, layer.partition.c_str(), layer.name.c_str(), GetTime() - t0,
+                         double(denseBytes) / (1024.0 * 1024.0), double(brickedBytes) / (1024.0 * 1024.0));
             }
          }
-         else if (arg == "-verbose")
+         
+         if (precision != SP_native)
          {
-            mVerbose = true;
+            double t0 = GetTime();
+            int numThreads = (mLoadThreads > 0 ? mLoadThreads : GetArnoldThreadCount());
+            size_t inBytes = 0;
+            size_t outBytes = 0;
+            size_t count = 0;
+            QuantizeStats stats;
+            
+            count += ConvertFields<Field3D::half>(sl.scalarh, sl.mipLevels, Quantizer<Field3D::half>(precision, stats, quantizedArena), numThreads, inBytes, outBytes);
+            count += ConvertFields<float>(sl.scalarf, sl.mipLevels, Quantizer<float>(precision, stats, quantizedArena), numThreads, inBytes, outBytes);
+            count += ConvertFields<double>(sl.scalard, sl.mipLevels, Quantizer<double>(precision, stats, quantizedArena), numThreads, inBytes, outBytes);
+            count += ConvertFields<Field3D::V3h>(sl.vectorh, sl.mipLevels, Quantizer<Field3D::V3h>(precision, stats, quantizedArena), numThreads, inBytes, outBytes);
+            count += ConvertFields<Field3D::V3f>(sl.vectorf, sl.mipLevels, Quantizer<Field3D::V3f>(precision, stats, quantizedArena), numThreads, inBytes, outBytes);
+            count += ConvertFields<Field3D::V3d>(sl.vectord, sl.mipLevels, Quantizer<Field3D::V3d>(precision, stats, quantizedArena), numThreads, inBytes, outBytes);
+            
+            if (mVerbose && count > 0)
+            {
+               AiMsgInfo("[volume_field3d] Stored %lu field(s) of layer %s.%s as %s in %.3f second(s) (%.2f MB -> %.2f MB, max error %g, rms error %g)",
+                         count, layer.partition.c_str(), layer.name.c_str(), StoragePrecisionToString(precision), GetTime() - t0,
+                         double(inBytes) / (1024.0 * 1024.0), double(outBytes) / (1024.0 * 1024.0),
+                         stats.maxError, (stats.count > 0.0 ? sqrt(stats.sumSquaredError / stats.count) : 0.0));
+            }
          }
-         else if (arg == "-ignoreXform")
+         
+         if (mCompress)
          {
-            mIgnoreTransform = true;
+            double t0 = GetTime();
+            int numThreads = (mLoadThreads > 0 ? mLoadThreads : GetArnoldThreadCount());
+            size_t inBytes = 0;
+            size_t outBytes = 0;
+            size_t count = 0;
+            
+            count += ConvertFields<Field3D::half>(sl.scalarh, sl.mipLevels, ArenaConverter<Field3D::half>(Compress<Field3D::half>, sl.arena), numThreads, inBytes, outBytes);
+            count += ConvertFields<float>(sl.scalarf, sl.mipLevels, ArenaConverter<float>(Compress<float>, sl.arena), numThreads, inBytes, outBytes);
+            count += ConvertFields<double>(sl.scalard, sl.mipLevels, ArenaConverter<double>(Compress<double>, sl.arena), numThreads, inBytes, outBytes);
+            count += ConvertFields<Field3D::V3h>(sl.vectorh, sl.mipLevels, ArenaConverter<Field3D::V3h>(Compress<Field3D::V3h>, sl.arena), numThreads, inBytes, outBytes);
+            count += ConvertFields<Field3D::V3f>(sl.vectorf, sl.mipLevels, ArenaConverter<Field3D::V3f>(Compress<Field3D::V3f>, sl.arena), numThreads, inBytes, outBytes);
+            count += ConvertFields<Field3D::V3d>(sl.vectord, sl.mipLevels, ArenaConverter<Field3D::V3d>(Compress<Field3D::V3d>, sl.arena), numThreads, inBytes, outBytes);
+            
+            if (mVerbose && count > 0)
+            {
+               AiMsgInfo("[volume_field3d] Compressed %lu field(s) of layer %s.%s in %.3f second(s) (%.2f MB -> %.2f MB)",
+                         count, layer.partition.c_str(), layer.name.c_str(), GetTime() - t0,
+                         double(inBytes) / (1024.0 * 1024.0), double(outBytes) / (1024.0 * 1024.0));
+            }
          }
-         else
+         
+         if (sl.arena && mVerbose)
          {
-            AiMsgWarning("[volume_field3d] Invalid flag '%s'", arg.c_str());
+            AiMsgInfo("[volume_field3d] Layer %s.%s arena: %.2f MB in %lu chunk(s), %s huge pages (%lu chunk(s) on explicit huge pages)",
+                      layer.partition.c_str(), layer.name.c_str(), double(sl.arena->reservedBytes()) / (1024.0 * 1024.0),
+                      sl.arena->chunkCount(), HugePagesToString(sl.arena->hugePages()), sl.arena->hugeChunkCount());
          }
+         
+         sl.loaded.set(1);
+         read = true;
       }
       
-      // Read params from user attributes
-      if (readStringUserAttr(node, "file", mPath))
-      {
-         AiMsgDebug("[volume_field3d] User attribute 'file' found. '-file' flag overridden");
-      }
-      if (readStringUserAttr(node, "partition", mPartition))
+      AiCritSecLeave(&sl.lock);
+      
+      return read;
+   }
+   
+   // Read layer fields from file, in shared layer 'sl'
+   void readFileLayer(LayerData &layer, SharedLayer &sl)
+   {
+      FileData &file = *(layer.file);
+      Field3D::Field3DInputFile *f3d = acquireFile(file);
+      
+      if (layer.isVector)
       {
-         AiMsgDebug("[volume_field3d] User attribute 'partition' found. '-partition' flag overridden");
+         sl.vectorh = f3d->readVectorLayers<Field3D::half>(layer.partition, layer.name);
+         sl.vectorf = f3d->readVectorLayers<float>(layer.partition, layer.name);
+         sl.vectord = f3d->readVectorLayers<double>(layer.partition, layer.name);
       }
-      if (readStringArrayUserAttr(node, "merge", ' ', true, mergeTypes))
+      else
       {
-         AiMsgDebug("[volume_field3d] User attribute 'merge' found. '-merge' flag overridden");
+         sl.scalarh = f3d->readScalarLayers<Field3D::half>(layer.partition, layer.name);
+         sl.scalarf = f3d->readScalarLayers<float>(layer.partition, layer.name);
+         sl.scalard = f3d->readScalarLayers<double>(layer.partition, layer.name);
       }
-      if (readFloatUserAttr(node, "frame", mFrame))
+      
+      releaseFile(file, f3d);
+      
+      ExpandMipFields<Field3D::half>(sl.scalarh, sl.mipLevels);
+      ExpandMipFields<float>(sl.scalarf, sl.mipLevels);
+      ExpandMipFields<double>(sl.scalard, sl.mipLevels);
+      ExpandMipFields<Field3D::V3h>(sl.vectorh, sl.mipLevels);
+      ExpandMipFields<Field3D::V3f>(sl.vectorf, sl.mipLevels);
+      ExpandMipFields<Field3D::V3d>(sl.vectord, sl.mipLevels);
+      
+      // before any conversion changes the fields data window
+      std::vector<bool> bound(layer.fields.size(), false);
+      
+      sl.headerIndices.clear();
+      
+      bindHeaders<Field3D::half>(layer, sl.scalarh, bound, sl.headerIndices);
+      bindHeaders<float>(layer, sl.scalarf, bound, sl.headerIndices);
+      bindHeaders<double>(layer, sl.scalard, bound, sl.headerIndices);
+      bindHeaders<Field3D::V3h>(layer, sl.vectorh, bound, sl.headerIndices);
+      bindHeaders<Field3D::V3f>(layer, sl.vectorf, bound, sl.headerIndices);
+      bindHeaders<Field3D::V3d>(layer, sl.vectord, bound, sl.headerIndices);
+   }
+   
+   // Progressive mode proxy: coarsest MIP level of each field of the layer, without reading
+   // the finer levels. Leaves 'sl' empty if the layer has fields without MIP levels.
+   void readMipProxy(LayerData &layer, SharedLayer &sl)
+   {
+      FileData &file = *(layer.file);
+      Field3D::Field3DInputFile *f3d = acquireFile(file);
+      
+      if (layer.isVector)
       {
-         AiMsgDebug("[volume_field3d] User attribute 'frame' found. '-frame' flag overridden");
+         sl.vectorh = f3d->readVectorLayers<Field3D::half>(layer.partition, layer.name);
+         sl.vectorf = f3d->readVectorLayers<float>(layer.partition, layer.name);
+         sl.vectord = f3d->readVectorLayers<double>(layer.partition, layer.name);
       }
-      if (readFloatUserAttr(node, "fps", mFPS))
+      else
       {
-         AiMsgDebug("[volume_field3d] User attribute 'fps' found. '-fps' flag overridden");
+         sl.scalarh = f3d->readScalarLayers<Field3D::half>(layer.partition, layer.name);
+         sl.scalarf = f3d->readScalarLayers<float>(layer.partition, layer.name);
+         sl.scalard = f3d->readScalarLayers<double>(layer.partition, layer.name);
       }
-      if (readFloatUserAttr(node, "motionStartFrame", mMotionStartFrame))
+      
+      releaseFile(file, f3d);
+      
+      // MIP fields share the extents, data window and mapping of their finest level
+      std::vector<bool> bound(layer.fields.size(), false);
+      
+      sl.headerIndices.clear();
+      
+      bindHeaders<Field3D::half>(layer, sl.scalarh, bound, sl.headerIndices);
+      bindHeaders<float>(layer, sl.scalarf, bound, sl.headerIndices);
+      bindHeaders<double>(layer, sl.scalard, bound, sl.headerIndices);
+      bindHeaders<Field3D::V3h>(layer, sl.vectorh, bound, sl.headerIndices);
+      bindHeaders<Field3D::V3f>(layer, sl.vectorf, bound, sl.headerIndices);
+      bindHeaders<Field3D::V3d>(layer, sl.vectord, bound, sl.headerIndices);
+      
+      if (!CoarsestMipLevels<Field3D::half>(sl.scalarh) ||
+          !CoarsestMipLevels<float>(sl.scalarf) ||
+          !CoarsestMipLevels<double>(sl.scalard) ||
+          !CoarsestMipLevels<Field3D::V3h>(sl.vectorh) ||
+          !CoarsestMipLevels<Field3D::V3f>(sl.vectorf) ||
+          !CoarsestMipLevels<Field3D::V3d>(sl.vectord))
       {
-         AiMsgDebug("[volume_field3d] User attribute 'motionStartFrame' found. '-motionStartFrame' flag overridden");
-         hasMotionStart = true;
+         sl.scalarh.clear();
+         sl.scalarf.clear();
+         sl.scalard.clear();
+         sl.vectorh.clear();
+         sl.vectorf.clear();
+         sl.vectord.clear();
+         sl.headerIndices.clear();
+         return;
       }
-      if (readFloatUserAttr(node, "motionEndFrame", mMotionEndFrame))
+      
+      BuildProxyFields<Field3D::half>(sl.scalarh, ProxyResolution);
+      BuildProxyFields<float>(sl.scalarf, ProxyResolution);
+      BuildProxyFields<double>(sl.scalard, ProxyResolution);
+      BuildProxyFields<Field3D::V3h>(sl.vectorh, ProxyResolution);
+      BuildProxyFields<Field3D::V3f>(sl.vectorf, ProxyResolution);
+      BuildProxyFields<Field3D::V3d>(sl.vectord, ProxyResolution);
+   }
+   
+   // Progressive mode: sample low resolution copies of the layer fields until the full
+   // resolution data read in background is published (see publishLayers). Copies are
+   // only made from the coarsest MIP level stored in the file: other layers have no
+   // cheaper source than a full read, they are read once, right away.
+   // Called before rendering starts.
+   void loadProxy(LayerData &layer)
+   {
+      if (layer.loaded.get() != 0 || layer.proxy)
       {
-         AiMsgDebug("[volume_field3d] User attribute 'motionEndFrame' found. '-motionEndFrame' flag overridden");
-         hasMotionEnd = true;
+         return;
       }
-      if (readFloatUserAttr(node, "velocityScale", mVelocityScale))
+      
+      double t0 = GetTime();
+      bool read = false;
+      
+      SharedLayer *sl = FieldCache::Acquire(layer.key + "|proxy");
+      
+      AiCritSecEnter(&sl->lock);
+      
+      if (sl->loaded.get() == 0)
       {
-         AiMsgDebug("[volume_field3d] User attribute 'velocityScale' found. '-velocityScale' flag overridden");
+         readMipProxy(layer, *sl);
+         
+         sl->loaded.set(1);
+         read = true;
       }
-      if (readStringArrayUserAttr(node, "velocityField", ' ', true, velocityFields))
+      
+      AiCritSecLeave(&sl->lock);
+      
+      if (sl->headerIndices.empty())
       {
-         if (velocityFields.size() != 1 && velocityFields.size() != 3)
+         FieldCache::Release(sl);
+         
+         if (mVerbose)
          {
-            AiMsgDebug("[volume_field3d] User attribute 'velocityField' found but invalid specification (expected 1 or 3 names)");
+            AiMsgInfo("[volume_field3d] No MIP levels in %s layer '%s.%s', read at full resolution", layer.isVector ? "vector" : "scalar",
+                      layer.partition.c_str(), layer.name.c_str());
          }
-         else
+         
+         loadLayer(layer);
+         return;
+      }
+      
+      layer.proxy = sl;
+      
+      size_t offset = 0;
+      
+      if (layer.isVector)
+      {
+         loadProxyFields<Field3D::V3h>(layer, FDT_half, sl->vectorh, sl->headerIndices, offset);
+         loadProxyFields<Field3D::V3f>(layer, FDT_float, sl->vectorf, sl->headerIndices, offset);
+         loadProxyFields<Field3D::V3d>(layer, FDT_double, sl->vectord, sl->headerIndices, offset);
+      }
+      else
+      {
+         loadProxyFields<Field3D::half>(layer, FDT_half, sl->scalarh, sl->headerIndices, offset);
+         loadProxyFields<float>(layer, FDT_float, sl->scalarf, sl->headerIndices, offset);
+         loadProxyFields<double>(layer, FDT_double, sl->scalard, sl->headerIndices, offset);
+      }
+      
+      if (mVerbose)
+      {
+         AiMsgInfo("[volume_field3d] %s %s layer '%s.%s' proxy in %.3f second(s)", read ? "Built" : "Shared", layer.isVector ? "vector" : "scalar",
+                   layer.partition.c_str(), layer.name.c_str(), GetTime() - t0);
+      }
+   }
+   
+   // Release layer proxies once its full resolution fields are published
+   void releaseProxy(LayerData &layer)
+   {
+      for (size_t i=0; i<layer.fields.size(); ++i)
+      {
+         mFields[layer.fields[i]].proxy = 0;
+      }
+      
+      layer.proxies.clear();
+      
+      FieldCache::Release(layer.proxy);
+      layer.proxy = 0;
+   }
+   
+   // Progressive mode: read layer shared data without binding it to the volume fields,
+   // those only change between renders (see publishLayers)
+   void readLayer(LayerData &layer)
+   {
+      AiCritSecEnter(&layer.lock);
+      if (!layer.shared)
+      {
+         layer.shared = FieldCache::Acquire(layer.key);
+      }
+      AiCritSecLeave(&layer.lock);
+      
+      double t0 = GetTime();
+      
+      bool read = readSharedLayer(layer);
+      
+      if (mVerbose)
+      {
+         AiMsgInfo("[volume_field3d] %s %s layer '%s.%s' in background in %.3f second(s)", read ? "Read" : "Shared", layer.isVector ? "vector" : "scalar",
+                   layer.partition.c_str(), layer.name.c_str(), GetTime() - t0);
+      }
+   }
+   
+   bool isLayerRead(LayerData &layer)
+   {
+      AiCritSecEnter(&layer.lock);
+      bool read = (layer.shared && layer.shared->loaded.get() != 0);
+      AiCritSecLeave(&layer.lock);
+      
+      return read;
+   }
+   
+   // Progressive mode: bind the layers read in background since the previous update.
+   // Called between renders so that the fields don't change while being sampled.
+   void publishLayers()
+   {
+      size_t published = 0;
+      size_t pending = 0;
+      
+      for (size_t i=0; i<mLayers.size(); ++i)
+      {
+         LayerData &layer = *(mLayers[i]);
+         
+         if (layer.loaded.get() != 0)
          {
-            AiMsgDebug("[volume_field3d] User attribute 'velocityField' found. '-velocityField' flag overridden");
-            std::swap(velocityFields, mVelocityFields);
+            continue;
          }
-      }
-      if (readStringUserAttr(node, "shutterTimeType", shutterTimeType))
-      {
-         ShutterTimeType stt = ShutterTimeTypeFromString(shutterTimeType);
-         if (stt != STT_unknown)
+         
+         if (isLayerRead(layer))
          {
-            AiMsgDebug("[volume_field3d] User attribute 'shutterTimeType' found. '-shutterTimeType' flag overridden");
-            mShutterTimeType = stt;
+            // no I/O involved
+            loadLayer(layer);
+            releaseProxy(layer);
+            ++published;
          }
          else
          {
-            AiMsgWarning("[volume_field3d] Invalid value for shutterTimeType attribute. Should be one of 'normalized', 'frame_relative' or 'absolute_frame'");
+            ++pending;
          }
       }
-      if (readBoolUserAttr(node, "worldSpaceVelocity", mWorldSpaceVelocity))
+      
+      if (mVerbose && published > 0)
       {
-         AiMsgDebug("[voluem_field3d] User attribute 'worldSpaceVelocity' found. '-worldSpaceVelocity' flag overridden");
+         AiMsgInfo("[volume_field3d] Use full resolution data for %lu layer(s), %lu still being read", published, pending);
       }
-      if (readBoolUserAttr(node, "ignoreXform", mIgnoreTransform))
+   }
+   
+   // Build all layers proxies, spread over the load threads
+   void loadProxies()
+   {
+      std::vector<size_t> order(mLayers.size());
+      
+      for (size_t i=0; i<order.size(); ++i)
       {
-         AiMsgDebug("[volume_field3d] User attribute 'ignoreXform' found. '-ignoreXform' flag overridden");
+         order[i] = i;
       }
-      if (readBoolUserAttr(node, "verbose", mVerbose))
+      
+      LoadLayersTask task(this, order, true);
+      
+      int numThreads = (mLoadThreads > 0 ? mLoadThreads : GetArnoldThreadCount());
+      
+      double t0 = GetTime();
+      
+      RunParallel(task, mLayers.size(), numThreads, AI_PRIORITY_NORMAL);
+      
+      if (mVerbose)
       {
-         AiMsgDebug("[volume_field3d] User attribute 'verbose' found. '-verbose' flag overridden");
+         AiMsgInfo("[volume_field3d] All layers proxies built in %.3f second(s)", GetTime() - t0);
       }
+   }
+   
+   // Read all layers not yet loaded, spread over the load threads.
+   // Note: HDF5 calls (block decompression included) are serialized by Field3D, Ogawa reads
+   //       and conversions run concurrently.
+   //       Fields order (global and partition indices) is set when reading headers and
+   //       doesn't depend on the order in which layers are read.
+   // In progressive mode, layers are only read (see readLayer).
+   void loadLayers(int priority=AI_PRIORITY_NORMAL)
+   {
+      std::vector<size_t> order(mLayers.size());
       
-      // fill mChannelsMergeType dictionnary
-      for (size_t i=0; i<mergeTypes.size(); ++i)
+      if (mProgressive)
       {
-         std::string &md = mergeTypes[i];
+         // smallest layers first so that low resolution fields show up early
+         std::vector<std::pair<double, size_t> > sizes(mLayers.size());
          
-         size_t p = md.find('=');
-         
-         if (p != std::string::npos)
+         for (size_t i=0; i<mLayers.size(); ++i)
          {
-            std::string channel = md.substr(0, p);
-            SampleMergeType mtype = SampleMergeTypeFromString(md.substr(p + 1));
+            sizes[i].first = 0.0;
+            sizes[i].second = i;
             
-            if (channel.length() > 0 && mtype != SMT_unknown)
+            for (size_t j=0; j<mLayers[i]->fields.size(); ++j)
             {
-               mChannelsMergeType[channel] = mtype;
-               AiMsgDebug("[volume_field3d] Using %s merge for channel \"%s\"", SampleMergeTypeToString(mtype), channel.c_str());
+               const FieldData &fd = mFields[mLayers[i]->fields[j]];
+               
+               if (fd.base)
+               {
+                  Field3D::V3i res = fd.base->dataResolution();
+                  sizes[i].first += double(res.x) * double(res.y) * double(res.z);
+               }
             }
          }
+         
+         std::sort(sizes.begin(), sizes.end());
+         
+         for (size_t i=0; i<sizes.size(); ++i)
+         {
+            order[i] = sizes[i].second;
+         }
+      }
+      else
+      {
+         for (size_t i=0; i<order.size(); ++i)
+         {
+            order[i] = i;
+         }
       }
       
-      // setup motion start/end
-      if (!hasMotionStart)
+      LoadLayersTask task(this, order, false);
+      
+      int numThreads = (mLoadThreads > 0 ? mLoadThreads : GetArnoldThreadCount());
+      
+      if (mVerbose)
       {
-         mMotionStartFrame = mFrame;
+         AiMsgInfo("[volume_field3d] Read %lu layer(s) using %d thread(s)", mLayers.size(), std::min(numThreads, int(mLayers.size())));
       }
-      if (!hasMotionEnd)
+      
+      double t0 = GetTime();
+      
+      RunParallel(task, mLayers.size(), numThreads, priority);
+      
+      if (mVerbose)
       {
-         mMotionEndFrame = mFrame;
+         double total = 0.0;
+         
+         for (size_t i=0; i<mLayers.size(); ++i)
+         {
+            total += mLayers[i]->readTime;
+         }
+         
+         // total > elapsed when layers reads overlap
+         AiMsgInfo("[volume_field3d] All layers read in %.3f second(s) (%.3f second(s) cumulated layer read time)", GetTime() - t0, total);
       }
-      if (mMotionEndFrame < mMotionStartFrame)
+   }
+   
+   // File handle for a layer read. Field3D serializes HDF5 access so all reads
+   // share the main handle, Ogawa files get one handle per concurrent read so
+   // that layers are actually read in parallel. If no additional handle can be
+   // opened, reads take turns on the main one.
+   Field3D::Field3DInputFile* acquireFile(FileData &file)
+   {
+      if (file.format != FF_ogawa)
       {
-         mMotionEndFrame = mMotionStartFrame;
+         return file.f3d;
       }
       
-      if (mFPS < AI_EPSILON)
+      Field3D::Field3DInputFile *f3d = 0;
+      
+      AiCritSecEnter(&file.lock);
+      if (!file.freeFiles.empty())
       {
-         mFPS = AI_EPSILON;
+         f3d = file.freeFiles.back();
+         file.freeFiles.pop_back();
       }
+      AiCritSecLeave(&file.lock);
       
-      if (mVerbose && !noSetup)
+      if (!f3d)
       {
-         AiMsgInfo("[volume_field3d] Parameters:");
-         AiMsgInfo("[volume_field3d]   path = '%s'", mPath.c_str());
-         AiMsgInfo("[volume_field3d]   partition = '%s'", mPartition.c_str());
-         AiMsgInfo("[volume_field3d]   frame = %f", mFrame);
-         AiMsgInfo("[volume_field3d]   fps = %f", mFPS);
-         for (size_t i=0; i<mVelocityFields.size(); ++i)
+         f3d = new Field3D::Field3DInputFile();
+         
+         if (file.openPath != file.path)
          {
-            AiMsgInfo("[volume_field3d]   velocity field %lu = '%s'", i, mVelocityFields[i].c_str());
+            StagingCache::Touch(file.openPath);
          }
-         AiMsgInfo("[volume_field3d]   velocity scale = %f", mVelocityScale);
-         AiMsgInfo("[volume_field3d]   world space velocity = %s", mWorldSpaceVelocity ? "true" : "false");
-         AiMsgInfo("[volume_field3d]   motion start frame = %f", mMotionStartFrame);
-         AiMsgInfo("[volume_field3d]   motion end frame = %f", mMotionEndFrame);
-         AiMsgInfo("[volume_field3d]   shutter time type = %s", ShutterTimeTypeToString(mShutterTimeType));
-         for (std::map<std::string, SampleMergeType>::iterator mtit=mChannelsMergeType.begin(); mtit!=mChannelsMergeType.end(); ++mtit)
+         
+         if (!f3d->open(file.openPath))
          {
-            AiMsgInfo("[volume_field3d]   '%s' channel merge = %s", mtit->first.c_str(), SampleMergeTypeToString(mtit->second));
+            AiMsgWarning("[volume_field3d] Could not open additional handle on \"%s\"", file.path.c_str());
+            delete f3d;
+            
+            // released by releaseFile
+            AiCritSecEnter(&file.fallbackLock);
+            f3d = file.f3d;
          }
-         AiMsgInfo("[volume_field3d]   ignore transform = %s", mIgnoreTransform ? "true" : "false");
       }
       
-      // Replace frame in path (if necessary)
-      // allow ###, %03d, or yet <frame> and <frame:pad> tokens in file path
-      int iframe = int(floorf(mFrame));
-      
-      size_t p0 = mPath.find_last_of("\\/");
-      size_t p1;
-      size_t p2;
-      
-      std::string dirname = (p0 != std::string::npos ? mPath.substr(0, p0) : "");
-      std::string basename = (p0 != std::string::npos ? mPath.substr(p0 + 1) : mPath);
-      
-      // Probably won't ever need more than 32 digits for the frame number
-      char *tmp = new char[basename.length() + 32];
-      bool foundFramePattern = false;
+      return f3d;
+   }
+   
+   void releaseFile(FileData &file, Field3D::Field3DInputFile *f3d)
+   {
+      if (f3d != file.f3d)
+      {
+         AiCritSecEnter(&file.lock);
+         file.freeFiles.push_back(f3d);
+         AiCritSecLeave(&file.lock);
+      }
+      else if (file.format == FF_ogawa)
+      {
+         AiCritSecLeave(&file.fallbackLock);
+      }
+   }
+   
+   #ifdef F3D_OGAWA_SUPPORT
+   
+   // Field3D reads and decompresses the sparse blocks of an Ogawa backed field on
+   // several threads. HDF5 block reads (decompression included, it is an HDF5
+   // filter) run under Field3D's global HDF5 lock and don't benefit from it.
+   // Note: process wide setting
+   void setupIOThreads()
+   {
+      int numThreads = (mIOThreads > 0 ? mIOThreads : GetArnoldThreadCount());
       
-      p0 = basename.rfind("<frame");
-      if (p0 != std::string::npos)
+      if (Field3D::numIOThreads() != size_t(numThreads))
       {
-         // <frame> or <frame:N>
-         p2 = basename.find('>', p0);
-         
-         if (p2 != std::string::npos)
+         if (mVerbose)
          {
-            p1 = basename.rfind(':', p2);
-            
-            if (p1 != std::string::npos && p1 > p0)
-            {
-               std::string pads = basename.substr(p1 + 1, p2 - p1 - 1);
-               int pad = 0;
-               
-               if (sscanf(pads.c_str(), "%d", &pad) != 1)
-               {
-                  AiMsgWarning("[volume_field3d] Invalid <frame> token format: %s. Assume no padding", basename.substr(p0, p2-p1+1).c_str());
-                  pad = 0;
-               }
-               
-               if (pad > 1)
-               {
-                  sprintf(tmp, "%%0%dd", pad);
-                  basename = basename.substr(0, p0) + tmp + basename.substr(p2 + 1);
-               }
-               else
-               {
-                  basename = basename.substr(0, p0) + "%d" + basename.substr(p2 + 1);
-               }
-            }
-            else
-            {
-               basename = basename.substr(0, p0) + "%d" + basename.substr(p2 + 1);
-            }
-            
-            foundFramePattern = true;
+            AiMsgInfo("[volume_field3d] Use %d thread(s) for Ogawa sparse blocks reads", numThreads);
          }
+         Field3D::setNumIOThreads(size_t(numThreads));
+      }
+   }
+   
+   #endif
+   
+   // Read voxel data in background: first sample of a channel only waits for its own layer
+   // (in progressive mode, samples use the layer proxy until the next update instead)
+   void startPreload()
+   {
+      if (!mPreload || mBoundsOnly)
+      {
+         return;
       }
       
-      if (!foundFramePattern)
+      if (mPreloadThread)
       {
-         p1 = basename.rfind('#');
-         
-         if (p1 != std::string::npos)
-         {
-            if (p1 > 0)
-            {
-               p0 = basename.find_last_not_of("#", p1 - 1);
-               
-               if (p0 == std::string::npos)
-               {
-                  sprintf(tmp, "%%0%lud", p1 + 1);
-                  basename = tmp + basename.substr(p1 + 1);
-               }
-               else
-               {
-                  size_t n = p1 - p0;
-                  
-                  sprintf(tmp, "%%0%lud", n);
-                  basename = basename.substr(0, p0 + 1) + tmp + basename.substr(p1 + 1);
-               }
-            }
-            else
-            {
-               basename = std::string("%d") + basename.substr(p1 + 1);
-            }
-            
-            foundFramePattern = true;
-         }
-         else
+         if (mPreloadDone.get() == 0)
          {
-            // support already in printf format
+            return;
          }
+         
+         // previous preload completed, layers left may have been added by a frame change
+         AiThreadWait(mPreloadThread);
+         AiThreadClose(mPreloadThread);
+         
+         mPreloadThread = 0;
       }
       
-      sprintf(tmp, basename.c_str(), iframe);
-         
-      if (basename == tmp)
+      size_t pending = 0;
+      
+      for (size_t i=0; i<mLayers.size(); ++i)
       {
-         AiMsgWarning("[volume_field3d] No frame pattern in file name: \"%s\"", basename.c_str());
+         LayerData &layer = *(mLayers[i]);
+         
+         if (layer.loaded.get() == 0 && !(mProgressive && isLayerRead(layer)))
+         {
+            ++pending;
+         }
       }
-      else
+      
+      if (pending == 0)
       {
-         basename = tmp;
+         return;
       }
       
-      delete[] tmp;
+      mCancelLoad.set(0);
+      mPreloadDone.set(0);
+      
+      mPreloadThread = AiThreadCreate(PreloadThread, this, AI_PRIORITY_LOW);
       
-      mPath = dirname;
-      if (mPath.length() > 0)
+      if (!mPreloadThread)
+      {
+         AiMsgWarning("[volume_field3d] Failed to start preload thread");
+         loadLayers();
+         
+         if (mProgressive)
+         {
+            publishLayers();
+         }
+      }
+   }
+   
+   void stopPreload()
+   {
+      if (mPreloadThread)
       {
-         mPath += "/";
+         // layers being read are completed, remaining ones are skipped
+         mCancelLoad.set(1);
+         
+         AiThreadWait(mPreloadThread);
+         AiThreadClose(mPreloadThread);
+         
+         mPreloadThread = 0;
+         mCancelLoad.set(0);
       }
-      mPath += basename;
+   }
+   
+   static unsigned int PreloadThread(void *data)
+   {
+      VolumeData *vd = (VolumeData*) data;
       
-      if (mVerbose && !noSetup)
+      vd->loadLayers(AI_PRIORITY_LOW);
+      
+      if (vd->mProgressive && vd->mVerbose && vd->mCancelLoad.get() == 0)
       {
-         AiMsgInfo("[volume_field3d] Using %s", mPath.c_str());
+         // Arnold offers no way to request a new render from here
+         AiMsgInfo("[volume_field3d] Full resolution data read, used from next update");
       }
       
-      if (!noSetup)
+      vd->mPreloadDone.set(1);
+      
+      return 0;
+   }
+   
+   // Frames prefetching runs in the background until next update or reset.
+   // The frames cache is only modified by the prefetch thread while it is running.
+   void startPrefetch()
+   {
+      if (mPrefetch <= 0 || mBoundsOnly || mPrefetchThread || !HasFramePattern(mPathPattern))
       {
-         return setup();
+         return;
       }
-      else
+      
+      mCancelPrefetch.set(0);
+      
+      mPrefetchThread = AiThreadCreate(PrefetchThread, this, AI_PRIORITY_LOW);
+      
+      if (!mPrefetchThread)
       {
-         return true;
+         AiMsgWarning("[volume_field3d] Failed to start prefetch thread");
       }
    }
    
-   bool setup()
+   void stopPrefetch()
    {
-      if (mVerbose)
+      if (mPrefetchThread)
       {
-         AiMsgInfo("[volume_field3d] Open file: %s", mPath.c_str());
+         // layer being read is completed, remaining ones are skipped
+         mCancelPrefetch.set(1);
+         
+         AiThreadWait(mPrefetchThread);
+         AiThreadClose(mPrefetchThread);
+         
+         mPrefetchThread = 0;
+         mCancelPrefetch.set(0);
       }
+   }
+   
+   static unsigned int PrefetchThread(void *data)
+   {
+      VolumeData *vd = (VolumeData*) data;
       
-      mF3DFile = new Field3D::Field3DInputFile();
+      vd->prefetchFrames();
       
-      if (!mF3DFile->open(mPath))
-      {
-         reset();
-         return false;
-      }
-      else
+      return 0;
+   }
+   
+   // Read next frames into the frames cache
+   void prefetchFrames()
+   {
+      int iframe = int(floorf(mFrame));
+      // prefetched frames are kept in frame order at the front of the cache so
+      // that the next frame is the last one to be evicted
+      size_t inserted = 0;
+      
+      for (int i=1; i<=mPrefetch && mCancelPrefetch.get() == 0; ++i)
       {
-         std::vector<std::string> partitions;
-         std::vector<std::string> layers;
-         std::map<std::string, size_t> fieldCount;
-         std::map<std::string, std::map<std::string, size_t> > partitionsFieldCount;
-         std::map<std::string, size_t>::iterator pfcit;
-         std::map<std::string, size_t>::iterator gfcit;
+         std::string path = ExpandFiles(mPathPattern, iframe + i);
+         
+         if (path == mPath || hasCachedFrame(path, mPartition, processingKey()))
+         {
+            continue;
+         }
          
-         if (mPartition.length() > 0)
+         if (!FilesExist(path))
          {
-            partitions.push_back(mPartition);
+            continue;
          }
-         else
+         
+         double t0 = GetTime();
+         
+         VolumeData *vd = new VolumeData();
+         
+         vd->mPath = path;
+         vd->mPartition = mPartition;
+         vd->mVerbose = mVerbose;
+         vd->mDownsample = mDownsample;
+         vd->mMipmap = mMipmap;
+         vd->mDenseToSparse = mDenseToSparse;
+         vd->mBricked = mBricked;
+         vd->mChannelsPrecision = mChannelsPrecision;
+         vd->mCompress = mCompress;
+         vd->mRenderCache = mRenderCache;
+         vd->mSharedCache = mSharedCache;
+         vd->mStageDir = mStageDir;
+         vd->mStageSize = mStageSize;
+         vd->mArena = mArena;
+         vd->mHugePages = mHugePages;
+         // layers are read below, one at a time
+         vd->mLazyLoad = true;
+         vd->mLoadThreads = 1;
+         
+         // process wide settings were applied by the main thread
+         if (!vd->setup(false))
          {
-            // Note: partition names are made unique by 'getPartitionNames'
-            mF3DFile->getPartitionNames(partitions);
+            delete vd;
+            continue;
          }
          
-         for (size_t i=0; i<partitions.size(); ++i)
+         for (size_t j=0; j<vd->mLayers.size() && mCancelPrefetch.get() == 0; ++j)
          {
-            const std::string &partition = partitions[i];
-            
-            std::map<std::string, size_t> &partitionFieldCount = partitionsFieldCount[partition];
-            
-            layers.clear();   
-            mF3DFile->getScalarLayerNames(layers, partition);
-            
-            for (size_t j=0; j<layers.size(); ++j)
-            {
-               const std::string &layer = layers[j];
-               
-               Field3D::Field<Field3D::half>::Vec hfields = mF3DFile->readScalarLayers<Field3D::half>(partition, layer);
-               Field3D::Field<float>::Vec ffields = mF3DFile->readScalarLayers<float>(partition, layer);
-               Field3D::Field<double>::Vec dfields = mF3DFile->readScalarLayers<double>(partition, layer);
-               
-               if (hfields.empty() && ffields.empty() && dfields.empty())
-               {
-                  continue;
-               }
-               
-               gfcit = fieldCount.find(layer);
-               if (gfcit == fieldCount.end())
-               {
-                  fieldCount[layer] = 0;
-                  gfcit = fieldCount.find(layer);
-               }
-               
-               pfcit = partitionFieldCount.find(layer);
-               if (pfcit == partitionFieldCount.end())
-               {
-                  partitionFieldCount[layer] = 0;
-                  pfcit = partitionFieldCount.find(layer);
-               }
-               
-               addFields<Field3D::half>(partition, layer, FDT_half, false, hfields, pfcit->second, gfcit->second);
-               addFields<float>(partition, layer, FDT_float, false, ffields, pfcit->second, gfcit->second);
-               addFields<double>(partition, layer, FDT_double, false, dfields, pfcit->second, gfcit->second);
-            }
-            
-            layers.clear();
-            mF3DFile->getVectorLayerNames(layers, partition);
-            
-            for (size_t j=0; j<layers.size(); ++j)
-            {
-               const std::string &layer = layers[j];
-               
-               Field3D::Field<Field3D::V3h>::Vec hfields = mF3DFile->readVectorLayers<Field3D::half>(partition, layer);
-               Field3D::Field<Field3D::V3f>::Vec ffields = mF3DFile->readVectorLayers<float>(partition, layer);
-               Field3D::Field<Field3D::V3d>::Vec dfields = mF3DFile->readVectorLayers<double>(partition, layer);
-               
-               if (hfields.empty() && ffields.empty() && dfields.empty())
-               {
-                  continue;
-               }
-               
-               gfcit = fieldCount.find(layer);
-               if (gfcit == fieldCount.end())
-               {
-                  fieldCount[layer] = 0;
-                  gfcit = fieldCount.find(layer);
-               }
-               
-               pfcit = partitionFieldCount.find(layer);
-               if (pfcit == partitionFieldCount.end())
-               {
-                  partitionFieldCount[layer] = 0;
-                  pfcit = partitionFieldCount.find(layer);
-               }
-               
-               addFields<Field3D::V3h>(partition, layer, FDT_half, true, hfields, pfcit->second, gfcit->second);
-               addFields<Field3D::V3f>(partition, layer, FDT_float, true, ffields, pfcit->second, gfcit->second);
-               addFields<Field3D::V3d>(partition, layer, FDT_double, true, dfields, pfcit->second, gfcit->second);
-            }
+            vd->loadLayer(*(vd->mLayers[j]));
+         }
+         
+         if (mVerbose)
+         {
+            AiMsgInfo("[volume_field3d] Prefetched frame %d in %.3f second(s): %s", iframe + i, GetTime() - t0, path.c_str());
          }
          
-         setupVelocityFields();
+         // layers not read because of cancellation will be read on demand
+         mFrameCache.insert(mFrameCache.begin() + std::min(inserted, mFrameCache.size()), vd);
+         ++inserted;
          
-         return true;
+         trimFrameCache();
       }
    }
    
+   // Field to sample for 'fd', null if it has no voxel data. In progressive mode layers are
+   // never read while rendering, fields are sampled through their proxy until published.
+   FieldData* ensureLoaded(FieldData &fd)
+   {
+      if (fd.layer && fd.layer->loaded.load() == 0)
+      {
+         if (mProgressive)
+         {
+            return ((fd.proxy && fd.proxy->type != FT_unknown) ? fd.proxy : 0);
+         }
+         
+         loadLayer(*fd.layer);
+      }
+      
+      return (fd.type != FT_unknown ? &fd : 0);
+   }
+   
    void setupVelocityFields()
    {
       for (size_t i=0; i<mFields.size(); ++i)
@@ -1426,8 +8455,13 @@ public:
       VolumeData tmp;
       bool rv = false;
       
+      // frames cache is about to be accessed
+      stopPrefetch();
+      
       if (tmp.init(node, paramString, true))
       {
+         tmp.mFileKey = FilesKey(tmp.mPath);
+         
          if (isIdentical(tmp))
          {
             if (mVerbose)
@@ -1435,6 +8469,8 @@ public:
                AiMsgInfo("[volume_field3d] No changes in fields to be read");
             }
             
+            bool ignoreTransformChanged = (mIgnoreTransform != tmp.mIgnoreTransform);
+            
             mNode = node;
             mIgnoreTransform = tmp.mIgnoreTransform;
             mVerbose = tmp.mVerbose;
@@ -1445,21 +8481,103 @@ public:
             mMotionStartFrame = tmp.mMotionStartFrame;
             mMotionEndFrame = tmp.mMotionEndFrame;
             mShutterTimeType = tmp.mShutterTimeType;
+            mLazyLoad = tmp.mLazyLoad;
+            mRenderCache = tmp.mRenderCache;
+            mSharedCache = tmp.mSharedCache;
+            mStageDir = tmp.mStageDir;
+            mStageSize = tmp.mStageSize;
+            mArena = tmp.mArena;
+            mHugePages = tmp.mHugePages;
+            mMemoryLimit = tmp.mMemoryLimit;
+            mSequentialRead = tmp.mSequentialRead;
+            mBoundsOnly = tmp.mBoundsOnly;
+            mLoadThreads = tmp.mLoadThreads;
+            mIOThreads = tmp.mIOThreads;
+            mPreload = tmp.mPreload;
+            mProgressive = tmp.mProgressive;
+            mFrameCacheSize = tmp.mFrameCacheSize;
+            mFrameCacheMemory = tmp.mFrameCacheMemory;
+            mPrefetch = tmp.mPrefetch;
+            // mDownsample, mMipmap, mDenseToSparse, mBricked, mChannelsPrecision and mCompress identical
+            mPathPattern = tmp.mPathPattern;
+            
+            trimFrameCache();
+            
+            // only velocity fields lookup depends on settings
+            bool velocityChanged = (mVelocityFields != tmp.mVelocityFields);
+            
             std::swap(mChannelsMergeType, tmp.mChannelsMergeType);
             std::swap(mVelocityFields, tmp.mVelocityFields);
             
-            setupVelocityFields();
+            if (mProgressive)
+            {
+               publishLayers();
+            }
+            
+            if (mPreload)
+            {
+               // no-op if already running
+               startPreload();
+            }
+            else if (!mLazyLoad && !mBoundsOnly)
+            {
+               loadLayers();
+            }
+            
+            if (velocityChanged)
+            {
+               setupVelocityFields();
+            }
+            
+            if (ignoreTransformChanged)
+            {
+               buildFieldGrid();
+            }
+            
+            startPrefetch();
             
             rv = true;
          }
          else
          {
-            if (tmp.setup())
+            bool ready = false;
+            VolumeData *cached = popCachedFrame(tmp.mPath, tmp.mPartition, tmp.processingKey());
+            
+            if (cached)
+            {
+               if (tmp.mVerbose)
+               {
+                  AiMsgInfo("[volume_field3d] Use cached frame: %s", tmp.mPath.c_str());
+               }
+               
+               tmp.swapFrame(*cached);
+               delete cached;
+               
+               if (tmp.mProgressive && !tmp.mBoundsOnly)
+               {
+                  // for the layers the cached frame didn't read
+                  tmp.loadProxies();
+               }
+               
+               ready = true;
+            }
+            else
+            {
+               ready = tmp.setup();
+               
+               if (ready)
+               {
+                  tmp.reuseLayers(*this);
+               }
+            }
+            
+            if (ready)
             {
+               // previous fields go to tmp, make sure they aren't being read anymore
+               stopPreload();
+               
+               swapFrame(tmp);
                std::swap(mNode, tmp.mNode);
-               std::swap(mF3DFile, tmp.mF3DFile);
-               std::swap(mPath, tmp.mPath);
-               std::swap(mPartition, tmp.mPartition);
                std::swap(mIgnoreTransform, tmp.mIgnoreTransform);
                std::swap(mVerbose, tmp.mVerbose);
                std::swap(mFrame, tmp.mFrame);
@@ -1472,11 +8590,42 @@ public:
                std::swap(mChannelsMergeType, tmp.mChannelsMergeType);
                std::swap(mVelocityFields, tmp.mVelocityFields);
                std::swap(mChannelsMergeType, tmp.mChannelsMergeType);
-               std::swap(mFieldIndices, tmp.mFieldIndices);
-               std::swap(mFields, tmp.mFields);
+               std::swap(mLazyLoad, tmp.mLazyLoad);
+               std::swap(mRenderCache, tmp.mRenderCache);
+               std::swap(mSharedCache, tmp.mSharedCache);
+               std::swap(mStageDir, tmp.mStageDir);
+               std::swap(mStageSize, tmp.mStageSize);
+               std::swap(mArena, tmp.mArena);
+               std::swap(mHugePages, tmp.mHugePages);
+               std::swap(mMemoryLimit, tmp.mMemoryLimit);
+               std::swap(mSequentialRead, tmp.mSequentialRead);
+               std::swap(mBoundsOnly, tmp.mBoundsOnly);
+               std::swap(mLoadThreads, tmp.mLoadThreads);
+               std::swap(mIOThreads, tmp.mIOThreads);
+               std::swap(mPreload, tmp.mPreload);
+               std::swap(mProgressive, tmp.mProgressive);
+               std::swap(mFrameCacheSize, tmp.mFrameCacheSize);
+               std::swap(mFrameCacheMemory, tmp.mFrameCacheMemory);
+               std::swap(mPrefetch, tmp.mPrefetch);
+               std::swap(mDownsample, tmp.mDownsample);
+               std::swap(mMipmap, tmp.mMipmap);
+               std::swap(mDenseToSparse, tmp.mDenseToSparse);
+               std::swap(mBricked, tmp.mBricked);
+               std::swap(mChannelsPrecision, tmp.mChannelsPrecision);
+               std::swap(mCompress, tmp.mCompress);
+               std::swap(mPathPattern, tmp.mPathPattern);
                
                setupVelocityFields();
                
+               // cached frames may have been set up with another -ignoreXform
+               buildFieldGrid();
+               
+               // tmp now holds the previous frame
+               cacheFrame(tmp);
+               
+               startPreload();
+               startPrefetch();
+               
                rv = true;
             }
             else
@@ -1493,6 +8642,241 @@ public:
       return rv;
    }
    
+   // Grab layers already read by another volume (i.e. when only the partition changed)
+   // Layers data is shared through FieldCache, layers still to be read are those whose
+   // key changed (different file, or file modified on disk)
+   void reuseLayers(VolumeData &prev)
+   {
+      std::map<std::string, LayerData*> prevLayers;
+      size_t reused = 0;
+      size_t pending = 0;
+      
+      for (size_t i=0; i<prev.mLayers.size(); ++i)
+      {
+         LayerData *ld = prev.mLayers[i];
+         
+         if (ld->loaded.get() != 0)
+         {
+            prevLayers[ld->key] = ld;
+         }
+      }
+      
+      for (size_t i=0; i<mLayers.size(); ++i)
+      {
+         LayerData *ld = mLayers[i];
+         
+         if (ld->loaded.get() != 0)
+         {
+            continue;
+         }
+         
+         if (prevLayers.find(ld->key) != prevLayers.end())
+         {
+            // no I/O involved, prev still holds a reference on shared data
+            loadLayer(*ld);
+            releaseProxy(*ld);
+            ++reused;
+         }
+         else
+         {
+            ++pending;
+         }
+      }
+      
+      if (mVerbose)
+      {
+         AiMsgInfo("[volume_field3d] %lu layer(s) reused from previous update, %lu not read yet", reused, pending);
+      }
+   }
+   
+   StoragePrecision channelPrecision(const std::string &channel) const
+   {
+      std::map<std::string, StoragePrecision>::const_iterator it = mChannelsPrecision.find(channel);
+      
+      if (it == mChannelsPrecision.end())
+      {
+         it = mChannelsPrecision.find("*");
+      }
+      
+      return (it != mChannelsPrecision.end() ? it->second : SP_native);
+   }
+   
+   // Settings altering fields once read
+   std::string processingKey() const
+   {
+      std::string key;
+      
+      if (mDownsample > 1)
+      {
+         char tmp[32];
+         sprintf(tmp, "|downsample%d", mDownsample);
+         key += tmp;
+      }
+      
+      if (mMipmap)
+      {
+         key += "|mipmap";
+      }
+      
+      if (mDenseToSparse)
+      {
+         key += "|sparse";
+      }
+      
+      if (mBricked)
+      {
+         key += "|bricked";
+      }
+      
+      for (std::map<std::string, StoragePrecision>::const_iterator it=mChannelsPrecision.begin(); it!=mChannelsPrecision.end(); ++it)
+      {
+         key += "|" + it->first + "=" + StoragePrecisionToString(it->second);
+      }
+      
+      if (mCompress)
+      {
+         key += "|compressed";
+      }
+      
+      return key;
+   }
+   
+   // Exchange file and fields data (a frame) with another volume
+   void swapFrame(VolumeData &rhs)
+   {
+      std::swap(mFiles, rhs.mFiles);
+      std::swap(mFileKey, rhs.mFileKey);
+      std::swap(mPath, rhs.mPath);
+      std::swap(mPartition, rhs.mPartition);
+      std::swap(mFieldIndices, rhs.mFieldIndices);
+      std::swap(mFields, rhs.mFields);
+      mFieldGrid.swap(rhs.mFieldGrid);
+      std::swap(mLayers, rhs.mLayers);
+   }
+   
+   // Approximate memory used by loaded fields
+   size_t memSize() const
+   {
+      size_t total = 0;
+      
+      for (size_t i=0; i<mFields.size(); ++i)
+      {
+         const FieldData &fd = mFields[i];
+         
+         if (fd.type != FT_unknown && fd.field)
+         {
+            total += size_t(fd.field->memSize());
+         }
+      }
+      
+      return total;
+   }
+   
+   void clearFrameCache()
+   {
+      for (size_t i=0; i<mFrameCache.size(); ++i)
+      {
+         delete mFrameCache[i];
+      }
+      mFrameCache.clear();
+   }
+   
+   // Keep previous frame's data around for later reuse
+   void cacheFrame(VolumeData &prev)
+   {
+      if (mFrameCacheSize <= 0 || prev.mFiles.empty())
+      {
+         return;
+      }
+      
+      VolumeData *vd = new VolumeData();
+      
+      vd->swapFrame(prev);
+      vd->mDownsample = prev.mDownsample;
+      vd->mMipmap = prev.mMipmap;
+      vd->mDenseToSparse = prev.mDenseToSparse;
+      vd->mBricked = prev.mBricked;
+      vd->mChannelsPrecision = prev.mChannelsPrecision;
+      vd->mCompress = prev.mCompress;
+      
+      if (mVerbose)
+      {
+         AiMsgInfo("[volume_field3d] Cache frame: %s (%.2f MB)", vd->mPath.c_str(), double(vd->memSize()) / (1024.0 * 1024.0));
+      }
+      
+      // most recently used first
+      mFrameCache.push_front(vd);
+      
+      trimFrameCache();
+   }
+   
+   // Remove least recently used frames until both frames count and memory limits are honored
+   void trimFrameCache()
+   {
+      // leave room for prefetched frames
+      while (mFrameCache.size() > size_t(std::max(0, mFrameCacheSize) + std::max(0, mPrefetch)))
+      {
+         delete mFrameCache.back();
+         mFrameCache.pop_back();
+      }
+      
+      if (mFrameCacheMemory > 0.0f)
+      {
+         size_t maxBytes = size_t(double(mFrameCacheMemory) * 1024.0 * 1024.0);
+         size_t total = 0;
+         
+         for (size_t i=0; i<mFrameCache.size(); ++i)
+         {
+            total += mFrameCache[i]->memSize();
+         }
+         
+         while (total > maxBytes && mFrameCache.size() > 0)
+         {
+            total -= mFrameCache.back()->memSize();
+            delete mFrameCache.back();
+            mFrameCache.pop_back();
+         }
+      }
+   }
+   
+   bool hasCachedFrame(const std::string &path, const std::string &partition, const std::string &processing) const
+   {
+      for (FrameCache::const_iterator it=mFrameCache.begin(); it!=mFrameCache.end(); ++it)
+      {
+         if ((*it)->mPath == path && (*it)->mPartition == partition && (*it)->processingKey() == processing)
+         {
+            return true;
+         }
+      }
+      
+      return false;
+   }
+   
+   // Returns a cached frame for the given path and partition, removing it from the cache.
+   // Frames whose file changed on disk are discarded.
+   VolumeData* popCachedFrame(const std::string &path, const std::string &partition, const std::string &processing)
+   {
+      for (FrameCache::iterator it=mFrameCache.begin(); it!=mFrameCache.end(); ++it)
+      {
+         VolumeData *vd = *it;
+         
+         if (vd->mPath == path && vd->mPartition == partition && vd->processingKey() == processing)
+         {
+            mFrameCache.erase(it);
+            
+            if (vd->mFileKey != FilesKey(path))
+            {
+               delete vd;
+               return 0;
+            }
+            
+            return vd;
+         }
+      }
+      
+      return 0;
+   }
+   
    void computeBounds(AtBBox &outBox, float &autoStep)
    {
       Field3D::Box3d bbox;
@@ -1505,42 +8889,44 @@ public:
       {
          FieldData &fd = mFields[i];
          
-         if (!fd.base)
+         if (!fd.base || fd.unsupported)
          {
             continue;
          }
          
-         Field3D::V3i res = fd.base->dataResolution();
+         Field3D::V3i res;
+         
+         if (fd.layer && fd.layer->loaded.load() != 0 && fd.field)
+         {
+            res = fd.field->dataResolution();
+         }
+         else
+         {
+            res = fd.base->dataResolution();
+            
+            // match the resolution of the fields to be loaded (all field classes,
+            // MAC fields included, are downsampled)
+            if (mDownsample > 1)
+            {
+               res.x = DownsampledResolution(res.x, mDownsample);
+               res.y = DownsampledResolution(res.y, mDownsample);
+               res.z = DownsampledResolution(res.z, mDownsample);
+            }
+         }
          
-         Field3D::V3d bmin(0.0, 0.0, 0.0);
-         Field3D::V3d bmax(1.0, 1.0, 1.0);
          Field3D::V3d lstep(1.0 / double(res.x),
                             1.0 / double(res.y),
                             1.0 / double(res.z));
          Field3D::V3d step, corner;
          Field3D::Box3d b;
          
+         fieldBounds(fd, b);
+         
          if (!mIgnoreTransform)
          {
-            fd.base->mapping()->localToWorld(bmax, corner);
-            b.extendBy(corner);
-            fd.base->mapping()->localToWorld(Field3D::V3d(1.0, 1.0, 0.0), corner);
-            b.extendBy(corner);
-            fd.base->mapping()->localToWorld(Field3D::V3d(1.0, 0.0, 1.0), corner);
-            b.extendBy(corner);
-            fd.base->mapping()->localToWorld(Field3D::V3d(1.0, 0.0, 0.0), corner);
-            b.extendBy(corner);
-            fd.base->mapping()->localToWorld(Field3D::V3d(0.0, 1.0, 1.0), corner);
-            b.extendBy(corner);
-            fd.base->mapping()->localToWorld(Field3D::V3d(0.0, 1.0, 0.0), corner);
-            b.extendBy(corner);
-            fd.base->mapping()->localToWorld(Field3D::V3d(0.0, 0.0, 1.0), corner);
-            b.extendBy(corner);
-            fd.base->mapping()->localToWorld(bmin, corner);
-            b.extendBy(corner);
-            
             // Notes: - corner is the origin (0, 0, 0) in world space
             //        - localToWorld is transforming its input as a point, not a vector
+            fd.base->mapping()->localToWorld(Field3D::V3d(0.0, 0.0, 0.0), corner);
             fd.base->mapping()->localToWorld(lstep, step);
             
             step.x = fabs(step.x - corner.x);
@@ -1549,9 +8935,6 @@ public:
          }
          else
          {
-            b.min = bmin;
-            b.max = bmax;
-            
             step = lstep;
          }
          
@@ -1620,15 +9003,20 @@ public:
       AiMsgDebug("[volume_field3d]   Range: %f -> %f", t0, t1);
       #endif
       
-      for (size_t i=0; i<mFields.size(); ++i)
+      // only the fields whose bounds the ray segment crosses
+      std::vector<size_t> candidates;
+      
+      mFieldGrid.find(wray.pos, wray.dir, double(t0), double(t1), candidates);
+      
+      for (size_t i=0; i<candidates.size(); ++i)
       {
-         FieldData &fd = mFields[i];
+         FieldData &fd = mFields[candidates[i]];
          
          #ifdef _DEBUG
          AiMsgDebug("[volume_field3d]   Process field %s.%s[%lu]", fd.partition.c_str(), fd.name.c_str(), fd.partitionIndex);
          #endif
          
-         if (!fd.base)
+         if (!fd.base || fd.unsupported)
          {
             #ifdef _DEBUG
             AiMsgDebug("[volume_field3d]     Skip invalid field");
@@ -1854,6 +9242,9 @@ public:
       
       int hitCount = 0;
       
+      // shading point footprint (object space), for MIP level selection
+      double footprint = -1.0;
+      
       size_t nvf = mVelocityFields.size();
       float vscl = secondsFromFrame(sg->time) * mVelocityScale;
       bool ignoreMb = ((fabsf(vscl) < AI_EPSILON) || (nvf != 1 && nvf != 3));
@@ -1871,53 +9262,76 @@ public:
             AiMsgWarning("[volume_field3d] No field indices for channel \"%s\"", channel);
          }
          
-         for (size_t i=0; i<indices.size(); ++i)
+         // field world space shading point (== arnold object space point)
+         Field3D::V3d Pw(sg->Po.x, sg->Po.y, sg->Po.z);
+         
+         // fields (of all channels) whose bounds contain the shading point
+         const size_t *cbegin = 0;
+         const size_t *cend = 0;
+         
+         mFieldGrid.find(Pw, cbegin, cend);
+         
+         for (const size_t *c=cbegin; c<cend; ++c)
          {
-            FieldData &fd = mFields[indices[i]];
+            // channel indices are sorted, fields being added in order
+            if (!std::binary_search(indices.begin(), indices.end(), *c))
+            {
+               continue;
+            }
+            
+            FieldData &fd = mFields[*c];
             
-            if (fd.base)
+            if (!fd.unsupported)
             {
                #ifdef _DEBUG
                AiMsgDebug("[volume_field3d] Sample field %s.%s[%lu]", fd.partition.c_str(), fd.name.c_str(), fd.partitionIndex);
                #endif
                
-               // field world space shading point (== arnold object space point)
-               Field3D::V3d Pw(sg->Po.x, sg->Po.y, sg->Po.z);
                // field local space shading point
                Field3D::V3d Pl;
                // field voxel space shading point
                Field3D::V3d Pv;
                
+               // Bounds are tested with the field header, voxel data is only read for fields actually hit
                if (mIgnoreTransform)
                {
                   Pl = Pw;
-                  fd.base->mapping()->localToVoxel(Pw, Pv);
                }
                else
                {
                   fd.base->mapping()->worldToLocal(Pw, Pl);
-                  fd.base->mapping()->worldToVoxel(Pw, Pv);
                }
                
-               if (unitCube.intersects(Pl))
+               FieldData *lfd = (unitCube.intersects(Pl) ? ensureLoaded(fd) : 0);
+               
+               if (lfd)
                {
+                  // loaded field resolution may differ from the header's (i.e. -downsample, proxy)
+                  lfd->field->mapping()->localToVoxel(Pl, Pv);
+                  
                   if (!ignoreMb)
                   {
                      Field3D::V3d V(0, 0, 0);
                      
                      AtByte vtype = AI_TYPE_UNDEFINED;
                      AtParamValue vvalue;
+                     // velocity fields voxel space shading point
+                     Field3D::V3d Pvv;
                      
                      if (nvf == 1)
                      {
-                        if (!fd.velocityField[0] || !fd.velocityField[0]->isVector)
+                        FieldData *vfd = ((fd.velocityField[0] && fd.velocityField[0]->isVector) ? ensureLoaded(*fd.velocityField[0]) : 0);
+                        
+                        if (!vfd)
                         {
                            AiMsgWarning("[volume_field3d] Cannot use specified velocity vector field");
                         }
                         else
                         {
+                           vfd->field->mapping()->localToVoxel(Pl, Pvv);
+                           
                            // read a single VECTOR field
-                           if (fd.velocityField[0]->sample(Pv, interp, SMT_average, &vvalue, &vtype) && vtype == AI_TYPE_VECTOR)
+                           if (vfd->sample(Pvv, interp, sg->tid, SMT_average, &vvalue, &vtype) && vtype == AI_TYPE_VECTOR)
                            {
                               V.x = vvalue.VEC.x;
                               V.y = vvalue.VEC.y;
@@ -1931,15 +9345,25 @@ public:
                      }
                      else
                      {
-                        if (!fd.velocityField[0] || fd.velocityField[0]->isVector ||
-                            !fd.velocityField[1] || fd.velocityField[1]->isVector ||
-                            !fd.velocityField[2] || fd.velocityField[2]->isVector)
+                        FieldData *vfd[3] = {0, 0, 0};
+                        
+                        for (int a=0; a<3; ++a)
+                        {
+                           if (fd.velocityField[a] && !fd.velocityField[a]->isVector)
+                           {
+                              vfd[a] = ensureLoaded(*fd.velocityField[a]);
+                           }
+                        }
+                        
+                        if (!vfd[0] || !vfd[1] || !vfd[2])
                         {
                            AiMsgWarning("[volume_field3d] Cannot use specified velocity scalar fields");
                         }
                         else
                         {
-                           if (fd.velocityField[0]->sample(Pv, interp, SMT_average, &vvalue, &vtype) && vtype == AI_TYPE_FLOAT)
+                           vfd[0]->field->mapping()->localToVoxel(Pl, Pvv);
+                           
+                           if (vfd[0]->sample(Pvv, interp, sg->tid, SMT_average, &vvalue, &vtype) && vtype == AI_TYPE_FLOAT)
                            {
                               V.x = vvalue.FLT;
                            }
@@ -1947,7 +9371,10 @@ public:
                            {
                               AiMsgWarning("[volume_field3d] Could not sample velocity X scalar field");
                            }
-                           if (fd.velocityField[1]->sample(Pv, interp, SMT_average, &vvalue, &vtype) && vtype == AI_TYPE_FLOAT)
+                           
+                           vfd[1]->field->mapping()->localToVoxel(Pl, Pvv);
+                           
+                           if (vfd[1]->sample(Pvv, interp, sg->tid, SMT_average, &vvalue, &vtype) && vtype == AI_TYPE_FLOAT)
                            {
                               V.y = vvalue.FLT;
                            }
@@ -1955,7 +9382,10 @@ public:
                            {
                               AiMsgWarning("[volume_field3d] Could not sample velocity Y scalar field");
                            }
-                           if (fd.velocityField[2]->sample(Pv, interp, SMT_average, &vvalue, &vtype) && vtype == AI_TYPE_FLOAT)
+                           
+                           vfd[2]->field->mapping()->localToVoxel(Pl, Pvv);
+                           
+                           if (vfd[2]->sample(Pvv, interp, sg->tid, SMT_average, &vvalue, &vtype) && vtype == AI_TYPE_FLOAT)
                            {
                               V.z = vvalue.FLT;
                            }
@@ -1996,583 +9426,1574 @@ public:
                      //Pl.y = std::min(std::max(0.0, Pl.y), 1.0);
                      //Pl.z = std::min(std::max(0.0, Pl.z), 1.0);
                      
-                     fd.base->mapping()->localToVoxel(Pl, Pv);
+                     lfd->field->mapping()->localToVoxel(Pl, Pv);
                   }
                   
                   mtit = mChannelsMergeType.find(fd.name);
                   mergeType = (mtit != mChannelsMergeType.end() ? mtit->second : SMT_add);
                   
-                  if (fd.sample(Pv, interp, mergeType, value, type))
+                  FieldData *sfd = lfd;
+                  
+                  if (lfd->levels.size() > 0)
+                  {
+                     if (footprint < 0.0)
+                     {
+                        footprint = shadingFootprint(sg);
+                     }
+                     
+                     sfd = lfd->level(footprint, mIgnoreTransform);
+                     
+                     if (sfd != lfd)
+                     {
+                        // levels share local space
+                        sfd->field->mapping()->localToVoxel(Pl, Pv);
+                     }
+                  }
+                  
+                  if (sfd->sample(Pv, interp, sg->tid, mergeType, value, type))
                   {
                      ++hitCount;
                   }
                }
                else
                {
-                  // Not inside volume. Set a default value?
+                  // Not inside volume (or voxel data not available yet). Set a default value?
+               }
+            }
+         }
+      }
+      else
+      {
+         AiMsgWarning("[volume_field3d] No channel \"%s\" in file \"%s\"", channel, mPath.c_str());
+      }
+      
+      if (hitCount > 1 && mergeType == SMT_average)
+      {
+         // averaging results
+         float scl = 1.0f / float(hitCount);
+         
+         if (*type == AI_TYPE_FLOAT)
+         {
+            value->FLT *= scl;
+         }
+         else if (*type == AI_TYPE_VECTOR)
+         {
+            value->VEC.x *= scl;
+            value->VEC.y *= scl;
+            value->VEC.z *= scl;
+         }
+      }
+      
+      return (hitCount > 0);
+   }
+
+private:
+   
+   // Largest of the ray differentials lengths, in object space
+   double shadingFootprint(const AtShaderGlobals *sg) const
+   {
+      AtVector dx, dy;
+      
+      AiM4VectorByMatrixMult(&dx, sg->Minv, &(sg->dPdx));
+      AiM4VectorByMatrixMult(&dy, sg->Minv, &(sg->dPdy));
+      
+      double lx = sqrt(double(dx.x) * dx.x + double(dx.y) * dx.y + double(dx.z) * dx.z);
+      double ly = sqrt(double(dy.x) * dy.x + double(dy.y) * dy.y + double(dy.z) * dy.z);
+      
+      return std::max(lx, ly);
+   }
+   
+   // Object space bounds of a field's unit cube (empty for invalid fields)
+   void fieldBounds(const FieldData &fd, Field3D::Box3d &b) const
+   {
+      b.makeEmpty();
+      
+      if (!fd.base)
+      {
+         return;
+      }
+      
+      if (mIgnoreTransform)
+      {
+         b.min = Field3D::V3d(0.0, 0.0, 0.0);
+         b.max = Field3D::V3d(1.0, 1.0, 1.0);
+         return;
+      }
+      
+      Field3D::V3d corner;
+      
+      for (int i=0; i<8; ++i)
+      {
+         fd.base->mapping()->localToWorld(Field3D::V3d((i & 1) ? 1.0 : 0.0, (i & 2) ? 1.0 : 0.0, (i & 4) ? 1.0 : 0.0), corner);
+         b.extendBy(corner);
+      }
+   }
+   
+   void buildFieldGrid()
+   {
+      std::vector<Field3D::Box3d> bounds(mFields.size());
+      
+      for (size_t i=0; i<mFields.size(); ++i)
+      {
+         fieldBounds(mFields[i], bounds[i]);
+      }
+      
+      mFieldGrid.build(bounds);
+   }
+   
+   float shutterFrame(float shutterTime)
+   {
+      float sf = mFrame;
+      
+      if (mShutterTimeType == STT_normalized)
+      {
+         if (mMotionEndFrame > mMotionStartFrame)
+         {
+            sf = mFrame + mMotionStartFrame + shutterTime * (mMotionEndFrame - mMotionStartFrame);
+         }
+      }
+      else if (mShutterTimeType == STT_frame_relative)
+      {
+         sf = mFrame + shutterTime;
+      }
+      else if (mShutterTimeType == STT_absolute_frame)
+      {
+         sf = shutterTime;
+      }
+      
+      return sf;
+   }
+   
+   float secondsFromFrame(float shutterTime)
+   {
+      return (shutterFrame(shutterTime) - mFrame) / mFPS;
+   }
+   
+   template <typename DataType>
+   void addFields(FileData &file, const std::string &filePartition, const std::string &layer, bool isVector,
+                  typename Field3D::EmptyField<DataType>::Vec &fields, 
+                  size_t &partitionFieldCount, size_t &globalFieldCount)
+   {
+      // channel names use the file prefixed partition name
+      std::string partition = file.prefix + filePartition;
+      size_t maxlen = partition.length() + layer.length() + 32;
+      char *tmp = (char*) AiMalloc(maxlen * sizeof(char));
+      
+      std::string key = file.key + "|" + filePartition + "|" + layer + (isVector ? "|vector" : "|scalar") + processingKey();
+      
+      LayerData *ld = new LayerData(&file, filePartition, layer, isVector, key);
+      
+      for (size_t i=0; i<fields.size(); ++i)
+      {
+         FieldData fd;
+         
+         fd.partition = partition;
+         fd.name = layer;
+         fd.setup(fields[i], isVector, ld);
+         
+         fd.partitionIndex = partitionFieldCount++;
+         fd.globalIndex = globalFieldCount++;
+         
+         if (mVerbose)
+         {
+            AiMsgInfo("[volume_field3d] Add %s channel '%s.%s[%lu]'", isVector ? "vector" : "scalar", partition.c_str(), layer.c_str(), fd.partitionIndex);
+            AiMsgInfo("[volume_field3d]   also accessible as: '%s.%s', '%s[%lu]' and '%s'", partition.c_str(), layer.c_str(), layer.c_str(), fd.globalIndex, layer.c_str());
+         }
+         
+         { // partition.field[index]
+            sprintf(tmp, "%s.%s[%lu]", partition.c_str(), layer.c_str(), fd.partitionIndex);
+            std::vector<size_t> &indices = mFieldIndices[tmp];
+            indices.push_back(mFields.size());
+         }
+         
+         { // partition.field
+            sprintf(tmp, "%s.%s", partition.c_str(), layer.c_str());
+            std::vector<size_t> &indices = mFieldIndices[tmp];
+            indices.push_back(mFields.size());
+         }
+         
+         { // field[index]
+            sprintf(tmp, "%s[%lu]", layer.c_str(), fd.globalIndex);
+            std::vector<size_t> &indices = mFieldIndices[tmp];
+            indices.push_back(mFields.size());
+         }
+         
+         { // field
+            sprintf(tmp, "%s", layer.c_str());
+            std::vector<size_t> &indices = mFieldIndices[tmp];
+            indices.push_back(mFields.size());
+         }
+         
+         ld->fields.push_back(mFields.size());
+         
+         mFields.push_back(fd);
+      }
+      
+      mLayers.push_back(ld);
+      
+      AiFree(tmp);
+   }
+   
+   // Field3D returns the fields of a layer grouped by bit depth, the layer headers
+   // are in file order. A field is bound to the first header left with the same
+   // extents, data window and mapping (fields whose headers only differ by their
+   // bit depth are interchangeable).
+   template <typename DataType>
+   void bindHeaders(const LayerData &layer, const typename Field3D::Field<DataType>::Vec &fields,
+                    std::vector<bool> &bound, std::vector<size_t> &indices)
+   {
+      for (size_t i=0; i<fields.size(); ++i)
+      {
+         size_t index = layer.fields.size();
+         size_t first = layer.fields.size();
+         
+         for (size_t j=0; j<layer.fields.size(); ++j)
+         {
+            const FieldData &fd = mFields[layer.fields[j]];
+            
+            if (bound[j] || !fd.base)
+            {
+               continue;
+            }
+            
+            if (first == layer.fields.size())
+            {
+               first = j;
+            }
+            
+            if (fd.base->extents() == fields[i]->extents() &&
+                fd.base->dataWindow() == fields[i]->dataWindow() &&
+                fd.base->mapping()->isIdentical(fields[i]->mapping()))
+            {
+               index = j;
+               break;
+            }
+         }
+         
+         if (index == layer.fields.size())
+         {
+            index = first;
+         }
+         
+         if (index < bound.size())
+         {
+            bound[index] = true;
+         }
+         
+         indices.push_back(index);
+      }
+   }
+   
+   // 'offset' is the index of fields[0] in the shared layer fields (see SharedLayer::headerIndices)
+   template <typename DataType>
+   void loadFields(LayerData &layer, FieldDataType dataType,
+                   const typename Field3D::Field<DataType>::Vec &fields,
+                   const MipLevels &mipLevels, const std::vector<size_t> &headerIndices,
+                   size_t &offset, size_t &count)
+   {
+      for (size_t i=0; i<fields.size(); ++i, ++offset)
+      {
+         size_t index = (offset < headerIndices.size() ? headerIndices[offset] : offset);
+         
+         if (index >= layer.fields.size())
+         {
+            continue;
+         }
+         
+         FieldData &fd = mFields[layer.fields[index]];
+         
+         if (fd.type == FT_unknown && fd.load(fields[i], dataType))
+         {
+            MipLevels::const_iterator it = mipLevels.find(fields[i].get());
+            
+            if (it != mipLevels.end())
+            {
+               for (size_t l=0; l<it->second.size(); ++l)
+               {
+                  layer.levels.push_back(FieldData());
+                  
+                  FieldData &lfd = layer.levels.back();
+                  
+                  lfd.setup(it->second[l], fd.isVector, &layer);
+                  
+                  if (!lfd.load(it->second[l], dataType))
+                  {
+                     layer.levels.pop_back();
+                     break;
+                  }
+                  
+                  fd.levels.push_back(&lfd);
+               }
+            }
+            
+            ++count;
+         }
+      }
+   }
+   
+   template <typename DataType>
+   void loadProxyFields(LayerData &layer, FieldDataType dataType,
+                        const typename Field3D::Field<DataType>::Vec &fields,
+                        const std::vector<size_t> &headerIndices, size_t &offset)
+   {
+      for (size_t i=0; i<fields.size(); ++i, ++offset)
+      {
+         size_t index = (offset < headerIndices.size() ? headerIndices[offset] : offset);
+         
+         if (index >= layer.fields.size())
+         {
+            continue;
+         }
+         
+         FieldData &fd = mFields[layer.fields[index]];
+         
+         if (fd.proxy)
+         {
+            continue;
+         }
+         
+         layer.proxies.push_back(FieldData());
+         
+         FieldData &pfd = layer.proxies.back();
+         
+         pfd.setup(fields[i], fd.isVector, 0);
+         
+         if (!pfd.load(fields[i], dataType))
+         {
+            layer.proxies.pop_back();
+            continue;
+         }
+         
+         fd.proxy = &pfd;
+      }
+   }
+   
+   void stripString(std::string &s)
+   {
+      size_t p = s.find_first_not_of(" \t\n");
+      
+      if (p == std::string::npos)
+      {
+         s = "";
+         return;
+      }
+      
+      s = s.substr(p);
+      
+      p = s.find_last_not_of(" \t\n");
+      
+      if (p != std::string::npos)
+      {
+         s = s.substr(0, p+1);
+      }
+   }
+   
+   size_t splitString(const std::string &in, char sep, bool strip, std::vector<std::string> &out)
+   {
+      out.clear();
+      
+      std::string tmp;
+      size_t p0 = 0;
+      size_t p1 = in.find(sep, p0);
+      
+      while (p1 != std::string::npos)
+      {
+         tmp = in.substr(p0, p1 - p0);
+         
+         if (strip)
+         {
+            stripString(tmp);
+         }
+         
+         if (tmp.length() > 0)
+         {
+            out.push_back(tmp);
+         }
+         
+         p0 = p1 + 1;
+         p1 = in.find(sep, p0);
+      }
+      
+      tmp = in.substr(p0);
+      
+      if (strip)
+      {
+         stripString(tmp);
+      }
+      
+      if (tmp.length() > 0)
+      {
+         out.push_back(tmp);
+      }
+      
+      return out.size();
+   }
+   
+   size_t splitParamString(const std::string &in, std::vector<std::string> &out)
+   {
+      static const char *sSplitChars = " \t\n";
+      
+      out.clear();
+      
+      std::string tmp;
+      std::string part;
+      bool inquotes = false;
+      
+      size_t p0 = in.find_first_not_of(sSplitChars);
+      
+      if (p0 == std::string::npos)
+      {
+         return 0;
+      }
+      
+      size_t p1 = in.find_first_of(sSplitChars, p0);
+      size_t p2;
+      
+      while (p1 != std::string::npos)
+      {
+         tmp = in.substr(p0, p1 - p0);
+         
+         if (tmp.length() > 0)
+         {
+            if (inquotes)
+            {
+               if (tmp[tmp.length()-1] != '"')
+               {
+                  part = part + " " + tmp;
+               }
+               else
+               {
+                  out.push_back(part + tmp.substr(0, tmp.length() - 1));
+                  inquotes = false;
                }
             }
             else
             {
-               AiMsgWarning("[volume_field3d] Invalid field %s.%s[%lu]", fd.partition.c_str(), fd.name.c_str(), fd.partitionIndex);
+               if (tmp[0] == '"' && tmp[tmp.length()-1] != '"')
+               {
+                  part = tmp;
+                  inquotes = true;
+               }
+               else
+               {
+                  out.push_back(tmp);
+               }
             }
          }
-      }
-      else
-      {
-         AiMsgWarning("[volume_field3d] No channel \"%s\" in file \"%s\"", channel, mPath.c_str());
+         
+         p2 = in.find_first_not_of(sSplitChars, p1);
+         
+         // also keep white spaces if we're inside a quoted string
+         if (inquotes && p2 != std::string::npos)
+         {
+            part += in.substr(p1, p2 - p1);
+         }
+         
+         p0 = p2;
+         p1 = in.find_first_of(sSplitChars, p0);
       }
       
-      if (hitCount > 1 && mergeType == SMT_average)
+      if (p0 != std::string::npos)
       {
-         // averaging results
-         float scl = 1.0f / float(hitCount);
+         tmp = in.substr(p0);
          
-         if (*type == AI_TYPE_FLOAT)
-         {
-            value->FLT *= scl;
-         }
-         else if (*type == AI_TYPE_VECTOR)
+         if (tmp.length() > 0)
          {
-            value->VEC.x *= scl;
-            value->VEC.y *= scl;
-            value->VEC.z *= scl;
+            if (inquotes)
+            {
+               if (tmp[tmp.length()-1] != '"')
+               {
+                  AiMsgWarning("[volume_field3d] Unterminated string argument");
+                  out.push_back(part + tmp);
+               }
+               else
+               {
+                  out.push_back(part + tmp.substr(0, tmp.length() - 1));
+               }
+            }
+            else
+            {
+               out.push_back(tmp);
+            }
          }
       }
       
-      return (hitCount > 0);
+      return out.size();
    }
-
-private:
    
-   float shutterFrame(float shutterTime)
+   bool readBoolUserAttr(const AtNode *node, const char *paramName, bool &out)
    {
-      float sf = mFrame;
+      const AtUserParamEntry *param = AiNodeLookUpUserParameter(node, paramName);
       
-      if (mShutterTimeType == STT_normalized)
+      if (param && AiUserParamGetCategory(param) == AI_USERDEF_CONSTANT)
       {
-         if (mMotionEndFrame > mMotionStartFrame)
+         int ptype = AiUserParamGetType(param);
+         
+         switch (ptype)
          {
-            sf = mFrame + mMotionStartFrame + shutterTime * (mMotionEndFrame - mMotionStartFrame);
+         case AI_TYPE_BOOLEAN:
+            out = AiNodeGetBool(node, paramName);
+            break;
+         case AI_TYPE_BYTE:
+            out = (AiNodeGetByte(node, paramName) != 0);
+            break;
+         case AI_TYPE_INT:
+            out = (AiNodeGetInt(node, paramName) != 0);
+            break;
+         case AI_TYPE_UINT:
+            out = (AiNodeGetUInt(node, paramName) != 0);
+            break;
+         default:
+            return false;
          }
+         
+         return true;
       }
-      else if (mShutterTimeType == STT_frame_relative)
-      {
-         sf = mFrame + shutterTime;
-      }
-      else if (mShutterTimeType == STT_absolute_frame)
+      else
       {
-         sf = shutterTime;
+         return false;
       }
-      
-      return sf;
-   }
-   
-   float secondsFromFrame(float shutterTime)
-   {
-      return (shutterFrame(shutterTime) - mFrame) / mFPS;
    }
    
-   template <typename DataType>
-   void addFields(const std::string &partition, const std::string &layer,
-                  FieldDataType dataType, bool isVector,
-                  typename Field3D::Field<DataType>::Vec &fields, 
-                  size_t &partitionFieldCount, size_t &globalFieldCount)
+   bool readFloatUserAttr(const AtNode *node, const char *paramName, float &out)
    {
-      size_t maxlen = partition.length() + layer.length() + 32;
-      char *tmp = (char*) AiMalloc(maxlen * sizeof(char));
+      const AtUserParamEntry *param = AiNodeLookUpUserParameter(node, paramName);
       
-      for (size_t i=0; i<fields.size(); ++i)
+      if (param && AiUserParamGetCategory(param) == AI_USERDEF_CONSTANT)
       {
-         FieldData fd;
-         
-         fd.partition = partition;
-         fd.name = layer;
+         int ptype = AiUserParamGetType(param);
          
-         if (!fd.setup(fields[i], dataType, isVector))
+         switch (ptype)
          {
-            continue;
+         case AI_TYPE_BYTE:
+            out = float(AiNodeGetByte(node, paramName));
+            break;
+         case AI_TYPE_INT:
+            out = float(AiNodeGetInt(node, paramName));
+            break;
+         case AI_TYPE_UINT:
+            out = float(AiNodeGetUInt(node, paramName));
+            break;
+         case AI_TYPE_FLOAT:
+            out = AiNodeGetFlt(node, paramName);
+            break;
+         default:
+            return false;
          }
          
-         fd.partitionIndex = partitionFieldCount++;
-         fd.globalIndex = globalFieldCount++;
+         return true;
+      }
+      else
+      {
+         return false;
+      }
+   }
+   
+   bool readIntUserAttr(const AtNode *node, const char *paramName, int &out)
+   {
+      const AtUserParamEntry *param = AiNodeLookUpUserParameter(node, paramName);
+      
+      if (param && AiUserParamGetCategory(param) == AI_USERDEF_CONSTANT)
+      {
+         int ptype = AiUserParamGetType(param);
          
-         if (mVerbose)
+         switch (ptype)
          {
-            AiMsgInfo("[volume_field3d] Add %s channel '%s.%s[%lu]'", isVector ? "vector" : "scalar", partition.c_str(), layer.c_str(), fd.partitionIndex);
-            AiMsgInfo("[volume_field3d]   also accessible as: '%s.%s', '%s[%lu]' and '%s'", partition.c_str(), layer.c_str(), layer.c_str(), fd.globalIndex, layer.c_str());
-         }
-         
-         { // partition.field[index]
-            sprintf(tmp, "%s.%s[%lu]", partition.c_str(), layer.c_str(), fd.partitionIndex);
-            std::vector<size_t> &indices = mFieldIndices[tmp];
-            indices.push_back(mFields.size());
-         }
-         
-         { // partition.field
-            sprintf(tmp, "%s.%s", partition.c_str(), layer.c_str());
-            std::vector<size_t> &indices = mFieldIndices[tmp];
-            indices.push_back(mFields.size());
-         }
-         
-         { // field[index]
-            sprintf(tmp, "%s[%lu]", layer.c_str(), fd.globalIndex);
-            std::vector<size_t> &indices = mFieldIndices[tmp];
-            indices.push_back(mFields.size());
-         }
-         
-         { // field
-            sprintf(tmp, "%s", layer.c_str());
-            std::vector<size_t> &indices = mFieldIndices[tmp];
-            indices.push_back(mFields.size());
+         case AI_TYPE_BYTE:
+            out = int(AiNodeGetByte(node, paramName));
+            break;
+         case AI_TYPE_INT:
+            out = AiNodeGetInt(node, paramName);
+            break;
+         case AI_TYPE_UINT:
+            out = int(AiNodeGetUInt(node, paramName));
+            break;
+         default:
+            return false;
          }
          
-         mFields.push_back(fd);
+         return true;
+      }
+      else
+      {
+         return false;
       }
-      
-      AiFree(tmp);
    }
    
-   void stripString(std::string &s)
+   bool readStringUserAttr(const AtNode *node, const char *paramName, std::string &out)
    {
-      size_t p = s.find_first_not_of(" \t\n");
+      const AtUserParamEntry *param = AiNodeLookUpUserParameter(node, paramName);
       
-      if (p == std::string::npos)
+      if (param && AiUserParamGetCategory(param) == AI_USERDEF_CONSTANT && AiUserParamGetType(param) == AI_TYPE_STRING)
       {
-         s = "";
-         return;
+         out = AiNodeGetStr(node, paramName);
+         return true;
       }
-      
-      s = s.substr(p);
-      
-      p = s.find_last_not_of(" \t\n");
-      
-      if (p != std::string::npos)
+      else
       {
-         s = s.substr(0, p+1);
+         return false;
       }
    }
    
-   size_t splitString(const std::string &in, char sep, bool strip, std::vector<std::string> &out)
+   bool readStringArrayUserAttr(const AtNode *node, const char *paramName, char sep, bool strip, std::vector<std::string> &out)
    {
-      out.clear();
-      
-      std::string tmp;
-      size_t p0 = 0;
-      size_t p1 = in.find(sep, p0);
+      const AtUserParamEntry *param = AiNodeLookUpUserParameter(node, paramName);
       
-      while (p1 != std::string::npos)
+      if (param && AiUserParamGetCategory(param) == AI_USERDEF_CONSTANT)
       {
-         tmp = in.substr(p0, p1 - p0);
+         std::string tmp;
          
-         if (strip)
+         if (AiUserParamGetType(param) == AI_TYPE_ARRAY && AiUserParamGetArrayType(param) == AI_TYPE_STRING)
          {
-            stripString(tmp);
+            out.clear();
+            
+            AtArray *ary = AiNodeGetArray(node, paramName);
+            
+            for (unsigned int i=0; i<ary->nelements; ++i)
+            {
+               tmp = AiArrayGetStr(ary, i);
+               
+               if (strip)
+               {
+                  stripString(tmp);
+               }
+               
+               out.push_back(tmp);
+            }
+            
+            return true;
          }
-         
-         if (tmp.length() > 0)
+         else if (AiUserParamGetType(param) == AI_TYPE_STRING)
          {
-            out.push_back(tmp);
+            tmp = AiNodeGetStr(node, paramName);
+            
+            splitString(tmp, sep, strip, out);
+            
+            return true;
+         }
+         else
+         {
+            return false;
          }
-         
-         p0 = p1 + 1;
-         p1 = in.find(sep, p0);
-      }
-      
-      tmp = in.substr(p0);
-      
-      if (strip)
-      {
-         stripString(tmp);
       }
-      
-      if (tmp.length() > 0)
+      else
       {
-         out.push_back(tmp);
+         return false;
       }
-      
-      return out.size();
    }
    
-   size_t splitParamString(const std::string &in, std::vector<std::string> &out)
+private:
+   
+   class LoadLayersTask : public ParallelTask
    {
-      static const char *sSplitChars = " \t\n";
-      
-      out.clear();
-      
-      std::string tmp;
-      std::string part;
-      bool inquotes = false;
+   public:
       
-      size_t p0 = in.find_first_not_of(sSplitChars);
-      
-      if (p0 == std::string::npos)
+      LoadLayersTask(VolumeData *vd, const std::vector<size_t> &order, bool proxies)
+         : mVolume(vd)
+         , mOrder(order)
+         , mProxies(proxies)
       {
-         return 0;
       }
       
-      size_t p1 = in.find_first_of(sSplitChars, p0);
-      size_t p2;
-      
-      while (p1 != std::string::npos)
+      virtual void run(size_t index)
       {
-         tmp = in.substr(p0, p1 - p0);
-         
-         if (tmp.length() > 0)
+         if (mVolume->mCancelLoad.get() == 0)
          {
-            if (inquotes)
+            LayerData &layer = *(mVolume->mLayers[mOrder[index]]);
+            
+            if (mProxies)
             {
-               if (tmp[tmp.length()-1] != '"')
-               {
-                  part = part + " " + tmp;
-               }
-               else
-               {
-                  out.push_back(part + tmp.substr(0, tmp.length() - 1));
-                  inquotes = false;
-               }
+               mVolume->loadProxy(layer);
+            }
+            else if (mVolume->mProgressive)
+            {
+               mVolume->readLayer(layer);
             }
             else
             {
-               if (tmp[0] == '"' && tmp[tmp.length()-1] != '"')
-               {
-                  part = tmp;
-                  inquotes = true;
-               }
-               else
-               {
-                  out.push_back(tmp);
-               }
+               mVolume->loadLayer(layer);
             }
          }
-         
-         p2 = in.find_first_not_of(sSplitChars, p1);
-         
-         // also keep white spaces if we're inside a quoted string
-         if (inquotes && p2 != std::string::npos)
-         {
-            part += in.substr(p1, p2 - p1);
-         }
-         
-         p0 = p2;
-         p1 = in.find_first_of(sSplitChars, p0);
       }
       
-      if (p0 != std::string::npos)
+   private:
+      
+      VolumeData *mVolume;
+      const std::vector<size_t> &mOrder;
+      bool mProxies;
+   };
+   
+   class OpenFilesTask : public ParallelTask
+   {
+   public:
+      
+      OpenFilesTask(VolumeData *vd)
+         : mVolume(vd)
       {
-         tmp = in.substr(p0);
-         
-         if (tmp.length() > 0)
-         {
-            if (inquotes)
-            {
-               if (tmp[tmp.length()-1] != '"')
-               {
-                  AiMsgWarning("[volume_field3d] Unterminated string argument");
-                  out.push_back(part + tmp);
-               }
-               else
-               {
-                  out.push_back(part + tmp.substr(0, tmp.length() - 1));
-               }
-            }
-            else
-            {
-               out.push_back(tmp);
-            }
-         }
       }
       
-      return out.size();
+      virtual void run(size_t index)
+      {
+         mVolume->openFile(*(mVolume->mFiles[index]));
+      }
+      
+   private:
+      
+      VolumeData *mVolume;
+   };
+   
+   // Generated MIP levels stop at this resolution
+   static const int MinMipResolution = 8;
+   // Progressive mode proxies resolution
+   static const int ProxyResolution = 64;
+   
+   typedef std::map<std::string, std::vector<size_t> > FieldIndices;
+   typedef std::deque<FieldData> Fields;
+   typedef std::vector<LayerData*> Layers;
+   typedef std::deque<VolumeData*> FrameCache;
+   
+   // fill in with whatever necessary
+   const AtNode *mNode;
+   std::vector<FileData*> mFiles;
+   // files keys, see FilesKey
+   std::string mFileKey;
+   
+   // ';' separated list of files
+   std::string mPath;
+   // ';' separated list of files patterns (frame and wildcards)
+   std::string mPathPattern;
+   std::string mPartition;
+   bool mIgnoreTransform;
+   bool mVerbose;
+   std::map<std::string, SampleMergeType> mChannelsMergeType;
+   float mFrame;
+   float mFPS;
+   std::vector<std::string> mVelocityFields;
+   float mVelocityScale;
+   bool mWorldSpaceVelocity;
+   float mMotionStartFrame; // relative to mFrame
+   float mMotionEndFrame; // relative to mFrame
+   ShutterTimeType mShutterTimeType;
+   bool mLazyLoad;
+   bool mRenderCache;
+   bool mSharedCache;
+   std::string mStageDir;
+   float mStageSize; // in MB, 0 for no limit
+   int mDownsample;
+   bool mMipmap;
+   bool mDenseToSparse;
+   bool mBricked;
+   std::map<std::string, StoragePrecision> mChannelsPrecision;
+   bool mCompress;
+   bool mArena;
+   HugePages mHugePages;
+   float mMemoryLimit; // in MB
+   float mSequentialRead; // in MB, 0 to disable
+   bool mBoundsOnly;
+   int mLoadThreads; // 0 to use arnold threads count
+   int mIOThreads; // 0 to use arnold threads count
+   bool mPreload;
+   bool mProgressive;
+   void *mPreloadThread;
+   // set by the preload thread when it exits
+   AtomicInt mPreloadDone;
+   AtomicInt mCancelLoad;
+   int mFrameCacheSize;
+   float mFrameCacheMemory; // in MB, 0 for no limit
+   FrameCache mFrameCache;
+   int mPrefetch;
+   void *mPrefetchThread;
+   AtomicInt mCancelPrefetch;
+   
+   FieldIndices mFieldIndices;
+   Fields mFields;
+   // over mFields world space bounds
+   FieldGrid mFieldGrid;
+   Layers mLayers;
+};
+
+// ---
+
+#if AI_VERSION_ARCH_NUM > 4
+#   define HAS_VOLUME_UPDATE
+#elif AI_VERSION_ARCH_NUM == 4
+#   if AI_VERSION_MAJOR_NUM > 2
+#      define HAS_VOLUME_UPDATE
+#   elif AI_VERSION_MAJOR_NUM == 2
+#      if AI_VERSION_MINOR_NUM >= 6
+#         define HAS_VOLUME_UPDATE
+#      endif
+#   endif
+#endif
+
+bool F3D_Init(void **user_ptr)
+{
+   Field3D::initIO();
+   FieldCache::Init();
+#ifndef _WIN32
+   SharedSegments::CleanupStale(RenderCache::Magic);
+#endif
+   return true;
+}
+
+bool F3D_Cleanup(void *user_ptr)
+{
+   SparseBlockCache::Report();
+   FieldCache::Cleanup();
+   ClearDecodeCaches();
+#ifndef _WIN32
+   // after the cache released this process segments
+   SharedSegments::CleanupStale(RenderCache::Magic);
+#endif
+   return true;
+}
+
+bool F3D_CreateVolume(void *user_ptr, const char *user_string, const AtNode *node, AtVolumeData *data)
+{
+   VolumeData *volume_data = new VolumeData();
+   
+   bool rv = volume_data->init(node, user_string);
+   
+   if (rv)
+   {
+      volume_data->computeBounds(data->bbox, data->auto_step_size);
+   }
+   else
+   {
+      AiMsgWarning("[volume_field3d] Failed to initialize volume data");
+      data->bbox.min = AI_P3_ZERO;
+      data->bbox.max = AI_P3_ZERO;
+      data->auto_step_size = std::numeric_limits<float>::max();
    }
    
-   bool readBoolUserAttr(const AtNode *node, const char *paramName, bool &out)
+   data->private_info = (void*) volume_data;
+   
+   return rv;
+}
+
+#ifdef HAS_VOLUME_UPDATE
+bool F3D_UpdateVolume(void *user_ptr, const char *user_string, const AtNode *node, AtVolumeData *data)
+{
+   VolumeData *volume_data = (VolumeData*) data->private_info;
+   
+   if (volume_data)
    {
-      const AtUserParamEntry *param = AiNodeLookUpUserParameter(node, paramName);
-      
-      if (param && AiUserParamGetCategory(param) == AI_USERDEF_CONSTANT)
+      if (volume_data->update(node, user_string))
       {
-         int ptype = AiUserParamGetType(param);
-         
-         switch (ptype)
-         {
-         case AI_TYPE_BOOLEAN:
-            out = AiNodeGetBool(node, paramName);
-            break;
-         case AI_TYPE_BYTE:
-            out = (AiNodeGetByte(node, paramName) != 0);
-            break;
-         case AI_TYPE_INT:
-            out = (AiNodeGetInt(node, paramName) != 0);
-            break;
-         case AI_TYPE_UINT:
-            out = (AiNodeGetUInt(node, paramName) != 0);
-            break;
-         default:
-            return false;
-         }
-         
+         volume_data->computeBounds(data->bbox, data->auto_step_size);
          return true;
       }
       else
       {
+         data->bbox.min = AI_P3_ZERO;
+         data->bbox.max = AI_P3_ZERO;
+         data->auto_step_size = std::numeric_limits<float>::max();
          return false;
       }
    }
+   else
+   {
+      data->bbox.min = AI_P3_ZERO;
+      data->bbox.max = AI_P3_ZERO;
+      data->auto_step_size = std::numeric_limits<float>::max();
+      return false;
+   }
+}
+#endif
+
+bool F3D_CleanupVolume(void *user_ptr, AtVolumeData *data, const AtNode *node)
+{
+   VolumeData *volume_data = (VolumeData*) data->private_info;
    
-   bool readFloatUserAttr(const AtNode *node, const char *paramName, float &out)
+   delete volume_data;
+   
+   return true;
+}
+
+void F3D_RayExtents(void *user_ptr, const AtVolumeData *data, const AtVolumeIntersectionInfo *info, AtByte tid, float time, const AtPoint *origin, const AtVector *direction, float t0, float t1)
+{
+   VolumeData *volume_data = (VolumeData*) data->private_info;
+   
+   if (volume_data)
    {
-      const AtUserParamEntry *param = AiNodeLookUpUserParameter(node, paramName);
-      
-      if (param && AiUserParamGetCategory(param) == AI_USERDEF_CONSTANT)
+      volume_data->rayExtents(info, tid, time, origin, direction, t0, t1);
+   }
+}
+
+bool F3D_Sample(void *user_ptr, const AtVolumeData *data, const char *channel, const AtShaderGlobals *sg, int interp, AtParamValue *value, AtByte *type)
+{
+   VolumeData *volume_data = (VolumeData*) data->private_info;
+   
+   if (volume_data)
+   {
+      return volume_data->sample(channel, sg, interp, value, type);
+   }
+   else
+   {
+      return false;
+   }
+}
+
+volume_plugin_loader
+{
+   vtable->Init = F3D_Init;
+   vtable->Cleanup = F3D_Cleanup;
+   vtable->CreateVolume = F3D_CreateVolume;
+   #ifdef HAS_VOLUME_UPDATE
+   vtable->UpdateVolume = F3D_UpdateVolume;
+   #endif
+   vtable->CleanupVolume = F3D_CleanupVolume;
+   vtable->Sample = F3D_Sample;
+   vtable->RayExtents = F3D_RayExtents;
+   strcpy(vtable->version, AI_VERSION);
+   return true;
+}
+
+#ifdef ARNOLD_F3D_TEST
+
+// Self tests ('-selfTest' as first argument): conversions and caches round trips
+
+// Deterministic voxel values, none equal to the dense fields background
+static float TestValue(int i, int j, int k)
+{
+   return 1.0f + float((i * 7 + j * 13 + k * 29) % 101) / 100.0f;
+}
+
+typedef float (*TestValueFunction)(int, int, int);
+
+// Odd resolution so that the last bricks are partial
+template <typename T>
+static typename Field3D::DenseField<T>::Ptr TestDenseField(TestValueFunction valueFunc=TestValue)
+{
+   typename Field3D::DenseField<T>::Ptr field(new Field3D::DenseField<T>());
+   
+   field->name = "test";
+   field->attribute = "density";
+   field->setSize(Field3D::V3i(37, 21, 13));
+   
+   const Field3D::Box3i &dw = field->dataWindow();
+   
+   for (int k=dw.min.z; k<=dw.max.z; ++k)
+   {
+      for (int j=dw.min.y; j<=dw.max.y; ++j)
       {
-         int ptype = AiUserParamGetType(param);
-         
-         switch (ptype)
+         for (int i=dw.min.x; i<=dw.max.x; ++i)
          {
-         case AI_TYPE_BYTE:
-            out = float(AiNodeGetByte(node, paramName));
-            break;
-         case AI_TYPE_INT:
-            out = float(AiNodeGetInt(node, paramName));
-            break;
-         case AI_TYPE_UINT:
-            out = float(AiNodeGetUInt(node, paramName));
-            break;
-         case AI_TYPE_FLOAT:
-            out = AiNodeGetFlt(node, paramName);
-            break;
-         default:
-            return false;
+            field->fastLValue(i, j, k) = T(valueFunc(i, j, k));
          }
-         
-         return true;
-      }
-      else
-      {
-         return false;
       }
    }
    
-   bool readStringUserAttr(const AtNode *node, const char *paramName, std::string &out)
+   return field;
+}
+
+// Compare all voxels of a converted field with the source values, 'tolerance' relative to the value
+template <typename FieldType>
+static bool TestCompare(const char *name, const FieldType &field, double tolerance, TestValueFunction valueFunc=TestValue)
+{
+   const Field3D::Box3i &dw = field.dataWindow();
+   
+   if (dw.size() != Field3D::V3i(36, 20, 12))
    {
-      const AtUserParamEntry *param = AiNodeLookUpUserParameter(node, paramName);
-      
-      if (param && AiUserParamGetCategory(param) == AI_USERDEF_CONSTANT && AiUserParamGetType(param) == AI_TYPE_STRING)
-      {
-         out = AiNodeGetStr(node, paramName);
-         return true;
-      }
-      else
-      {
-         return false;
-      }
+      AiMsgError("[volume_field3d] %s: data window mismatch", name);
+      return false;
    }
    
-   bool readStringArrayUserAttr(const AtNode *node, const char *paramName, char sep, bool strip, std::vector<std::string> &out)
+   for (int k=dw.min.z; k<=dw.max.z; ++k)
    {
-      const AtUserParamEntry *param = AiNodeLookUpUserParameter(node, paramName);
-      
-      if (param && AiUserParamGetCategory(param) == AI_USERDEF_CONSTANT)
+      for (int j=dw.min.y; j<=dw.max.y; ++j)
       {
-         std::string tmp;
-         
-         if (AiUserParamGetType(param) == AI_TYPE_ARRAY && AiUserParamGetArrayType(param) == AI_TYPE_STRING)
+         for (int i=dw.min.x; i<=dw.max.x; ++i)
          {
-            out.clear();
-            
-            AtArray *ary = AiNodeGetArray(node, paramName);
+            double expected = valueFunc(i, j, k);
+            double value = field.fastValue(i, j, k);
             
-            for (unsigned int i=0; i<ary->nelements; ++i)
+            if (fabs(value - expected) > tolerance * expected)
             {
-               tmp = AiArrayGetStr(ary, i);
-               
-               if (strip)
-               {
-                  stripString(tmp);
-               }
-               
-               out.push_back(tmp);
+               AiMsgError("[volume_field3d] %s: voxel (%d, %d, %d) = %f, expected %f", name, i, j, k, value, expected);
+               return false;
             }
-            
-            return true;
-         }
-         else if (AiUserParamGetType(param) == AI_TYPE_STRING)
-         {
-            tmp = AiNodeGetStr(node, paramName);
-            
-            splitString(tmp, sep, strip, out);
-            
-            return true;
-         }
-         else
-         {
-            return false;
          }
       }
-      else
+   }
+   
+   return true;
+}
+
+static bool TestBricked()
+{
+   Field3D::DenseField<float>::Ptr dense = TestDenseField<float>();
+   Arena *arena = Arena::Create(HP_none);
+   
+   BrickedField<float>::Ptr bricked = BrickedField<float>::Cast(DenseToBricked<float>(dense, 2, 0));
+   BrickedField<float>::Ptr arenaBricked = BrickedField<float>::Cast(DenseToBricked<float>(dense, 2, arena));
+   
+   // the fields hold a reference on the arena
+   arena->unref();
+   
+   return (bricked && TestCompare("bricked", *bricked, 0.0) &&
+           arenaBricked && TestCompare("bricked (arena)", *arenaBricked, 0.0));
+}
+
+// Error bound: half the quantization step of the brick value range (values are in [1, 2])
+static bool TestQuantized()
+{
+   Field3D::DenseField<float>::Ptr dense = TestDenseField<float>();
+   StoragePrecision precisions[] = {SP_half, SP_q16, SP_q8};
+   double tolerances[] = {1.0e-3, 1.0e-5, 2.5e-3};
+   
+   for (int p=0; p<3; ++p)
+   {
+      QuantizeStats stats;
+      QuantizedField<float>::Ptr quantized = QuantizedField<float>::Cast(Quantize<float>(dense, precisions[p], 2, stats, 0));
+      
+      if (!quantized || !TestCompare(StoragePrecisionToString(precisions[p]), *quantized, tolerances[p]))
       {
          return false;
       }
    }
    
-private:
+   return true;
+}
+
+// Noisy first row of bricks along z (stored raw), constant elsewhere
+static float TestHalfNoisyValue(int i, int j, int k)
+{
+   return (k < 8 ? TestValue(i, j, k) : 1.0f);
+}
+
+static bool TestCompressed()
+{
+   // not smaller once compressed: the source is kept
+   Field3D::DenseField<float>::Ptr noisy = TestDenseField<float>();
+   
+   if (Compress<float>(noisy, 2, 0) != noisy)
+   {
+      AiMsgError("[volume_field3d] compressed: incompressible field not kept as is");
+      return false;
+   }
+   
+   Field3D::DenseField<float>::Ptr dense = TestDenseField<float>(TestHalfNoisyValue);
+   Arena *arena = Arena::Create(HP_none);
+   
+   CompressedField<float>::Ptr compressed = CompressedField<float>::Cast(Compress<float>(dense, 2, arena));
+   
+   arena->unref();
+   
+   if (!compressed)
+   {
+      AiMsgError("[volume_field3d] compressed: field not compressed");
+      return false;
+   }
+   
+   CompressedField<float>::Accessor accessor(*compressed, 0);
+   
+   bool rv = TestCompare("compressed", accessor, 0.0, TestHalfNoisyValue);
+   
+   CompressedField<float>::ClearCaches();
+   
+   return rv;
+}
+
+static std::string TestPath(const char *name)
+{
+   #ifdef _WIN32
+   const char *dir = getenv("TEMP");
+   return std::string(dir ? dir : ".") + "\\" + name;
+   #else
+   const char *dir = getenv("TMPDIR");
+   return std::string(dir ? dir : "/tmp") + "/" + name;
+   #endif
+}
+
+// Layer whose fields are in a different order than in the file: Field3D groups
+// them by bit depth, the sidecar must map each one back to its own header
+static void TestLayer(SharedLayer &sl, Field3D::FieldRes::Vec &headers)
+{
+   Field3D::DenseField<float>::Ptr f = TestDenseField<float>();
+   Field3D::DenseField<Field3D::half>::Ptr h = TestDenseField<Field3D::half>(TestHalfNoisyValue);
+   
+   // file order: float field first
+   headers.clear();
+   headers.push_back(f);
+   headers.push_back(h);
+   
+   sl.scalarh.push_back(h);
+   sl.scalarf.push_back(f);
+   sl.headerIndices.push_back(1);
+   sl.headerIndices.push_back(0);
+}
+
+static bool TestMappedLayer(const char *name, const SharedLayer &sl)
+{
+   if (sl.scalarh.size() != 1 || sl.scalarf.size() != 1 || sl.headerIndices.size() != 2 ||
+       sl.headerIndices[0] != 1 || sl.headerIndices[1] != 0)
+   {
+      AiMsgError("[volume_field3d] %s: fields not bound to their headers", name);
+      return false;
+   }
+   
+   MappedField<Field3D::half>::Ptr h = MappedField<Field3D::half>::Cast(sl.scalarh[0]);
+   MappedField<float>::Ptr f = MappedField<float>::Cast(sl.scalarf[0]);
+   
+   return (h && TestCompare(name, *h, 1.0e-3, TestHalfNoisyValue) &&
+           f && TestCompare(name, *f, 0.0));
+}
+
+static bool TestRenderCache()
+{
+   SharedLayer sl("test");
+   Field3D::FieldRes::Vec headers;
+   std::string path = TestPath("volume_field3d_test.f3dc");
+   
+   TestLayer(sl, headers);
+   
+   if (!RenderCache::Write(path, "test", sl))
+   {
+      AiMsgError("[volume_field3d] render cache: could not write \"%s\"", path.c_str());
+      return false;
+   }
+   
+   SharedLayer mapped("test");
+   SharedLayer mismatch("test");
+   
+   bool rv = (RenderCache::Read(path, "test", false, headers, mapped) &&
+              TestMappedLayer("render cache", mapped) &&
+              !RenderCache::Read(path, "other key", false, headers, mismatch));
+   
+   remove(path.c_str());
+   
+   return rv;
+}
+
+#ifndef _WIN32
+
+static bool TestSharedCache()
+{
+   SharedLayer sl("test");
+   Field3D::FieldRes::Vec headers;
+   char tmp[64];
+   
+   sprintf(tmp, "test|%d", int(getpid()));
+   
+   std::string name = SharedSegments::Name(tmp);
+   
+   TestLayer(sl, headers);
+   
+   if (!RenderCache::Publish(name, "test", sl))
+   {
+      AiMsgError("[volume_field3d] shared cache: could not publish \"%s\"", name.c_str());
+      return false;
+   }
+   
+   // the layer is published once, a complete segment isn't cleaned up while used
+   bool rv = !RenderCache::Publish(name, "test", sl);
    
-   typedef std::map<std::string, std::vector<size_t> > FieldIndices;
-   typedef std::deque<FieldData> Fields;
+   SharedSegments::Cleanup(name, RenderCache::Magic);
    
-   // fill in with whatever necessary
-   const AtNode *mNode;
-   Field3D::Field3DInputFile *mF3DFile;
+   {
+      SharedLayer mapped("test");
+      
+      rv = (rv &&
+            RenderCache::Map(MappedFile::OpenShared(name), "test", false, headers, mapped) &&
+            TestMappedLayer("shared cache", mapped));
+   }
    
-   std::string mPath;
-   std::string mPartition;
-   bool mIgnoreTransform;
-   bool mVerbose;
-   std::map<std::string, SampleMergeType> mChannelsMergeType;
-   float mFrame;
-   float mFPS;
-   std::vector<std::string> mVelocityFields;
-   float mVelocityScale;
-   bool mWorldSpaceVelocity;
-   float mMotionStartFrame; // relative to mFrame
-   float mMotionEndFrame; // relative to mFrame
-   ShutterTimeType mShutterTimeType;
+   SharedSegments::Detach(name);
    
-   FieldIndices mFieldIndices;
-   Fields mFields;
-};
-
-// ---
+   // removed with its last user
+   MappedFile *mf = MappedFile::OpenShared(name);
+   
+   if (mf)
+   {
+      AiMsgError("[volume_field3d] shared cache: \"%s\" not removed", name.c_str());
+      mf->unref();
+      rv = false;
+   }
+   
+   // segments of a killed render, that no process looks up anymore
+   pid_t child = fork();
+   
+   if (child == 0)
+   {
+      // exits without detaching
+      _exit(RenderCache::Publish(name, "test", sl) ? 0 : 1);
+   }
+   
+   int status = 0;
+   
+   rv = (rv && child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+   
+   int fd = shm_open(name.c_str(), O_RDONLY, 0);
+   
+   if (fd == -1)
+   {
+      AiMsgError("[volume_field3d] shared cache: \"%s\" not published by child process", name.c_str());
+      rv = false;
+   }
+   else
+   {
+      close(fd);
+   }
+   
+   SharedSegments::CleanupStale(RenderCache::Magic);
+   
+   fd = shm_open(name.c_str(), O_RDONLY, 0);
+   
+   if (fd != -1 || (fd = shm_open((name + ".refs").c_str(), O_RDONLY, 0)) != -1)
+   {
+      AiMsgError("[volume_field3d] shared cache: stale \"%s\" not removed", name.c_str());
+      close(fd);
+      rv = false;
+   }
+   
+   return rv;
+}
 
-#if AI_VERSION_ARCH_NUM > 4
-#   define HAS_VOLUME_UPDATE
-#elif AI_VERSION_ARCH_NUM == 4
-#   if AI_VERSION_MAJOR_NUM > 2
-#      define HAS_VOLUME_UPDATE
-#   elif AI_VERSION_MAJOR_NUM == 2
-#      if AI_VERSION_MINOR_NUM >= 6
-#         define HAS_VOLUME_UPDATE
-#      endif
-#   endif
 #endif
 
-bool F3D_Init(void **user_ptr)
+static bool TestMakeDir(const std::string &dir)
 {
-   Field3D::initIO();
-   return true;
+   #ifdef _WIN32
+   return (CreateDirectoryA(dir.c_str(), NULL) || GetLastError() == ERROR_ALREADY_EXISTS);
+   #else
+   return (mkdir(dir.c_str(), 0777) == 0 || errno == EEXIST);
+   #endif
 }
 
-bool F3D_Cleanup(void *user_ptr)
+static void TestRemoveDir(const std::string &dir)
 {
-   return true;
+   #ifdef _WIN32
+   RemoveDirectoryA(dir.c_str());
+   #else
+   rmdir(dir.c_str());
+   #endif
 }
 
-bool F3D_CreateVolume(void *user_ptr, const char *user_string, const AtNode *node, AtVolumeData *data)
+static bool TestWriteFile(const std::string &path, size_t size)
 {
-   VolumeData *volume_data = new VolumeData();
+   std::vector<char> data(size);
    
-   bool rv = volume_data->init(node, user_string);
-   
-   if (rv)
+   for (size_t i=0; i<size; ++i)
    {
-      volume_data->computeBounds(data->bbox, data->auto_step_size);
+      data[i] = char(i * 31);
    }
-   else
+   
+   FILE *f = fopen(path.c_str(), "wb");
+   
+   if (!f)
    {
-      AiMsgWarning("[volume_field3d] Failed to initialize volume data");
-      data->bbox.min = AI_P3_ZERO;
-      data->bbox.max = AI_P3_ZERO;
-      data->auto_step_size = std::numeric_limits<float>::max();
+      return false;
    }
    
-   data->private_info = (void*) volume_data;
+   bool ok = (fwrite(&data[0], 1, size, f) == size);
    
-   return rv;
+   return (fclose(f) == 0 && ok);
 }
 
-#ifdef HAS_VOLUME_UPDATE
-bool F3D_UpdateVolume(void *user_ptr, const char *user_string, const AtNode *node, AtVolumeData *data)
+static bool TestReadFile(const std::string &path, std::vector<char> &data)
 {
-   VolumeData *volume_data = (VolumeData*) data->private_info;
+   FILE *f = fopen(path.c_str(), "rb");
    
-   if (volume_data)
+   if (!f)
    {
-      if (volume_data->update(node, user_string))
-      {
-         volume_data->computeBounds(data->bbox, data->auto_step_size);
-         return true;
-      }
-      else
-      {
-         data->bbox.min = AI_P3_ZERO;
-         data->bbox.max = AI_P3_ZERO;
-         data->auto_step_size = std::numeric_limits<float>::max();
-         return false;
-      }
+      return false;
    }
-   else
+   
+   char buffer[4096];
+   size_t n;
+   
+   data.clear();
+   
+   while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
    {
-      data->bbox.min = AI_P3_ZERO;
-      data->bbox.max = AI_P3_ZERO;
-      data->auto_step_size = std::numeric_limits<float>::max();
-      return false;
+      data.insert(data.end(), buffer, buffer + n);
    }
+   
+   fclose(f);
+   
+   return true;
 }
-#endif
 
-bool F3D_CleanupVolume(void *user_ptr, AtVolumeData *data, const AtNode *node)
+static bool TestFileExists(const std::string &path)
 {
-   VolumeData *volume_data = (VolumeData*) data->private_info;
+   struct stat st;
+   return (stat(path.c_str(), &st) == 0);
+}
+
+static bool TestAge(const std::string &path)
+{
+   struct utimbuf times;
    
-   delete volume_data;
+   times.actime = time(0) - 3600;
+   times.modtime = times.actime;
    
-   return true;
+   return (utime(path.c_str(), &times) == 0);
 }
 
-void F3D_RayExtents(void *user_ptr, const AtVolumeData *data, const AtVolumeIntersectionInfo *info, AtByte tid, float time, const AtPoint *origin, const AtVector *direction, float t0, float t1)
+// A local directory stands for the network storage
+static bool TestStagingCache()
 {
-   VolumeData *volume_data = (VolumeData*) data->private_info;
+   std::string remote = TestPath("volume_field3d_remote");
+   std::string dir = TestPath("volume_field3d_stage");
+   std::string src0 = remote + "/a.f3d";
+   std::string src1 = remote + "/b.f3d";
+   // fits one file only
+   float maxMB = 1500.0f / (1024.0f * 1024.0f);
+   std::vector<char> data0;
+   std::vector<char> data1;
    
-   if (volume_data)
+   bool rv = (TestMakeDir(remote) && TestWriteFile(src0, 1000) && TestWriteFile(src1, 1000));
+   
+   std::string local0 = (rv ? StagingCache::Stage(src0, dir, 0.0f, false) : src0);
+   
+   rv = (rv && local0 != src0 &&
+         TestReadFile(src0, data0) && TestReadFile(local0, data1) && data0 == data1 &&
+         StagingCache::Stage(src0, dir, 0.0f, false) == local0);
+   
+   if (!rv)
    {
-      volume_data->rayExtents(info, tid, time, origin, direction, t0, t1);
+      AiMsgError("[volume_field3d] staging cache: could not stage \"%s\"", src0.c_str());
+   }
+   
+   // a copy in use is kept within the grace period, even over budget
+   std::string local1 = src1;
+   
+   if (rv)
+   {
+      TestAge(local0);
+      StagingCache::Touch(local0);
+      
+      local1 = StagingCache::Stage(src1, dir, maxMB, false);
+      
+      rv = (local1 != src1 && TestFileExists(local0) && TestFileExists(local1));
+      
+      if (!rv)
+      {
+         AiMsgError("[volume_field3d] staging cache: copy in use evicted");
+      }
+   }
+   
+   // least recently used copy is evicted once unused
+   if (rv)
+   {
+      TestAge(local0);
+      
+      rv = (StagingCache::Stage(src1, dir, maxMB, false) == local1 &&
+            !TestFileExists(local0) && TestFileExists(local1));
+      
+      if (!rv)
+      {
+         AiMsgError("[volume_field3d] staging cache: unused copy not evicted");
+      }
    }
+   
+   remove(local0.c_str());
+   remove(local1.c_str());
+   remove(src0.c_str());
+   remove(src1.c_str());
+   TestRemoveDir(dir);
+   TestRemoveDir(remote);
+   
+   return rv;
 }
 
-bool F3D_Sample(void *user_ptr, const AtVolumeData *data, const char *channel, const AtShaderGlobals *sg, int interp, AtParamValue *value, AtByte *type)
+static double TestRandom(unsigned int &seed)
 {
-   VolumeData *volume_data = (VolumeData*) data->private_info;
+   seed = seed * 1664525u + 1013904223u;
+   return double(seed >> 8) / double(1 << 24);
+}
+
+static bool TestSegmentHits(const Field3D::Box3d &b, const Field3D::V3d &pos, const Field3D::V3d &dir, double t0, double t1)
+{
+   for (int a=0; a<3; ++a)
+   {
+      if (dir[a] == 0.0)
+      {
+         if (pos[a] < b.min[a] || pos[a] > b.max[a])
+         {
+            return false;
+         }
+      }
+      else
+      {
+         double ta = (b.min[a] - pos[a]) / dir[a];
+         double tb = (b.max[a] - pos[a]) / dir[a];
+         
+         t0 = std::max(t0, std::min(ta, tb));
+         t1 = std::min(t1, std::max(ta, tb));
+      }
+   }
    
-   if (volume_data)
+   return (t0 <= t1);
+}
+
+// One file per simulation tile: 4x4x2 tiles sharing faces, and an empty (invalid) field
+static bool TestFieldGrid()
+{
+   std::vector<Field3D::Box3d> bounds;
+   Field3D::Box3d empty;
+   
+   for (int z=0; z<2; ++z)
    {
-      return volume_data->sample(channel, sg, interp, value, type);
+      for (int y=0; y<4; ++y)
+      {
+         for (int x=0; x<4; ++x)
+         {
+            bounds.push_back(Field3D::Box3d(Field3D::V3d(10.0 * x, 10.0 * y, 10.0 * z),
+                                            Field3D::V3d(10.0 * (x + 1), 10.0 * (y + 1), 10.0 * (z + 1))));
+         }
+      }
    }
-   else
+   
+   empty.makeEmpty();
+   bounds.insert(bounds.begin() + 5, empty);
+   
+   FieldGrid grid;
+   
+   grid.build(bounds);
+   
+   unsigned int seed = 1;
+   bool rv = true;
+   
+   // items are a sorted superset of the boxes containing the point, and not all of them
+   for (int n=0; rv && n<1000; ++n)
    {
-      return false;
+      Field3D::V3d P(60.0 * TestRandom(seed) - 10.0, 60.0 * TestRandom(seed) - 10.0, 40.0 * TestRandom(seed) - 10.0);
+      const size_t *begin = 0;
+      const size_t *end = 0;
+      
+      grid.find(P, begin, end);
+      
+      rv = (size_t(end - begin) < bounds.size() / 2);
+      
+      for (const size_t *c=begin; rv && c+1<end; ++c)
+      {
+         rv = (*c < *(c + 1));
+      }
+      
+      for (size_t i=0; rv && i<bounds.size(); ++i)
+      {
+         rv = (!bounds[i].intersects(P) || std::binary_search(begin, end, i));
+      }
+   }
+   
+   if (!rv)
+   {
+      AiMsgError("[volume_field3d] field grid: point query missed a field");
+   }
+   
+   std::vector<size_t> items;
+   
+   for (int n=0; rv && n<1000; ++n)
+   {
+      Field3D::V3d pos(80.0 * TestRandom(seed) - 20.0, 80.0 * TestRandom(seed) - 20.0, 60.0 * TestRandom(seed) - 20.0);
+      Field3D::V3d dir(TestRandom(seed) - 0.5, TestRandom(seed) - 0.5, TestRandom(seed) - 0.5);
+      
+      // axis aligned rays along tiles faces
+      if (n % 10 == 0)
+      {
+         pos = Field3D::V3d(-5.0, 10.0, 10.0);
+         dir = Field3D::V3d(1.0, 0.0, 0.0);
+      }
+      
+      dir.normalize();
+      
+      double t0 = 30.0 * TestRandom(seed);
+      double t1 = t0 + 60.0 * TestRandom(seed);
+      
+      grid.find(pos, dir, t0, t1, items);
+      
+      for (size_t i=0; rv && i<bounds.size(); ++i)
+      {
+         rv = (bounds[i].isEmpty() || !TestSegmentHits(bounds[i], pos, dir, t0, t1) ||
+               std::binary_search(items.begin(), items.end(), i));
+      }
+   }
+   
+   if (!rv)
+   {
+      AiMsgError("[volume_field3d] field grid: ray query missed a field");
+   }
+   
+   // channel name prefixes stay the same across frames
+   const char *labels[][3] =
+   {
+      {"/sim/tile_003.0012.f3d", "12", "tile_003"},
+      {"/sim/tile_012.0012.f3d", "12", "tile_012"},
+      {"/sim/0012_tile3.f3d", "12", "tile3"},
+      {"/sim/tile3.f3d", "12", "tile3"},
+      {"C:\\sim\\tile3_-5.f3d", "-5", "tile3"}
+   };
+   
+   for (size_t i=0; i<sizeof(labels)/sizeof(labels[0]); ++i)
+   {
+      std::string label = VolumeData::FileLabel(labels[i][0], atoi(labels[i][1]));
+      
+      if (label != labels[i][2])
+      {
+         AiMsgError("[volume_field3d] field grid: \"%s\" label is \"%s\", expected \"%s\"", labels[i][0], label.c_str(), labels[i][2]);
+         rv = false;
+      }
    }
+   
+   return rv;
 }
 
-volume_plugin_loader
+typedef bool (*TestFunction)();
+
+struct TestCase
 {
-   vtable->Init = F3D_Init;
-   vtable->Cleanup = F3D_Cleanup;
-   vtable->CreateVolume = F3D_CreateVolume;
-   #ifdef HAS_VOLUME_UPDATE
-   vtable->UpdateVolume = F3D_UpdateVolume;
-   #endif
-   vtable->CleanupVolume = F3D_CleanupVolume;
-   vtable->Sample = F3D_Sample;
-   vtable->RayExtents = F3D_RayExtents;
-   strcpy(vtable->version, AI_VERSION);
-   return true;
-}
+   const char *name;
+   TestFunction run;
+};
 
-#ifdef ARNOLD_F3D_TEST
+static const TestCase Tests[] =
+{
+   {"bricked", TestBricked},
+   {"quantized", TestQuantized},
+   {"compressed", TestCompressed},
+   {"render cache", TestRenderCache},
+#ifndef _WIN32
+   {"shared cache", TestSharedCache},
+#endif
+   {"staging cache", TestStagingCache},
+   {"field grid", TestFieldGrid}
+};
+
+static int RunTests()
+{
+   int failed = 0;
+   
+   for (size_t i=0; i<sizeof(Tests)/sizeof(Tests[0]); ++i)
+   {
+      bool passed = Tests[i].run();
+      
+      AiMsgInfo("[volume_field3d] Test %s: %s", Tests[i].name, passed ? "passed" : "FAILED");
+      
+      if (!passed)
+      {
+         ++failed;
+      }
+   }
+   
+   return failed;
+}
 
 int main(int argc, char **argv)
 {
+   if (argc > 1 && !strcmp(argv[1], "-selfTest"))
+   {
+      AiBegin();
+      AiMsgSetConsoleFlags(AI_LOG_ALL);
+      
+      int failed = RunTests();
+      
+      AiEnd();
+      
+      return (failed > 0 ? 1 : 0);
+   }
+   
    std::string args = "";
    
    for (int i=1; i<argc; ++i)